@@ -1,19 +1,51 @@
-// Check if a binary file of unsigned 32-bit integers is sorted 
+// Check if a binary file of keys is sorted, and optionally if it is a permutation of the input file
+// The files are read in parallel by all the hardware threads or by numThreads threads
 //
 
 #include "Util.h"
 
 #include <iostream>
+#include <cstdlib>
 #include <cstdint>
 #include <memory>
 #include <functional>
 
+//Check the sorted file, and compare it to the input file if inputFileName is not empty
+//Returns the exit code of the program
+template<typename key>
+int checkFile(std::string fileName, std::string inputFileName, int numThreads) {
+  ems::FileSummary summary;
+  ems::FileSummary inputSummary;
+  try {
+    summary = ems::summarizeFile<key>(fileName, numThreads);
+    if (!inputFileName.empty()) inputSummary = ems::summarizeFile<key>(inputFileName, numThreads);
+  }
+  catch (std::ios_base::failure &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  if (!summary.numValues || !summary.sorted) {
+    std::cout << "File " << fileName.c_str() << " is not sorted " << std::endl;
+    return 1;
+  }
+  std::cout << "File " << fileName.c_str() << " is sorted (" << summary.numValues << " keys, hash " << std::hex << summary.hash << std::dec << ")" << std::endl;
+
+  if (!inputFileName.empty()) {
+    if ((summary.numValues != inputSummary.numValues) || (summary.hash != inputSummary.hash)) {
+      std::cout << "File " << fileName.c_str() << " is not a permutation of " << inputFileName.c_str() << std::endl;
+      return 1;
+    }
+    std::cout << "File " << fileName.c_str() << " is a permutation of " << inputFileName.c_str() << std::endl;
+  }
+  return 0;
+}
 
 int main(int argc, char** argv)
 {
   if (argc < 2) {
     std::cerr << "Too few arguments " << std::endl;
-    if (argc != 0) std::cerr << "Syntax : " << argv[0] << " fileName [keyType]" << std::endl;
+    if (argc != 0) std::cerr << "Syntax : " << argv[0] << " fileName [keyType] [inputFileName] [numThreads]" << std::endl;
     return 1;
   }
 
@@ -21,29 +53,29 @@ int main(int argc, char** argv)
 
   std::string keyType = "uint32";
   if (argc>=3) keyType = argv[2];
-  
-  std::function<bool(std::string)> myCheckSortedFile;
-
-  if (keyType == "uint8") myCheckSortedFile = ems::checkSortedFile<uint8_t>;
-  else if (keyType == "uint16") myCheckSortedFile = ems::checkSortedFile<uint16_t>;
-  else if (keyType == "uint32") myCheckSortedFile = ems::checkSortedFile<uint32_t>;
-  else if (keyType == "uint64") myCheckSortedFile = ems::checkSortedFile<uint64_t>;
-  else if (keyType == "int8") myCheckSortedFile = ems::checkSortedFile<int8_t>;
-  else if (keyType == "int16") myCheckSortedFile = ems::checkSortedFile<int16_t>;
-  else if (keyType == "int32") myCheckSortedFile = ems::checkSortedFile<int32_t>;
-  else if (keyType == "int64") myCheckSortedFile = ems::checkSortedFile<int64_t>;
-  else if (keyType == "float") myCheckSortedFile = ems::checkSortedFile<float>;
-  else if (keyType == "double") myCheckSortedFile = ems::checkSortedFile<double>;
+
+  std::string inputFileName;
+  if (argc >= 4) inputFileName = argv[3];
+
+  int numThreads = 0;
+  if (argc >= 5) numThreads = atoi(argv[4]);
+
+  std::function<int(std::string, std::string, int)> myCheckFile;
+
+  if (keyType == "uint8") myCheckFile = checkFile<uint8_t>;
+  else if (keyType == "uint16") myCheckFile = checkFile<uint16_t>;
+  else if (keyType == "uint32") myCheckFile = checkFile<uint32_t>;
+  else if (keyType == "uint64") myCheckFile = checkFile<uint64_t>;
+  else if (keyType == "int8") myCheckFile = checkFile<int8_t>;
+  else if (keyType == "int16") myCheckFile = checkFile<int16_t>;
+  else if (keyType == "int32") myCheckFile = checkFile<int32_t>;
+  else if (keyType == "int64") myCheckFile = checkFile<int64_t>;
+  else if (keyType == "float") myCheckFile = checkFile<float>;
+  else if (keyType == "double") myCheckFile = checkFile<double>;
   else {
     std::cerr << "Invalid key type " << keyType.c_str() << std::endl;
     return 1;
   }
 
-  if (!myCheckSortedFile(fileName)) {
-    std::cout << "File " << fileName.c_str() << " is not sorted " << std::endl;
-    return 1;
-  }
-  std::cout << "File " << fileName.c_str() << " is sorted " << std::endl;
-  return 0;
+  return myCheckFile(fileName, inputFileName, numThreads);
 }
-
@@ -1,4 +1,5 @@
-// Create a binary file of random unsigned 32-bit integers
+// Create a binary file of random keys with a given distribution
+// The file is reproducible from the seed printed (or given), the chunks are generated and written by all the hardware threads
 //
 
 #include "Util.h"
@@ -8,46 +9,74 @@
 #include <cstdint>
 #include <memory>
 #include <functional>
+#include <random>
+
+//Create the file with the options, the overload to store in a std::function
+template<typename key>
+bool createFile(std::string fileName, long long numValues, const ems::KeyGeneratorOptions &options) {
+  return ems::createRandomFile<key>(fileName, numValues, options);
+}
 
 int main(int argc, char** argv)
 {
   if (argc < 3) {
     std::cerr << "Too few arguments " << std::endl;
-    if (argc != 0) std::cerr << "Syntax : " << argv[0] << " fileName numValues [keyType] [chunkSize]" << std::endl;
+    if (argc != 0) std::cerr << "Syntax : " << argv[0] << " fileName numValues [keyType] [chunkSize] [distribution] [parameter] [seed] [numThreads]" << std::endl;
     return 1;
   }
 
   std::string fileName = argv[1];
   long long numValues = atoll(argv[2]);
-  
+
 
   std::string keyType = "uint32";
   if (argc >= 4) keyType = argv[3];
 
-  std::function<bool(std::string, long long, long long)> myCreateRandomFile;
-
-  if (keyType == "uint8") myCreateRandomFile = ems::createRandomFile<uint8_t>;
-  else if (keyType == "uint16") myCreateRandomFile = ems::createRandomFile<uint16_t>;
-  else if (keyType == "uint32") myCreateRandomFile = ems::createRandomFile<uint32_t>;
-  else if (keyType == "uint64") myCreateRandomFile = ems::createRandomFile<uint64_t>;
-  else if (keyType == "int8") myCreateRandomFile = ems::createRandomFile<int8_t>;
-  else if (keyType == "int16") myCreateRandomFile = ems::createRandomFile<int16_t>;
-  else if (keyType == "int32") myCreateRandomFile = ems::createRandomFile<int32_t>;
-  else if (keyType == "int64") myCreateRandomFile = ems::createRandomFile<int64_t>;
-  else if (keyType == "float") myCreateRandomFile = ems::createRandomFile<float>;
-  else if (keyType == "double") myCreateRandomFile = ems::createRandomFile<double>;
+  std::function<bool(std::string, long long, const ems::KeyGeneratorOptions &)> myCreateRandomFile;
+
+  if (keyType == "uint8") myCreateRandomFile = createFile<uint8_t>;
+  else if (keyType == "uint16") myCreateRandomFile = createFile<uint16_t>;
+  else if (keyType == "uint32") myCreateRandomFile = createFile<uint32_t>;
+  else if (keyType == "uint64") myCreateRandomFile = createFile<uint64_t>;
+  else if (keyType == "int8") myCreateRandomFile = createFile<int8_t>;
+  else if (keyType == "int16") myCreateRandomFile = createFile<int16_t>;
+  else if (keyType == "int32") myCreateRandomFile = createFile<int32_t>;
+  else if (keyType == "int64") myCreateRandomFile = createFile<int64_t>;
+  else if (keyType == "float") myCreateRandomFile = createFile<float>;
+  else if (keyType == "double") myCreateRandomFile = createFile<double>;
   else {
     std::cerr << "Invalid key type " << keyType.c_str() << std::endl;
     return 1;
   }
 
-  long long chunkSize = 10000;
-  if (argc >= 5) chunkSize = atoll(argv[4]);
+  ems::KeyGeneratorOptions options;
+  if (argc >= 5) options.chunkSize = atoll(argv[4]);
+
+  if ((argc >= 6) && !ems::parseKeyDistribution(argv[5], options.distribution)) {
+    std::cerr << "Invalid distribution " << argv[5] << std::endl;
+    return 1;
+  }
+
+  //The parameter of the distribution: percentage of swapped keys, number of unique keys or Zipf exponent
+  if (argc >= 7) {
+    double parameter = atof(argv[6]);
+    options.swapPercent = parameter;
+    options.numUniqueKeys = static_cast<long long>(parameter);
+    options.zipfExponent = parameter;
+  }
 
-  if (!myCreateRandomFile(fileName,numValues,chunkSize)) {
+  if (argc >= 8) options.seed = strtoull(argv[7], nullptr, 10);
+  else {
+    std::random_device rd;
+    options.seed = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+  }
+
+  if (argc >= 9) options.numThreads = atoi(argv[8]);
+
+  if (!myCreateRandomFile(fileName, numValues, options)) {
     std::cerr << "Error creating file " << fileName.c_str() << std::endl;
     return 1;
   }
+  std::cout << "Created file " << fileName.c_str() << " with seed " << options.seed << std::endl;
   return 0;
 }
-
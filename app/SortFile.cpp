@@ -7,6 +7,7 @@
 #include <cstdlib>
 #include <cstdint>
 #include <memory>
+#include <string>
 
 #ifdef WITH_CUDA
 #include "SortFileCuda.h"
@@ -15,6 +16,8 @@
 int numThreads;
 long long dataSizePerThread;
 long long numMergesPerThread;
+//Memory budget in bytes replacing numThreads, dataSizePerThread and numMergesPerThread, 0 if none
+long long memoryBudget;
 std::string inputFileName;
 std::string outputFileName;
 std::string profilingFileName;
@@ -39,8 +42,11 @@ int sortFile() {
   ems::SortFunction<key> cudaSortFunc = sortCuda<key>;
   for (int i = 0; i < numGpuThreads; i++) mergeSort.setSortFunction(cudaSortFunc, i);
 #endif //WITH_CUDA
-  mergeSort.setDataSizePerThread(dataSizePerThread);
-  mergeSort.setNumMergesPerThread(numMergesPerThread);
+  if (memoryBudget) mergeSort.setMemoryBudget(memoryBudget);
+  else {
+    mergeSort.setDataSizePerThread(dataSizePerThread);
+    mergeSort.setNumMergesPerThread(numMergesPerThread);
+  }
   if(!profilingFileName.empty()) mergeSort.setProfilingFileName(profilingFileName.c_str());
 
 
@@ -56,7 +62,7 @@ int main(int argc, char** argv)
 {
   if (argc < 3) {
     std::cerr << "Too few arguments " << std::endl;
-    if (argc != 0) std::cerr << "Syntax : " << argv[0] << " inputFileName outputFileName [keyType] [numThreads] [dataSizePerThread] [numMergesPerThread] [numGpuThreads] [profilingFileName]" << std::endl;
+    if (argc != 0) std::cerr << "Syntax : " << argv[0] << " inputFileName outputFileName [keyType] [numThreads] [dataSizePerThread|memoryBudget(K|M|G)] [numMergesPerThread] [numGpuThreads] [profilingFileName]" << std::endl;
     return 1;
   }
 
@@ -69,7 +75,19 @@ int main(int argc, char** argv)
   std::string keyType = "uint32";
   if (argc > 3) keyType = argv[3];
   dataSizePerThread = 10000000LL;
-  if (argc > 5) dataSizePerThread = atoll(argv[5]);
+  memoryBudget = 0;
+  if (argc > 5) {
+    //A size with a K, M or G suffix is the memory budget of the whole sort
+    std::string dataSize = argv[5];
+    int shift = 0;
+    switch (dataSize.empty() ? ' ' : dataSize.back()) {
+    case 'K': shift = 10; break;
+    case 'M': shift = 20; break;
+    case 'G': shift = 30; break;
+    }
+    if (shift) memoryBudget = atoll(dataSize.c_str()) << shift;
+    else dataSizePerThread = atoll(dataSize.c_str());
+  }
   numMergesPerThread = 10LL;
   if (argc > 6) numMergesPerThread = atoll(argv[6]);
 
@@ -0,0 +1,367 @@
+// Benchmark suite of the library: in-memory sort functions, merge kernels, thread pool dispatch and external sorts
+// Syntax : ems_bench [suite...] [--size numValues] [--repeat numRepeats] [--dir directory] [--json fileName]
+//                    [--baseline fileName] [--tolerance fraction]
+// suite can be sort, merge, threadpool or external (all of them by default)
+// The results are printed as a table and written in a JSON file with --json. With --baseline they are compared to
+// the results of a JSON file written by an earlier run, the program fails if a result is worse than its baseline
+// by more than the tolerance (default 0.1). Benchmarks should be built with -DCMAKE_BUILD_TYPE=Release.
+
+#include "ExternalMergeSort.h"
+#include "SimdSort.h"
+#include "MergeKernel.h"
+#include "ThreadPool.h"
+#include "KeyGenerator.h"
+#include "Util.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <atomic>
+#include <stdexcept>
+
+//Result of a benchmark, named suite/case
+struct BenchResult {
+  std::string name;
+  double value;
+  std::string unit;
+  bool higherIsBetter;
+};
+
+//Options of the benchmarks
+struct BenchOptions {
+  //Number of keys of the sort and merge benchmarks, the external sorts use 4 times more
+  long long numValues;
+  //Each measure is the best of numRepeats runs
+  int numRepeats;
+  //Directory of the files of the external sorts
+  std::string directory;
+};
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+double secondsSince(BenchClock::time_point startTime) {
+  return std::chrono::duration<double>(BenchClock::now() - startTime).count();
+}
+
+void addResult(std::vector<BenchResult> &results, const std::string &name, double value, const std::string &unit, bool higherIsBetter) {
+  BenchResult result = { name, value, unit, higherIsBetter };
+  results.push_back(result);
+  std::cout << std::setw(40) << std::left << name << std::setw(12) << std::right << std::fixed << std::setprecision(2) << value << ' ' << unit << std::endl;
+}
+
+//Sort uniform keys with each sort function, in millions of keys per second
+template<typename key>
+void benchSortType(const std::string &typeName, const BenchOptions &options, std::vector<BenchResult> &results) {
+  std::vector<key> input(options.numValues);
+  ems::KeyGeneratorOptions generatorOptions;
+  generatorOptions.seed = 1;
+  ems::generateKeys(input.data(), 0, options.numValues, options.numValues, generatorOptions);
+
+  std::vector<std::pair<std::string, ems::SortFunction<key>>> sortFunctions = {
+    { "default", ems::DefaultSortFunction<key>::get() },
+    { "std", std::sort<typename std::vector<key>::iterator> },
+    { "simd", ems::simdSort<key> }
+  };
+  for (auto &sortFunction : sortFunctions) {
+    double bestSeconds = std::numeric_limits<double>::max();
+    for (int r = 0; r < options.numRepeats; r++) {
+      std::vector<key> values = input;
+      auto startTime = BenchClock::now();
+      sortFunction.second(values.begin(), values.end());
+      bestSeconds = std::min(bestSeconds, secondsSince(startTime));
+      if (!std::is_sorted(values.begin(), values.end())) throw std::runtime_error("Keys not sorted by " + sortFunction.first);
+    }
+    addResult(results, "sort/" + sortFunction.first + "/" + typeName, options.numValues / bestSeconds / 1e6, "Mkeys/s", true);
+  }
+}
+
+void benchSort(const BenchOptions &options, std::vector<BenchResult> &results) {
+  benchSortType<uint8_t>("uint8", options, results);
+  benchSortType<uint16_t>("uint16", options, results);
+  benchSortType<uint32_t>("uint32", options, results);
+  benchSortType<uint64_t>("uint64", options, results);
+  benchSortType<int32_t>("int32", options, results);
+  benchSortType<int64_t>("int64", options, results);
+  benchSortType<float>("float", options, results);
+  benchSortType<double>("double", options, results);
+}
+
+//Merge sorted runs served by blocks of blockSize keys (as the input file buffers of a merge task), returns the seconds taken
+double benchMergeKernel(ems::MergeKernel kernel, const std::vector<std::vector<uint32_t>> &runData, long long blockSize, uint64_t &checksum) {
+  long long numRuns = runData.size();
+  std::vector<long long> runPos(numRuns, 0);
+  std::vector<ems::MergeRun<uint32_t>> runs(numRuns);
+  for (auto &run : runs) run.begin = run.end = nullptr;
+
+  ems::MergeRefillFunction<uint32_t> refill = [&](long long i, ems::MergeRun<uint32_t> &run) {
+    long long numRead = std::min<long long>(blockSize, runData[i].size() - runPos[i]);
+    if (numRead <= 0) return false;
+    run.begin = runData[i].data() + runPos[i];
+    run.end = run.begin + numRead;
+    runPos[i] += numRead;
+    return true;
+  };
+
+  std::vector<uint32_t> outputBuffer(blockSize);
+  ems::MergeOutput<uint32_t> output;
+  output.begin = output.pos = outputBuffer.data();
+  output.end = outputBuffer.data() + blockSize;
+
+  //Consume the output so that the merge cannot be optimized away
+  ems::MergeFlushFunction<uint32_t> flush = [&](ems::MergeOutput<uint32_t> &out) {
+    checksum += *out.begin + *(out.pos - 1);
+    out.pos = out.begin;
+  };
+
+  auto startTime = BenchClock::now();
+  ems::mergeRuns(kernel, runs, output, refill, flush);
+  return secondsSince(startTime);
+}
+
+//Merge uniform uint32 runs with each kernel and fan-in, in millions of keys per second
+void benchMerge(const BenchOptions &options, std::vector<BenchResult> &results) {
+  const long long blockSize = 1 << 16;
+  uint64_t checksum = 0;
+  std::vector<std::pair<std::string, ems::MergeKernel>> kernels = {
+    { "heap", ems::MergeKernel::Heap },
+    { "losertree", ems::MergeKernel::LoserTree },
+    { "cascade", ems::MergeKernel::Cascade }
+  };
+  for (long long numRuns : { 2, 4, 8, 16, 64, 256 }) {
+    std::vector<std::vector<uint32_t>> runData(numRuns);
+    ems::KeyGeneratorOptions generatorOptions;
+    for (long long i = 0; i < numRuns; i++) {
+      generatorOptions.seed = i;
+      runData[i].resize(options.numValues / numRuns);
+      ems::generateKeys(runData[i].data(), 0, runData[i].size(), runData[i].size(), generatorOptions);
+      std::sort(runData[i].begin(), runData[i].end());
+    }
+    long long numMerged = (options.numValues / numRuns) * numRuns;
+
+    for (auto &kernel : kernels) {
+      double bestSeconds = std::numeric_limits<double>::max();
+      for (int r = 0; r < options.numRepeats; r++) bestSeconds = std::min(bestSeconds, benchMergeKernel(kernel.second, runData, blockSize, checksum));
+      addResult(results, "merge/" + kernel.first + "/" + std::to_string(numRuns), numMerged / bestSeconds / 1e6, "Mkeys/s", true);
+    }
+  }
+  //Print the checksum so that the merges are not optimized away
+  std::cerr << "merge checksum " << checksum << std::endl;
+}
+
+//Empty task whose handler may add two children, forming a tree of tasks added by the workers
+struct BenchTask : public ems::Task {
+  int depth;
+};
+
+//Time per task of the thread pool, in nanoseconds
+void benchThreadPool(const BenchOptions &options, std::vector<BenchResult> &results) {
+  const int depth = 16;
+  const long long numTasks = 1LL << depth;
+  int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+  std::atomic<long long> numHandled(0);
+
+  //Tasks added from outside the workers go through the shared queue, tasks added by the workers through their deques
+  for (bool fromWorkers : { false, true }) {
+    double bestSeconds = std::numeric_limits<double>::max();
+    for (int r = 0; r < options.numRepeats; r++) {
+      ems::ThreadPool pool;
+      pool.addTaskHandler<BenchTask>([&](int, ems::Task *task) {
+        numHandled++;
+        BenchTask *benchTask = static_cast<BenchTask *>(task);
+        if (!fromWorkers || !benchTask->depth) return;
+        for (int i = 0; i < 2; i++) {
+          auto child = std::make_shared<BenchTask>();
+          child->depth = benchTask->depth - 1;
+          pool.addTask(child);
+        }
+      });
+
+      auto startTime = BenchClock::now();
+      if (fromWorkers) {
+        auto root = std::make_shared<BenchTask>();
+        root->depth = depth - 1;
+        pool.addTask(root);
+      }
+      else {
+        for (long long i = 0; i < numTasks - 1; i++) {
+          auto task = std::make_shared<BenchTask>();
+          task->depth = 0;
+          pool.addTask(task);
+        }
+      }
+      pool.handleTasks(numWorkers, true);
+      pool.join();
+      bestSeconds = std::min(bestSeconds, secondsSince(startTime));
+      if (pool.getThreadException()) throw std::runtime_error("Exception in the thread pool");
+    }
+    addResult(results, std::string("threadpool/") + (fromWorkers ? "worker" : "shared"), bestSeconds / (numTasks - 1) * 1e9, "ns/task", false);
+  }
+  if (numHandled != 2 * options.numRepeats * (numTasks - 1)) throw std::runtime_error("Tasks not handled by the thread pool");
+}
+
+//External sorts of a file of uniform uint32 keys over a sweep of the parameters, in GB/s of input
+void benchExternal(const BenchOptions &options, std::vector<BenchResult> &results) {
+  long long numValues = 4 * options.numValues;
+  std::string inputFileName = ems::findAvailableFileName(options.directory + "ems_bench_input");
+  std::string outputFileName = ems::findAvailableFileName(options.directory + "ems_bench_output");
+  ems::KeyGeneratorOptions generatorOptions;
+  generatorOptions.seed = 1;
+  if (inputFileName.empty() || outputFileName.empty() || !ems::createRandomFile<uint32_t>(inputFileName, numValues, generatorOptions)) {
+    throw std::runtime_error("Could not create the input file in " + options.directory);
+  }
+
+  std::set<int> threadCounts = { 1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())) };
+  try {
+    for (int numThreads : threadCounts) {
+      //Chunks of 1/8 to 1/128 of the keys of each thread, so that the sort is external
+      for (long long chunkDivisor : { 8, 32, 128 }) {
+        long long dataSizePerThread = std::max(1LL, numValues / numThreads / chunkDivisor);
+        for (long long numMerges : { 4, 16, 64 }) {
+          double bestSeconds = std::numeric_limits<double>::max();
+          for (int r = 0; r < options.numRepeats; r++) {
+            ems::ExternalMergeSort<uint32_t> sorter;
+            sorter.setInputFileName(inputFileName.c_str());
+            sorter.setOutputFileName(outputFileName.c_str());
+            sorter.setNumThreads(numThreads);
+            sorter.setDataSizePerThread(dataSizePerThread);
+            sorter.setNumMergesPerThread(numMerges);
+            auto startTime = BenchClock::now();
+            if (!sorter.sort()) throw std::runtime_error("External sort failed");
+            bestSeconds = std::min(bestSeconds, secondsSince(startTime));
+          }
+          if (!ems::checkSortedFile<uint32_t>(outputFileName)) throw std::runtime_error("External sort output not sorted");
+          std::ostringstream name;
+          name << "external/t" << numThreads << "/dsp" << dataSizePerThread << "/m" << numMerges;
+          addResult(results, name.str(), sizeof(uint32_t) * numValues / bestSeconds / 1e9, "GB/s", true);
+        }
+      }
+    }
+  }
+  catch (...) {
+    remove(inputFileName.c_str());
+    remove(outputFileName.c_str());
+    throw;
+  }
+  remove(inputFileName.c_str());
+  remove(outputFileName.c_str());
+}
+
+//Write the results as JSON, one result per line
+bool writeResults(const std::string &fileName, const std::vector<BenchResult> &results) {
+  std::ofstream file(fileName);
+  if (!file.is_open()) return false;
+  file << "{" << std::endl << "  \"results\": [" << std::endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &result = results[i];
+    file << "    {\"name\": \"" << result.name << "\", \"value\": " << std::setprecision(6) << result.value;
+    file << ", \"unit\": \"" << result.unit << "\", \"higherIsBetter\": " << (result.higherIsBetter ? "true" : "false") << "}";
+    file << ((i + 1 < results.size()) ? "," : "") << std::endl;
+  }
+  file << "  ]" << std::endl << "}" << std::endl;
+  return !file.fail();
+}
+
+//Read the values of the results of a JSON file written by writeResults
+bool readResults(const std::string &fileName, std::map<std::string, double> &values) {
+  std::ifstream file(fileName);
+  if (!file.is_open()) return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t namePos = line.find("\"name\": \"");
+    size_t valuePos = line.find("\"value\": ");
+    if ((namePos == std::string::npos) || (valuePos == std::string::npos)) continue;
+    namePos += 9;
+    size_t nameEnd = line.find('"', namePos);
+    if (nameEnd == std::string::npos) return false;
+    values[line.substr(namePos, nameEnd - namePos)] = atof(line.c_str() + valuePos + 9);
+  }
+  return true;
+}
+
+//Compare the results to the baseline, returns false if a result is worse than its baseline by more than the tolerance
+bool compareResults(const std::vector<BenchResult> &results, const std::map<std::string, double> &baseline, double tolerance) {
+  bool success = true;
+  std::cout << std::endl << std::setw(40) << std::left << "comparison to the baseline" << std::setw(12) << std::right << "baseline" << std::setw(12) << "ratio" << std::endl;
+  for (const BenchResult &result : results) {
+    auto it = baseline.find(result.name);
+    if ((it == baseline.end()) || (it->second <= 0)) continue;
+    //Ratio above 1 when the result is better than the baseline
+    double ratio = result.higherIsBetter ? result.value / it->second : it->second / result.value;
+    bool regression = ratio < 1 - tolerance;
+    success = success && !regression;
+    std::cout << std::setw(40) << std::left << result.name << std::setw(12) << std::right << std::fixed << std::setprecision(2) << it->second;
+    std::cout << std::setw(11) << ratio << 'x' << (regression ? "  REGRESSION" : "") << std::endl;
+  }
+  return success;
+}
+
+int main(int argc, char** argv)
+{
+  BenchOptions options;
+  options.numValues = 1LL << 22;
+  options.numRepeats = 3;
+  std::string jsonFileName;
+  std::string baselineFileName;
+  double tolerance = 0.1;
+  std::vector<std::string> suites;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = (i + 1 < argc);
+    if ((arg == "--size") && hasValue) options.numValues = atoll(argv[++i]);
+    else if ((arg == "--repeat") && hasValue) options.numRepeats = atoi(argv[++i]);
+    else if ((arg == "--dir") && hasValue) options.directory = std::string(argv[++i]) + "/";
+    else if ((arg == "--json") && hasValue) jsonFileName = argv[++i];
+    else if ((arg == "--baseline") && hasValue) baselineFileName = argv[++i];
+    else if ((arg == "--tolerance") && hasValue) tolerance = atof(argv[++i]);
+    else if ((arg == "sort") || (arg == "merge") || (arg == "threadpool") || (arg == "external")) suites.push_back(arg);
+    else {
+      std::cerr << "Syntax : " << argv[0] << " [sort] [merge] [threadpool] [external] [--size numValues] [--repeat numRepeats]"
+        << " [--dir directory] [--json fileName] [--baseline fileName] [--tolerance fraction]" << std::endl;
+      return 1;
+    }
+  }
+  if ((options.numValues < 256) || (options.numRepeats < 1)) {
+    std::cerr << "The size must be at least 256 keys and the number of repeats at least 1" << std::endl;
+    return 1;
+  }
+  if (suites.empty()) suites = { "sort", "merge", "threadpool", "external" };
+
+  std::map<std::string, double> baseline;
+  if (!baselineFileName.empty() && !readResults(baselineFileName, baseline)) {
+    std::cerr << "Could not read the baseline " << baselineFileName << std::endl;
+    return 1;
+  }
+
+  std::vector<BenchResult> results;
+  try {
+    for (auto &suite : suites) {
+      if (suite == "sort") benchSort(options, results);
+      else if (suite == "merge") benchMerge(options, results);
+      else if (suite == "threadpool") benchThreadPool(options, results);
+      else if (suite == "external") benchExternal(options, results);
+    }
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  if (!jsonFileName.empty() && !writeResults(jsonFileName, results)) {
+    std::cerr << "Could not write the results to " << jsonFileName << std::endl;
+    return 1;
+  }
+  if (!baselineFileName.empty() && !compareResults(results, baseline, tolerance)) return 1;
+  return 0;
+}
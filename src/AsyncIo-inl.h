@@ -0,0 +1,64 @@
+#pragma once
+
+namespace ems {
+
+  inline AsyncIo::AsyncIo() :
+    stop_(false)
+  {
+  }
+
+  inline AsyncIo::~AsyncIo() {
+    join();
+  }
+
+  inline std::future<void> AsyncIo::submit(std::function<void()> operation) {
+    std::packaged_task<void()> task(operation);
+    std::future<void> res = task.get_future();
+    {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(operationsMutex_);
+
+      operations_.push_back(std::move(task));
+      stop_ = false;
+      if (!thread_.joinable()) thread_ = std::thread(&AsyncIo::threadFunc, this);
+
+      //Release lock
+    }
+    operationsCondition_.notify_one();
+    return res;
+  }
+
+  inline void AsyncIo::join() {
+    {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(operationsMutex_);
+      stop_ = true;
+      //Release lock
+    }
+    operationsCondition_.notify_one();
+    if (thread_.joinable()) thread_.join();
+  }
+
+  inline void AsyncIo::threadFunc() {
+    while (true) {
+      std::packaged_task<void()> task;
+      {
+        //Acquire lock
+        std::unique_lock<std::mutex> lock(operationsMutex_);
+
+        while (operations_.empty() && !stop_) operationsCondition_.wait(lock);
+
+        //Only stop once all the operations have been performed
+        if (operations_.empty()) return;
+
+        task = std::move(operations_.front());
+        operations_.pop_front();
+
+        //Release lock
+      }
+      //Exceptions are stored in the future
+      task();
+    }
+  }
+
+} //namespace ems
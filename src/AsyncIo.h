@@ -0,0 +1,53 @@
+//Background thread performing I/O operations in submission order
+//Used to overlap disk accesses with computations (read-ahead and write-behind)
+
+#pragma once
+
+#include <deque>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace ems {
+
+  class AsyncIo
+  {
+  public:
+    AsyncIo();
+
+    //Wait for the pending operations and stop the thread
+    ~AsyncIo();
+
+    //Queue an operation, the thread is started by the first submission
+    //The returned future is ready once the operation is performed and rethrows its exceptions
+    std::future<void> submit(std::function<void()> operation);
+
+    //Wait for all the queued operations and stop the thread
+    //Exceptions thrown by the operations are only reported through their futures
+    void join();
+
+  private:
+    //Function executed by the I/O thread
+    void threadFunc();
+
+    //The I/O thread
+    std::thread thread_;
+
+    //Queued operations
+    std::deque<std::packaged_task<void()>> operations_;
+
+    //Mutex for accessing the operations
+    std::mutex operationsMutex_;
+
+    //Condition variable to notify the thread when an operation is queued or when it should stop
+    std::condition_variable operationsCondition_;
+
+    //Indicates that the thread should stop once the queue is empty
+    bool stop_;
+  };
+
+} //namespace ems
+
+#include "AsyncIo-inl.h"
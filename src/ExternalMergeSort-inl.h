@@ -1,10 +1,15 @@
 #pragma once
 
 #include "Util.h"
+#include "AsyncIo.h"
+#include "MergePlan.h"
 
 #include <cstdio>
-#include <queue>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
 #include <iostream>
+#include <algorithm>
 
 namespace ems {
 
@@ -17,24 +22,41 @@ namespace ems {
     pool_.setThreadExceptionHandler([](int, std::exception_ptr) { return false; });
 
     //Set the default handlers for the sort and merge tasks
-    pool_.addTaskHandler<SortChunkTask>(std::bind(&ExternalMergeSort<key>::handleSortChunkTask,this,std::placeholders::_1,std::placeholders::_2,std::sort<typename std::vector<key>::iterator>));
+    setSortFunction(DefaultSortFunction<key>::get());
     pool_.addTaskHandler<MergeFilesTask>(std::bind(&ExternalMergeSort<key>::handleMergeFilesTask, this, std::placeholders::_1, std::placeholders::_2));
+    pool_.addTaskHandler<MergeSlicesTask>(std::bind(&ExternalMergeSort<key>::handleMergeSlicesTask, this, std::placeholders::_1, std::placeholders::_2));
+    pool_.addTaskHandler<CreateFileTask>(std::bind(&ExternalMergeSort<key>::handleCreateFileTask, this, std::placeholders::_1, std::placeholders::_2));
+    pool_.addTaskHandler<CountKeysTask>(std::bind(&ExternalMergeSort<key>::handleCountKeysTask, this, std::placeholders::_1, std::placeholders::_2));
+    pool_.addTaskHandler<WriteKeysTask>(std::bind(&ExternalMergeSort<key>::handleWriteKeysTask, this, std::placeholders::_1, std::placeholders::_2));
+    pool_.addTaskHandler<ScanRunsTask>(std::bind(&ExternalMergeSort<key>::handleScanRunsTask, this, std::placeholders::_1, std::placeholders::_2));
   }
 
   template<typename key>
   void ExternalMergeSort<key>::setSortFunction(SortFunction<key> sortFunc, int threadId) {
     pool_.addTaskHandler<SortChunkTask>(std::bind(&ExternalMergeSort<key>::handleSortChunkTask, this, std::placeholders::_1, std::placeholders::_2, sortFunc),threadId);
+    pool_.addTaskHandler<SortPipelineTask>(std::bind(&ExternalMergeSort<key>::handleSortPipelineTask, this, std::placeholders::_1, std::placeholders::_2, sortFunc), threadId);
+    pool_.addTaskHandler<ReplacementSelectionTask>(std::bind(&ExternalMergeSort<key>::handleReplacementSelectionTask, this, std::placeholders::_1, std::placeholders::_2, sortFunc), threadId);
+    pool_.addTaskHandler<SortSliceTask>(std::bind(&ExternalMergeSort<key>::handleSortSliceTask, this, std::placeholders::_1, std::placeholders::_2, sortFunc), threadId);
   }
   
   template<typename key>
   void ExternalMergeSort<key>::clearSortFunction(int threadId) {
+    clearTaskHandler<SortChunkTask>(threadId);
+    clearTaskHandler<SortPipelineTask>(threadId);
+    clearTaskHandler<ReplacementSelectionTask>(threadId);
+    clearTaskHandler<SortSliceTask>(threadId);
+  }
+
+  template<typename key>
+  template<typename TaskType>
+  void ExternalMergeSort<key>::clearTaskHandler(int threadId) {
     if (threadId == -1) {
       //Only keep the default handler
-      TaskHandler defaultHandler = pool_.getTaskHandler<SortChunkTask>();
-      pool_.removeTaskHandler<SortChunkTask>();
-      pool_.addTaskHandler<SortChunkTask>(defaultHandler);
+      TaskHandler defaultHandler = pool_.getTaskHandler<TaskType>();
+      pool_.removeTaskHandler<TaskType>();
+      pool_.addTaskHandler<TaskType>(defaultHandler);
     }
-    else pool_.removeTaskHandler<SortChunkTask>(threadId);
+    else pool_.removeTaskHandler<TaskType>(threadId);
   }
 
 
@@ -48,47 +70,33 @@ namespace ems {
       }
 
       //Open the input file
-      inFile_.exceptions(std::fstream::failbit | std::fstream::badbit);
-      inFile_.open(inputFileName_, std::ios::in | std::ios::binary);
-      if (!inFile_.is_open()) {
+      if (!inFile_.open(inputFileName_, (directIo_ & DirectInput) ? (File::Read | File::Direct) : File::Read)) {
         std::cerr << "ExternalMergeSort::sortCould not open file " << inputFileName_ << std::endl;
         cleanup();
         return false;
       }
 
       //Unique id used for temporary files
-      int tmpFileId = 0;
+      tmpFileId_ = 0;
+      runRanges_.clear();
 
       //Get the size of the input file
-      inFile_.seekg(0, std::ios::end);
-      long long dataLength = inFile_.tellg();
-      inFile_.seekg(0, std::ios::beg);
+      long long dataLength = inFile_.size();
 
       //File size should be a multiple of sizeof(key)
-      if (dataLength % sizeof(key)) {
+      if ((dataLength < 0) || (dataLength % sizeof(key))) {
         std::cerr << "ExternalMergeSort::sort Invalid file size" << std::endl;
         cleanup();
         return false;
       }
       long long numValues = dataLength / sizeof(key);
 
-      //Get the number of chunks
-      long long numChunks = (numValues + dataSizePerThread_-1) / dataSizePerThread_;
-
-      //Compute the number of levels of merge to apply after the sorting and the number of chunks at each level
-      int numMergeLevels = 0;
-      long long levelSize = numChunks;
-      std::vector<long long> levelNumChunks;
-      while (levelSize>1) {
-        levelNumChunks.push_back(levelSize);
-        numMergeLevels++;
-        levelSize = (levelSize + numMergesPerThread_-1) / numMergesPerThread_;
+      //Pipelined workers use a third of their data for each chunk
+      //With direct I/O the chunks start and end on aligned positions
+      long long chunkSize = alignKeys((pipelinedSort_ && !replacementSelection_) ? dataSizePerThread_ / 3 : dataSizePerThread_);
 
-      }
-
-      //Clear the stored tasks
-      storedTasks_.clear();
-      storedTasks_.resize(numMergeLevels);
+      //Get the number of chunks
+      long long numChunks = (numValues + chunkSize-1) / chunkSize;
 
       //Clear all previous tasks in the pool
       pool_.clearTasks();
@@ -98,120 +106,260 @@ namespace ems {
       std::vector<std::shared_ptr<Task>> completedTasks;
       pool_.setProfile(!profilingFileName_.empty());
 
-      //Create the sort tasks for each chunk 
-      for (long long i = 0; i < numChunks; i++) {
-        std::shared_ptr<SortChunkTask> sortTask = std::make_shared<SortChunkTask>();
-        sortTask->startInd = i*dataSizePerThread_;
-        sortTask->numValues = std::min(dataSizePerThread_, numValues - sortTask->startInd);
-        if (numChunks>1) {
-          sortTask->sortedFileName = findAvailableFileName(outputFileName_,tmpFileId);
-          tmpFileId++;
-          if (sortTask->sortedFileName.empty()) {
-            //No available name found, return
-            std::cerr << "No available filename found " << std::endl;
+      //Narrow integer keys are sorted by counting
+      if (countingSort_ && CountingSortTraits<key>::isSupported && (numValues > 0)) {
+        return sortByCounting(numValues);
+      }
+
+      //Inputs which fit in the data of all the threads are sorted in memory
+      if (inMemorySort_ && (numThreads_ > 1) && (numValues > 0) && (numValues <= numThreads_ * dataSizePerThread_)) {
+        return sortInMemory(numValues);
+      }
+
+      //Presorted input made of fewer natural runs than chunks, the natural runs are merged directly from the input file
+      //They are only read by the merges if the input is not also the output, otherwise only a sorted input is detected
+      std::vector<long long> runStarts;
+      bool useNaturalRuns = false;
+      bool handlingTasks = false;
+      if (adaptiveSort_ && (numChunks > 1)) {
+        pool_.handleTasks(numThreads_);
+        handlingTasks = true;
+        if (findNaturalRuns(numValues, (inputFileName_ != outputFileName_) ? numChunks : 1, runStarts, completedTasks)) {
+          if (runStarts.size() == 1) {
+            //The input is already sorted, it is only copied
+            if (inputFileName_ != outputFileName_) {
+              File outFile;
+              if (!outFile.open(outputFileName_, fileMode(outputFileName_, File::Write))) throw std::ios_base::failure("Could not open file " + outputFileName_);
+              outFile.copyFrom(inFile_, dataLength, 0, 0);
+            }
+            cleanup();
+            if (!profilingFileName_.empty()) {
+              writeProfilingFile(profilingFileName_, numThreads_, pool_.getStartTime(), pool_.getEndTime(), completedTasks);
+            }
+            return true;
+          }
+          useNaturalRuns = true;
+          numChunks = runStarts.size();
+        }
+      }
+
+      //Initial sorted files generated by replacement selection, the files are only known once all the input has been read
+      bool useReplacementSelection = replacementSelection_ && (numChunks > 1) && !useNaturalRuns;
+      //A single compressed file generated by replacement selection is decoded to the output by a merge
+      bool decodeSingleRun = false;
+      if (useReplacementSelection) {
+        //Stored until they are all generated
+        storedTasks_.assign(1, std::vector<std::shared_ptr<Task>>());
+
+        //One contiguous range of the input per thread
+        long long rangeSize = (numValues + numThreads_ - 1) / numThreads_;
+        long long numRanges = (numValues + rangeSize - 1) / rangeSize;
+        for (long long i = 0; i < numRanges; i++) {
+          std::shared_ptr<ReplacementSelectionTask> selectionTask = std::make_shared<ReplacementSelectionTask>();
+          selectionTask->startInd = i*rangeSize;
+          selectionTask->numValues = std::min(rangeSize, numValues - selectionTask->startInd);
+          pool_.addTask(selectionTask);
+        }
+
+        if (!handlingTasks) pool_.handleTasks(numThreads_);
+        handlingTasks = true;
+
+        //Each generated file is described by a sort task so that the merges are scheduled as for the chunks
+        for (long long i = 0; i < numRanges; i++) {
+          std::shared_ptr<Task> completedTask = pool_.getCompletedTask();
+          if (!profilingFileName_.empty()) completedTasks.push_back(completedTask);
+          ReplacementSelectionTask *selectionTask = dynamic_cast<ReplacementSelectionTask *>(completedTask.get());
+          if (!selectionTask) continue;
+          long long startInd = selectionTask->startInd;
+          for (auto runInfo : selectionTask->runs) {
+            std::shared_ptr<SortChunkTask> runTask = std::make_shared<SortChunkTask>();
+            runTask->startInd = startInd;
+            runTask->numValues = runInfo.second;
+            runTask->sortedFileName = runInfo.first;
+            startInd += runInfo.second;
+            storedTasks_[0].push_back(runTask);
+          }
+        }
+        numChunks = storedTasks_[0].size();
+
+        //A single file is already the result
+        SortChunkTask *runTask = (numChunks == 1) ? dynamic_cast<SortChunkTask *>(storedTasks_[0][0].get()) : nullptr;
+        if (runTask && isCompressedRun(runTask->sortedFileName)) decodeSingleRun = true;
+        else if (runTask) {
+          remove(outputFileName_.c_str());
+          if (std::rename(runTask->sortedFileName.c_str(), outputFileName_.c_str())) {
+            std::cerr << "ExternalMergeSort::sort Could not rename " << runTask->sortedFileName << std::endl;
             cleanup();
             return false;
           }
+          runTask->sortedFileName = outputFileName_;
         }
-        else sortTask->sortedFileName = outputFileName_;
-        pool_.addTask(sortTask);
       }
 
-      pool_.handleTasks(numThreads_);
+      //Tasks writing the initial sorted files and their files, then the merges of the plan and their merged files
+      //The natural runs also have their position in the input file
+      std::vector<std::shared_ptr<Task>> levelTasks;
+      std::vector<std::pair<std::string, long long>> levelFiles;
+      std::vector<long long> levelOffsets;
 
-      std::shared_ptr<MergeFilesTask> newMergeTask;
-      std::shared_ptr<Task> completedTask = pool_.getCompletedTask();
+      //Chunks claimed by the pipelined workers
+      std::shared_ptr<SortPipeline> sortPipeline;
 
-      while (completedTask) {
-        //If needed save the task for profiling information
-        if (!profilingFileName_.empty()) completedTasks.push_back(completedTask);
-
-        //Find out the type of the task
-        SortChunkTask *sortTask = dynamic_cast<SortChunkTask *>(completedTask.get());
-        MergeFilesTask *mergeTask = dynamic_cast<MergeFilesTask *>(completedTask.get());
-        if (sortTask) {
-          //Only one chunk, exit directly
-          if (numChunks==1) break;
-          //Store the task
-          storedTasks_[0].push_back(completedTask);
-          //Create a merge task if we have enough stored tasks
-          if (storedTasks_[0].size() == std::min(numMergesPerThread_, levelNumChunks[0])) {
-            //Create the merge task
-            newMergeTask = std::make_shared<MergeFilesTask>();
-            newMergeTask->level = 1;
-            for (auto task : storedTasks_[0]) {
-              SortChunkTask *storedSortTask = dynamic_cast<SortChunkTask *>(task.get());
-              newMergeTask->files.push_back(std::make_pair(storedSortTask->sortedFileName,storedSortTask->numValues));
-            }
-            if (newMergeTask->level == numMergeLevels) {
-              //Last merge level, write directly to output
-              newMergeTask->mergedFileName = outputFileName_;
-            }
-            else {
-              //Find a filename
-              newMergeTask->mergedFileName = findAvailableFileName(outputFileName_, tmpFileId);
-              tmpFileId++;
-              if (newMergeTask->mergedFileName.empty()) {
-                //No available name found, return
-                std::cerr << "No available filename found " << std::endl;
-                cleanup();
-                return false;
-              }
+      if (useReplacementSelection) {
+        //The generated files are handled as completed sort tasks
+        levelTasks.swap(storedTasks_[0]);
+        for (auto &generatedTask : levelTasks) {
+          SortChunkTask *runTask = dynamic_cast<SortChunkTask *>(generatedTask.get());
+          levelFiles.push_back(std::make_pair(runTask->sortedFileName, runTask->numValues));
+          pool_.addCompletedTask(generatedTask);
+        }
+      }
+      else if (useNaturalRuns) {
+        //The natural runs are handled as completed sort tasks whose sorted file is a range of the input file
+        for (size_t r = 0; r < runStarts.size(); r++) {
+          std::shared_ptr<SortChunkTask> runTask = std::make_shared<SortChunkTask>();
+          runTask->startInd = runStarts[r];
+          runTask->numValues = ((r + 1 < runStarts.size()) ? runStarts[r + 1] : numValues) - runStarts[r];
+          runTask->sortedFileName = inputFileName_;
+          key first, last;
+          inFile_.read(&first, sizeof(key), sizeof(key)*runTask->startInd);
+          inFile_.read(&last, sizeof(key), sizeof(key)*(runTask->startInd + runTask->numValues - 1));
+          setRunRange(inputFileName_, runTask->startInd, first, last);
+          levelTasks.push_back(runTask);
+          levelFiles.push_back(std::make_pair(inputFileName_, runTask->numValues));
+          levelOffsets.push_back(runTask->startInd);
+          pool_.addCompletedTask(runTask);
+        }
+      }
+      else {
+        if (pipelinedSort_) sortPipeline = std::make_shared<SortPipeline>();
+
+        //Create the sort tasks for each chunk 
+        for (long long i = 0; i < numChunks; i++) {
+          std::shared_ptr<SortChunkTask> sortTask = std::make_shared<SortChunkTask>();
+          sortTask->startInd = i*chunkSize;
+          sortTask->numValues = std::min(chunkSize, numValues - sortTask->startInd);
+          if (numChunks>1) {
+            sortTask->sortedFileName = getTemporaryFileName();
+            if (sortTask->sortedFileName.empty()) {
+              //No available name found, return
+              std::cerr << "No available filename found " << std::endl;
+              cleanup();
+              return false;
             }
-            //Add the new merge task
-            pool_.addTask(newMergeTask); // , newMergeTask->level);
-            //Decrement the number of chunks for this level
-            levelNumChunks[0] -= storedTasks_[0].size();
-            //Clear the stored tasks
-            storedTasks_[0].clear();
           }
+          else sortTask->sortedFileName = outputFileName_;
+          if (sortPipeline) sortPipeline->chunks.push_back(sortTask);
+          else pool_.addTask(sortTask);
+          levelTasks.push_back(sortTask);
+          levelFiles.push_back(std::make_pair(sortTask->sortedFileName, sortTask->numValues));
         }
-        else if (mergeTask) {         
-          //If the last level has been reached, exit
-          if (mergeTask->level >= numMergeLevels) break;
-
-          //Store the task
-          storedTasks_[mergeTask->level].push_back(completedTask);
-          if (storedTasks_[mergeTask->level].size() == std::min(numMergesPerThread_, levelNumChunks[mergeTask->level])) {
-            //Create the merge task
-            newMergeTask = std::make_shared<MergeFilesTask>();
-            newMergeTask->level = mergeTask->level+1;
-            for (auto task : storedTasks_[mergeTask->level]) {
-              MergeFilesTask *storedMergeTask = dynamic_cast<MergeFilesTask *>(task.get());
-              long long taskNumValues = 0;
-              //Get the number of values for this stored task
-              for (auto fileInfo : storedMergeTask->files) {
-                taskNumValues += fileInfo.second;
-              }
-              newMergeTask->files.push_back(std::make_pair(storedMergeTask->mergedFileName, taskNumValues));
-            }
-            if (newMergeTask->level == numMergeLevels) {
-              //Last merge level, write directly to output
-              newMergeTask->mergedFileName = outputFileName_;
-            }
-            else {
-              //Find a filename
-              newMergeTask->mergedFileName = findAvailableFileName(outputFileName_, tmpFileId);
-              tmpFileId++;
-              if (newMergeTask->mergedFileName.empty()) {
-                //No available name found, return
-                std::cerr << "No available filename found " << std::endl;
-                cleanup();
-                return false;
-              }
-            }
-            //Add the new merge task
-            pool_.addTask(newMergeTask); // , newMergeTask->level);
-            //Decrement the number of chunks for this level
-            levelNumChunks[mergeTask->level] -= storedTasks_[mergeTask->level].size();
-            //Clear the stored tasks
-            storedTasks_[mergeTask->level].clear();
+
+        //One pipeline task per worker, the chunks are claimed dynamically and completed with addCompletedTask
+        if (sortPipeline) {
+          for (long long i = 0; i < std::min<long long>(numThreads_, numChunks); i++) {
+            std::shared_ptr<SortPipelineTask> pipelineTask = std::make_shared<SortPipelineTask>();
+            pipelineTask->pipeline = sortPipeline;
+            pool_.addTask(pipelineTask);
+          }
+        }
+      }
+
+      //The planned tasks are stored so that their files are removed if the sort fails
+      storedTasks_.assign(1, levelTasks);
+
+      //Plan the merges of the sorted files, the chunks are estimated to be sorted in order by all the threads
+      std::vector<long long> runSizes;
+      std::vector<double> runReadyTimes;
+      for (long long i = 0; i < numChunks; i++) {
+        runSizes.push_back(levelFiles[i].second);
+        if (!useReplacementSelection && !useNaturalRuns) runReadyTimes.push_back(static_cast<double>((i / numThreads_ + 1) * chunkSize));
+      }
+      std::vector<PlannedMerge> plan = planMerges(runSizes, runReadyTimes, numMergesPerThread_);
+      //A single compressed file is decoded by a merge of this file only
+      if (decodeSingleRun) {
+        plan.assign(1, PlannedMerge());
+        plan[0].inputs.assign(1, 0);
+        plan[0].numValues = runSizes[0];
+      }
+
+      //Tasks whose completion ends the sort
+      std::vector<std::shared_ptr<Task>> finalTasks;
+      if (plan.empty()) finalTasks = levelTasks;
+
+      //Input files of the final merge when it is split, removed once all its parts are completed
+      std::vector<std::pair<std::string, long long>> splitMergeFiles;
+
+      //Submit the merges of the plan, each merge is enqueued by the worker completing the last of its inputs
+      std::vector<std::shared_ptr<Task>> mergeTasks;
+      for (size_t m = 0; m < plan.size(); m++) {
+        bool finalMerge = (m + 1 == plan.size());
+        std::vector<std::shared_ptr<Task>> inputTasks;
+        std::shared_ptr<MergeFilesTask> mergeTask = std::make_shared<MergeFilesTask>();
+        mergeTask->level = plan[m].level;
+        for (long long input : plan[m].inputs) {
+          inputTasks.push_back(levelTasks[input]);
+          mergeTask->files.push_back(levelFiles[input]);
+          if (!levelOffsets.empty()) mergeTask->fileOffsets.push_back((input < numChunks) ? levelOffsets[input] : 0);
+        }
+        if (finalMerge) {
+          //Last merge, write directly to output
+          mergeTask->mergedFileName = outputFileName_;
+        }
+        else {
+          //Find a filename
+          mergeTask->mergedFileName = getTemporaryFileName();
+          if (mergeTask->mergedFileName.empty()) {
+            //No available name found, return
+            std::cerr << "No available filename found " << std::endl;
+            cleanup();
+            return false;
           }
         }
 
-        completedTask = pool_.getCompletedTask();
+        if (finalMerge && parallelFinalMerge_ && (numThreads_ > 1)) {
+          //The final merge is split between the threads, the parts write their range in place once the merged file is created
+          std::shared_ptr<CreateFileTask> createTask = std::make_shared<CreateFileTask>();
+          createTask->fileName = mergeTask->mergedFileName;
+          createTask->fileSize = sizeof(key)*plan[m].numValues;
+          pool_.addTask(createTask, inputTasks);
+          std::vector<std::shared_ptr<Task>> createDependency(1, createTask);
+          for (int i = 0; i < numThreads_; i++) {
+            std::shared_ptr<MergeFilesTask> partTask = std::make_shared<MergeFilesTask>(*mergeTask);
+            partTask->part = i;
+            partTask->numParts = numThreads_;
+            pool_.addTask(partTask, createDependency);
+            finalTasks.push_back(partTask);
+          }
+          splitMergeFiles = mergeTask->files;
+        }
+        else {
+          pool_.addTask(mergeTask, inputTasks);
+          if (finalMerge) finalTasks.push_back(mergeTask);
+        }
+
+        mergeTasks.push_back(mergeTask);
+        levelTasks.push_back(mergeTask);
+        levelFiles.push_back(std::make_pair(mergeTask->mergedFileName, plan[m].numValues));
+      }
+      storedTasks_.push_back(mergeTasks);
+
+      //Start the workers once the whole plan is submitted, they keep running after the scan and replacement selection
+      if (!handlingTasks) pool_.handleTasks(numThreads_);
+
+      //Wait for the final tasks, the other completed tasks are only kept for profiling
+      if (!waitForTasks(finalTasks, completedTasks)) {
+        std::cerr << "ExternalMergeSort::sort The sort tasks did not complete" << std::endl;
+        cleanupFailedSort();
+        return false;
       }
 
+      //The parts do not remove the merged files
+      for (auto &fileInfo : splitMergeFiles) removeMergedFile(fileInfo.first);
+
+      //Nothing to remove anymore
+      storedTasks_.clear();
+
       //Stop handling and join the threads
       cleanup();
 
@@ -230,49 +378,486 @@ namespace ems {
     }
   }
 
+  template<typename key>
+  bool ExternalMergeSort<key>::sortInMemory(long long numValues) {
+    std::vector<std::shared_ptr<Task>> completedTasks;
+
+    //One slice per thread, aligned for direct I/O if it still fits in the data of a thread
+    long long sliceSize = (numValues + numThreads_ - 1) / numThreads_;
+    long long alignedSliceSize = alignKeys(sliceSize + directIoKeys() - 1);
+    if (alignedSliceSize <= dataSizePerThread_) sliceSize = alignedSliceSize;
+    int numSlices = static_cast<int>((numValues + sliceSize - 1) / sliceSize);
+    std::vector<std::shared_ptr<Task>> sliceTasks;
+    std::vector<long long> sliceSizes;
+    for (int i = 0; i < numSlices; i++) {
+      std::shared_ptr<SortSliceTask> sliceTask = std::make_shared<SortSliceTask>();
+      sliceTask->startInd = i*sliceSize;
+      sliceTask->numValues = std::min(sliceSize, numValues - sliceTask->startInd);
+      sliceTask->slice = i;
+      pool_.addTask(sliceTask);
+      sliceTasks.push_back(sliceTask);
+      sliceSizes.push_back(sliceTask->numValues);
+    }
+
+    //The output file is created once all the input is loaded since it may be the input file
+    std::shared_ptr<CreateFileTask> createTask = std::make_shared<CreateFileTask>();
+    createTask->fileName = outputFileName_;
+    createTask->fileSize = sizeof(key)*numValues;
+    pool_.addTask(createTask, sliceTasks);
+
+    //The merge is split between all the threads
+    std::vector<std::shared_ptr<Task>> createDependency(1, createTask);
+    std::vector<std::shared_ptr<Task>> mergeTasks;
+    for (int i = 0; i < numThreads_; i++) {
+      std::shared_ptr<MergeSlicesTask> mergeTask = std::make_shared<MergeSlicesTask>();
+      mergeTask->sliceSizes = sliceSizes;
+      mergeTask->mergedFileName = outputFileName_;
+      mergeTask->part = i;
+      mergeTask->numParts = numThreads_;
+      pool_.addTask(mergeTask, createDependency);
+      mergeTasks.push_back(mergeTask);
+    }
+
+    pool_.handleTasks(numThreads_);
+
+    if (!waitForTasks(mergeTasks, completedTasks)) {
+      std::cerr << "ExternalMergeSort::sortInMemory The sort tasks did not complete" << std::endl;
+      cleanupFailedSort();
+      return false;
+    }
+
+    //Stop handling and join the threads
+    cleanup();
+
+    //Write profiling information
+    if (!profilingFileName_.empty()) {
+      writeProfilingFile(profilingFileName_, numThreads_, pool_.getStartTime(), pool_.getEndTime(), completedTasks);
+    }
+
+    return true;
+  }
+
+  template<typename key>
+  bool ExternalMergeSort<key>::sortByCounting(long long numValues) {
+    std::vector<std::shared_ptr<Task>> completedTasks;
+
+    //One range of the input per thread, aligned for direct I/O
+    long long rangeSize = alignKeys((numValues + numThreads_ - 1) / numThreads_ + directIoKeys() - 1);
+    long long numRanges = (numValues + rangeSize - 1) / rangeSize;
+    std::vector<std::shared_ptr<CountKeysTask>> countTasks;
+    std::vector<std::shared_ptr<Task>> countDependencies;
+    for (long long i = 0; i < numRanges; i++) {
+      std::shared_ptr<CountKeysTask> countTask = std::make_shared<CountKeysTask>();
+      countTask->startInd = i*rangeSize;
+      countTask->numValues = std::min(rangeSize, numValues - countTask->startInd);
+      pool_.addTask(countTask);
+      countTasks.push_back(countTask);
+      countDependencies.push_back(countTask);
+    }
+
+    //The output file is created once all the input is read since it may be the input file
+    std::shared_ptr<CreateFileTask> createTask = std::make_shared<CreateFileTask>();
+    createTask->fileName = outputFileName_;
+    createTask->fileSize = sizeof(key)*numValues;
+    pool_.addTask(createTask, countDependencies);
+
+    //The output is written in parallel from the counts of all the ranges
+    std::vector<std::shared_ptr<Task>> createDependency(1, createTask);
+    std::vector<std::shared_ptr<Task>> writeTasks;
+    for (int i = 0; i < numThreads_; i++) {
+      std::shared_ptr<WriteKeysTask> writeTask = std::make_shared<WriteKeysTask>();
+      writeTask->countTasks = countTasks;
+      writeTask->fileName = outputFileName_;
+      writeTask->part = i;
+      writeTask->numParts = numThreads_;
+      pool_.addTask(writeTask, createDependency);
+      writeTasks.push_back(writeTask);
+    }
+
+    pool_.handleTasks(numThreads_);
+
+    if (!waitForTasks(writeTasks, completedTasks)) {
+      std::cerr << "ExternalMergeSort::sortByCounting The sort tasks did not complete" << std::endl;
+      cleanupFailedSort();
+      return false;
+    }
+
+    //Stop handling and join the threads
+    cleanup();
+
+    //Write profiling information
+    if (!profilingFileName_.empty()) {
+      writeProfilingFile(profilingFileName_, numThreads_, pool_.getStartTime(), pool_.getEndTime(), completedTasks);
+    }
+
+    return true;
+  }
+
+  template<typename key>
+  bool ExternalMergeSort<key>::waitForTasks(const std::vector<std::shared_ptr<Task>> &tasks, std::vector<std::shared_ptr<Task>> &completedTasks) {
+    size_t numTasksCompleted = 0;
+    while (numTasksCompleted < tasks.size()) {
+      std::shared_ptr<Task> completedTask = pool_.getCompletedTask();
+      if (!completedTask) return false;
+
+      //If needed save the task for profiling information
+      if (!profilingFileName_.empty()) completedTasks.push_back(completedTask);
+
+      if (std::find(tasks.begin(), tasks.end(), completedTask) != tasks.end()) numTasksCompleted++;
+    }
+    return true;
+  }
+
   template<typename key>
   void ExternalMergeSort<key>::handleSortChunkTask(int threadId, Task *task, SortFunction<key> sortFunc) {
     SortChunkTask *sortTask = dynamic_cast<SortChunkTask *>(task);
     if (!sortTask) return;
-    std::fstream sortedFile;
+    File sortedFile;
+    IoRing ring;
     try {
-      //Open the file for this chunk
-      sortedFile.exceptions(std::fstream::failbit | std::fstream::badbit);
-      sortedFile.open(sortTask->sortedFileName, std::ios::out | std::ios::binary);
-      //Read the data in this thread data vector
-      {
-        //Lock
-        std::lock_guard<std::mutex> lock(inFileMutex_);
+      long long numBytes = sizeof(key)*sortTask->numValues;
+      bool useMappedFiles = memoryMappedIo_ && MappedFile::isSupported();
+      bool useIoRing = !useMappedFiles && ioUring_ && ring.init(ioQueueDepth_);
+
+      typename std::vector<key>::iterator dataIt = threadData(threadId);
+      key *data = &(*dataIt);
 
-        inFile_.seekg(sortTask->startInd * sizeof(key));
-        inFile_.read(reinterpret_cast<char *>(&(dataVec_[threadId][0])), sizeof(key)*sortTask->numValues);
-        //Release lock
+      if (useMappedFiles) {
+        //Copy the chunk from the mapped input file
+        MappedFile mappedInput;
+        mappedInput.map(inFile_, sortTask->startInd * sizeof(key), numBytes, false);
+        if (numBytes > 0) std::memcpy(data, mappedInput.data(), numBytes);
+      }
+      else if (useIoRing) {
+        //Read the chunk with many requests in flight
+        ring.read(inFile_, data, numBytes, sortTask->startInd * sizeof(key), 0);
+        ring.wait(0);
+      }
+      else {
+        //Read the data in this thread data vector, positional reads do not need to be serialized
+        inFile_.read(data, numBytes, sortTask->startInd * sizeof(key));
       }
 
       //sort the chunk
-      sortFunc(dataVec_[threadId].begin(), dataVec_[threadId].begin() + sortTask->numValues);
+      sortChunk(dataIt, dataIt + sortTask->numValues, sortFunc);
+      if (sortTask->numValues > 0) setRunRange(sortTask->sortedFileName, 0, data[0], data[sortTask->numValues - 1]);
 
-      //Write the sorted chunk
-      sortedFile.write(reinterpret_cast<char *>(&(dataVec_[threadId][0])), sizeof(key)*sortTask->numValues);
-      //Close the sorted file
+      //The sorted file is created once the input is read since it may be the input file
+      if (useMappedFiles) {
+        //Copy the sorted chunk to the mapped sorted file
+        if (!sortedFile.open(sortTask->sortedFileName, File::Read | File::Write)) throw std::ios_base::failure("Could not open file " + sortTask->sortedFileName);
+        sortedFile.resize(numBytes);
+        MappedFile mappedOutput;
+        mappedOutput.map(sortedFile, 0, numBytes, true);
+        if (numBytes > 0) std::memcpy(mappedOutput.data(), data, numBytes);
+        mappedOutput.unmap();
+      }
+      else {
+        if (!sortedFile.open(sortTask->sortedFileName, fileMode(sortTask->sortedFileName, File::Write))) throw std::ios_base::failure("Could not open file " + sortTask->sortedFileName);
+        if (isCompressedRun(sortTask->sortedFileName)) {
+          //Write the sorted chunk as compressed blocks
+          RunWriter<key> writer(sortedFile);
+          writer.write(data, sortTask->numValues);
+          writer.close();
+        }
+        else if (useIoRing) {
+          //Write the sorted chunk with many requests in flight
+          ring.write(sortedFile, data, numBytes, 0, 0);
+          ring.wait(0);
+        }
+        else sortedFile.write(data, numBytes, 0);
+      }
       sortedFile.close();
     }
     catch (...) {
-      //close and remove the file if needed
-      if (sortedFile.is_open()) sortedFile.close();
+      //Wait for the requests in flight before closing the file
+      try {
+        ring.waitAll();
+      }
+      catch (...) {
+      }
+      sortedFile.close();
       remove(sortTask->sortedFileName.c_str());
       throw;
     }
   }
 
+  //The data of this thread is split in three slots used in rotation:
+  //while the chunk in one slot is sorted, the next chunk is loaded in the second slot
+  //and the previous chunk is written from the third one by background I/O threads
+  //Sorted chunks are pushed to the completed tasks as soon as they are written
+  template<typename key>
+  void ExternalMergeSort<key>::handleSortPipelineTask(int threadId, Task *task, SortFunction<key> sortFunc) {
+    SortPipelineTask *pipelineTask = dynamic_cast<SortPipelineTask *>(task);
+    if (!pipelineTask || !pipelineTask->pipeline) return;
+    SortPipeline &pipeline = *pipelineTask->pipeline;
+
+    //Chunks claimed by this worker and not pushed to the completed tasks yet
+    std::vector<std::shared_ptr<SortChunkTask>> claimedChunks;
+
+    //Background I/O threads, separate threads so that loading and writing overlap as well
+    AsyncIo readIo;
+    AsyncIo writeIo;
+    try {
+      long long slotSize = alignKeys(dataSizePerThread_ / 3);
+      typename std::vector<key>::iterator data = threadData(threadId);
+
+      //Claim the next chunk and start loading it in the given slot
+      //Returns a null pointer when all chunks have been claimed
+      auto claimChunk = [&](int slot, std::future<void> &pendingRead) -> std::shared_ptr<SortChunkTask> {
+        if (pipeline.stop) return nullptr;
+        long long chunkInd = pipeline.nextChunk++;
+        if (chunkInd >= (long long)pipeline.chunks.size()) return nullptr;
+        std::shared_ptr<SortChunkTask> chunk = pipeline.chunks[chunkInd];
+        claimedChunks.push_back(chunk);
+        chunk->handlingThreadId = threadId;
+        if (pool_.getProfile()) chunk->startTime = std::chrono::high_resolution_clock::now();
+        key *buffer = &(*(data + slot*slotSize));
+        long long numValues = chunk->numValues;
+        long long startInd = chunk->startInd;
+        pendingRead = readIo.submit([=]() { inFile_.read(buffer, sizeof(key)*numValues, startInd * sizeof(key)); });
+        return chunk;
+      };
+
+      //Push a written chunk to the completed tasks
+      auto completeChunk = [&](std::shared_ptr<SortChunkTask> chunk) {
+        if (pool_.getProfile()) chunk->endTime = std::chrono::high_resolution_clock::now();
+        claimedChunks.erase(std::find(claimedChunks.begin(), claimedChunks.end(), chunk));
+        pool_.addCompletedTask(chunk);
+      };
+
+      int slot = 0;
+      std::future<void> pendingRead;
+      std::shared_ptr<SortChunkTask> chunk = claimChunk(slot, pendingRead);
+
+      //Chunk being written and its pending write
+      std::shared_ptr<SortChunkTask> writtenChunk;
+      std::future<void> pendingWrite;
+
+      while (chunk) {
+        //Start loading the next chunk
+        int nextSlot = (slot + 1) % 3;
+        std::future<void> nextPendingRead;
+        std::shared_ptr<SortChunkTask> nextChunk = claimChunk(nextSlot, nextPendingRead);
+
+        //Sort the current chunk once loaded
+        pendingRead.get();
+        sortChunk(data + slot*slotSize, data + slot*slotSize + chunk->numValues, sortFunc);
+        if (chunk->numValues > 0) setRunRange(chunk->sortedFileName, 0, data[slot*slotSize], data[slot*slotSize + chunk->numValues - 1]);
+
+        //The previous chunk must be written before its slot is reused by the chunk after the next one
+        if (pendingWrite.valid()) {
+          pendingWrite.get();
+          completeChunk(writtenChunk);
+        }
+
+        //Start writing the current chunk
+        key *buffer = &(*(data + slot*slotSize));
+        long long numValues = chunk->numValues;
+        std::string sortedFileName = chunk->sortedFileName;
+        pendingWrite = writeIo.submit([=]() {
+          File sortedFile;
+          if (!sortedFile.open(sortedFileName, fileMode(sortedFileName, File::Write))) throw std::ios_base::failure("Could not open file " + sortedFileName);
+          if (isCompressedRun(sortedFileName)) {
+            RunWriter<key> writer(sortedFile);
+            writer.write(buffer, numValues);
+            writer.close();
+          }
+          else sortedFile.write(buffer, sizeof(key)*numValues, 0);
+        });
+        writtenChunk = chunk;
+
+        chunk = nextChunk;
+        pendingRead = std::move(nextPendingRead);
+        slot = nextSlot;
+      }
+
+      //Wait for the last write
+      if (pendingWrite.valid()) {
+        pendingWrite.get();
+        completeChunk(writtenChunk);
+      }
+    }
+    catch (...) {
+      //Stop the other workers and wait for the background operations
+      pipeline.stop = true;
+      readIo.join();
+      writeIo.join();
+
+      //Remove the files of the chunks which were not completed
+      for (auto &claimedChunk : claimedChunks) remove(claimedChunk->sortedFileName.c_str());
+      throw;
+    }
+  }
+
+  //The data of this thread holds a heap of keys and two blocks buffering the input range and the generated files
+  //Keys are read one by one from the input and replace the smallest key of the heap, which is written to the current file
+  //Keys smaller than the last written key belong to the next file: they are stored at the end of the heap array
+  //which shrinks until it is empty, then the stored keys form the heap for the next file
+  template<typename key>
+  void ExternalMergeSort<key>::handleReplacementSelectionTask(int threadId, Task *task, SortFunction<key> sortFunc) {
+    ReplacementSelectionTask *selectionTask = dynamic_cast<ReplacementSelectionTask *>(task);
+    if (!selectionTask) return;
+    File runFile;
+    std::string runFileName;
+    //Writer of the current file if it is compressed
+    std::unique_ptr<RunWriter<key>> runWriter;
+    try {
+      typename std::vector<key>::iterator dataIt = threadData(threadId);
+      key *data = &(*dataIt);
+
+      //The blocks only need to be large enough to amortize the I/O, with direct I/O the output blocks are aligned
+      long long blockSize = alignKeys(std::max(1LL, dataSizePerThread_ / 16));
+      long long heapCapacity = alignKeys(dataSizePerThread_ - 2*blockSize);
+      key *heap = data;
+      key *inputBlock = data + heapCapacity;
+      key *outputBlock = inputBlock + blockSize;
+
+      //Fill the heap
+      long long heapNumValues = std::min(heapCapacity, selectionTask->numValues);
+      inFile_.read(heap, sizeof(key)*heapNumValues, sizeof(key)*selectionTask->startInd);
+
+      //Position of the next block in the input range and position in the input block
+      long long inputPos = heapNumValues;
+      long long inputBlockPos = 0;
+      long long inputBlockSize = 0;
+
+      //Number of keys written to the current file and in the output block
+      long long runNumValues = 0;
+      long long outputBlockPos = 0;
+
+      auto startRun = [&]() {
+        runFileName = getTemporaryFileName();
+        if (runFileName.empty() || !runFile.open(runFileName, fileMode(runFileName, File::Write))) throw std::ios_base::failure("Could not create a temporary file");
+        if (isCompressedRun(runFileName)) runWriter.reset(new RunWriter<key>(runFile));
+        runNumValues = 0;
+      };
+
+      //First and last key written to the current file
+      key runFirst = key();
+      key runLast = key();
+
+      auto flushOutput = [&]() {
+        if (!outputBlockPos) return;
+        if (!runNumValues) runFirst = outputBlock[0];
+        runLast = outputBlock[outputBlockPos - 1];
+        if (runWriter) runWriter->write(outputBlock, outputBlockPos);
+        else runFile.write(outputBlock, sizeof(key)*outputBlockPos, sizeof(key)*runNumValues);
+        runNumValues += outputBlockPos;
+        outputBlockPos = 0;
+      };
+
+      auto endRun = [&]() {
+        flushOutput();
+        if (runWriter) runWriter->close();
+        runWriter.reset();
+        runFile.close();
+        if (runNumValues) setRunRange(runFileName, 0, runFirst, runLast);
+        selectionTask->runs.push_back(std::make_pair(runFileName, runNumValues));
+        runFileName.clear();
+      };
+
+      auto output = [&](const key &val) {
+        outputBlock[outputBlockPos++] = val;
+        if (outputBlockPos == blockSize) flushOutput();
+      };
+
+      //Move the key at the root of the min-heap down to its place
+      auto siftDown = [](key *heapArray, long long heapSize) {
+        long long i = 0;
+        key val = heapArray[0];
+        while (true) {
+          long long child = 2 * i + 1;
+          if (child >= heapSize) break;
+          if ((child + 1 < heapSize) && KeyOrder<key>::less(heapArray[child + 1], heapArray[child])) child++;
+          if (!KeyOrder<key>::less(heapArray[child], val)) break;
+          heapArray[i] = heapArray[child];
+          i = child;
+        }
+        heapArray[i] = val;
+      };
+
+      auto heapCompare = [](const key &a, const key &b) { return KeyOrder<key>::less(b, a); };
+      long long heapSize = heapNumValues;
+      std::make_heap(heap, heap + heapSize, heapCompare);
+      startRun();
+
+      while (true) {
+        //Read the next key of the input range
+        if (inputBlockPos == inputBlockSize) {
+          inputBlockSize = std::min(blockSize, selectionTask->numValues - inputPos);
+          if (inputBlockSize <= 0) break;
+          inFile_.read(inputBlock, sizeof(key)*inputBlockSize, sizeof(key)*(selectionTask->startInd + inputPos));
+          inputPos += inputBlockSize;
+          inputBlockPos = 0;
+        }
+        key val = inputBlock[inputBlockPos++];
+
+        //Output the smallest key of the current file
+        key smallest = heap[0];
+        output(smallest);
+
+        if (!KeyOrder<key>::less(val, smallest)) {
+          //The key belongs to the current file, it replaces the root
+          heap[0] = val;
+          siftDown(heap, heapSize);
+        }
+        else {
+          //The key belongs to the next file, the heap shrinks to make room for it
+          std::pop_heap(heap, heap + heapSize, heapCompare);
+          heapSize--;
+          heap[heapSize] = val;
+          if (heapSize == 0) {
+            //The current file is complete, the stored keys form the next heap
+            endRun();
+            startRun();
+            heapSize = heapNumValues;
+            std::make_heap(heap, heap + heapSize, heapCompare);
+          }
+        }
+      }
+
+      //The remaining keys of the current file are the ones in the heap
+      sortFunc(dataIt, dataIt + heapSize);
+      for (long long i = 0; i < heapSize; i++) output(heap[i]);
+      endRun();
+
+      //The keys stored for the next file form the last file
+      if (heapSize < heapNumValues) {
+        startRun();
+        sortFunc(dataIt + heapSize, dataIt + heapNumValues);
+        for (long long i = heapSize; i < heapNumValues; i++) output(heap[i]);
+        endRun();
+      }
+    }
+    catch (...) {
+      //Close and remove the generated files
+      runWriter.reset();
+      runFile.close();
+      if (!runFileName.empty()) remove(runFileName.c_str());
+      for (auto runInfo : selectionTask->runs) remove(runInfo.first.c_str());
+      selectionTask->runs.clear();
+      throw;
+    }
+  }
+
   //Each file is allocated an input buffer in the dataVec of this thread.
   //An output buffer for the merged file is also allocated
+  //With double buffering each buffer is split in two blocks: while one block is merged
+  //the other one is loaded (input files) or written (merged file) by a background I/O thread
+  //A part of a split merge first finds the range of each input file to merge by multisequence selection
   template<typename key>
   void ExternalMergeSort<key>::handleMergeFilesTask(int threadId, Task *task) {
     MergeFilesTask *mergeTask = dynamic_cast<MergeFilesTask *>(task);
     if (!mergeTask) return;
-    std::fstream mergedFile;
-    std::vector<std::unique_ptr<std::fstream>> inputFiles;
+    File mergedFile;
+    std::vector<std::unique_ptr<File>> inputFiles;
+    //Readers of the compressed input files and writer of a compressed merged file
+    std::vector<std::unique_ptr<RunReader<key>>> inputReaders;
+    std::unique_ptr<RunWriter<key>> mergedWriter;
+    //Background I/O thread and io_uring, declared after the files so that they are stopped before the files are destroyed
+    AsyncIo io;
+    IoRing ring;
     try {
       long long numMerges = mergeTask->files.size();
       if (!numMerges) return;
@@ -281,114 +866,733 @@ namespace ems {
       long long inputFileArraySize = dataSizePerThread_ / (numMerges+1);
       if (!inputFileArraySize) return;
 
+      //Split the arrays in blocks, with direct I/O the blocks are aligned
+      int numBlocks = (doubleBuffering_ && (inputFileArraySize >= 2)) ? 2 : 1;
+      long long inputBlockSize = alignKeys(inputFileArraySize / numBlocks);
+      inputFileArraySize = numBlocks*inputBlockSize;
+
       //Remaining size is allocated to the merged file
       long long mergedFileArraySize = dataSizePerThread_ - numMerges*inputFileArraySize;
-
-      //Keep track of the current position in the input files and the array for each input file
-      std::vector<long long> inputFilePos(numMerges, 0);
-      std::vector<long long> inputFileArrayPos(numMerges);
-      //Set the array position at the end so that data is loaded
-      for (int i = 0; i < numMerges; i++) inputFileArrayPos[i] = (i + 1)*mergedFileArraySize;
-
-      //Keep track of the current position in the array for the output file
-      long long mergedFileArrayPos = numMerges*inputFileArraySize;
+      long long mergedBlockSize = alignKeys(mergedFileArraySize / numBlocks);
 
       //Open the input files in read mode
       inputFiles.resize(numMerges);
       for (int i = 0; i < numMerges; i++) {
-	inputFiles[i] = std::unique_ptr<std::fstream>(new std::fstream);
-        inputFiles[i]->exceptions(std::fstream::failbit | std::fstream::badbit);
-        inputFiles[i]->open(mergeTask->files[i].first, std::ios::in | std::ios::binary);
-      }
-
-      //Open the merged file in write mode
-      mergedFile.exceptions(std::fstream::failbit | std::fstream::badbit);
-      mergedFile.open(mergeTask->mergedFileName, std::ios::out | std::ios::binary);
-
-      //Priority queue keeping track of the values at the current pointers in the thread data vector
-      std::priority_queue<std::pair<key, long long>, std::vector<std::pair<key, long long>>, std::greater<std::pair<key, long long>>> mergeQueue;
-
-      //Perform N-way merge of the input files
-      //Load the initial data and fill the priority queue
-      for (long long i = 0; i < numMerges; i++) {
-        //If the end for this chunk has been reached skip to the next chunk
-        if (inputFilePos[i] == mergeTask->files[i].second) continue;
-
-        //Load data for file i
-        long long numRead = std::min<long long>(inputFileArraySize, mergeTask->files[i].second - inputFilePos[i]);
-        if (numRead) {
-          //Point to the beginning of the buffer for this chunk
-          inputFileArrayPos[i] = i*inputFileArraySize;
-          //Read the data
-          inputFiles[i]->read(reinterpret_cast<char *>(&(dataVec_[threadId][inputFileArrayPos[i]])), sizeof(key)* numRead);
-          mergeQueue.push(std::make_pair(dataVec_[threadId][inputFileArrayPos[i]], i));
+        inputFiles[i] = std::unique_ptr<File>(new File);
+        if (!inputFiles[i]->open(mergeTask->files[i].first, fileMode(mergeTask->files[i].first, File::Read))) throw std::ios_base::failure("Could not open file " + mergeTask->files[i].first);
+      }
+
+      //The compressed input files are read by batches of encoded blocks as large as the input blocks
+      inputReaders.resize(numMerges);
+      for (int i = 0; i < numMerges; i++) {
+        if (!isCompressedRun(mergeTask->files[i].first)) continue;
+        inputReaders[i] = std::unique_ptr<RunReader<key>>(new RunReader<key>(sizeof(key)*inputBlockSize));
+        inputReaders[i]->open(*inputFiles[i]);
+      }
+
+      //Position of the first key of each input file, not zero for the natural runs of the input
+      std::vector<long long> fileOffsets(mergeTask->fileOffsets);
+      fileOffsets.resize(numMerges, 0);
+
+      //Keep track of the position of the next block to load in the input files and of the end of the range to merge
+      std::vector<long long> inputFilePos(numMerges, 0);
+      std::vector<long long> inputFileEnd(numMerges);
+      for (long long i = 0; i < numMerges; i++) inputFileEnd[i] = mergeTask->files[i].second;
+
+      //Position of the merged keys in the merged file
+      long long mergedFilePos = 0;
+
+      if (mergeTask->numParts > 1) {
+        //Find the range of each input file for this part
+        long long numValues = 0;
+        for (auto fileInfo : mergeTask->files) numValues += fileInfo.second;
+        long long startRank = partRank(numValues, mergeTask->part, mergeTask->numParts, mergeTask->mergedFileName);
+        long long endRank = partRank(numValues, mergeTask->part + 1, mergeTask->numParts, mergeTask->mergedFileName);
+        if (startRank == endRank) return;
+
+        auto keyAt = [&](long long i, long long pos) {
+          if (inputReaders[i]) return inputReaders[i]->keyAt(pos);
+          key val;
+          inputFiles[i]->read(&val, sizeof(key), sizeof(key)*(fileOffsets[i] + pos));
+          return val;
+        };
+        inputFilePos = multiSequenceSelect<key>(inputFileEnd, startRank, keyAt);
+        inputFileEnd = multiSequenceSelect<key>(inputFileEnd, endRank, keyAt);
+        mergedFilePos = startRank;
+        for (long long i = 0; i < numMerges; i++) {
+          if (inputReaders[i]) inputReaders[i]->seek(inputFilePos[i]);
         }
       }
 
-      //While the queue is not empty, dequeue the top element, add it to the result and try to fetch another value from the same input file
-      while (!mergeQueue.empty()) {
-        auto topPair = mergeQueue.top();
-        mergeQueue.pop();
-        dataVec_[threadId][mergedFileArrayPos++] = topPair.first;
-
-        //Add data to the queue from the input file we just poped
-        //Increment the pointers for this input file
-        inputFileArrayPos[topPair.second]++;
-        inputFilePos[topPair.second]++;
-        //Check that the end of this input file has not been reached
-        if (inputFilePos[topPair.second] != mergeTask->files[topPair.second].second) {
-          //Read more data if necessary
-          if (inputFileArrayPos[topPair.second] == (topPair.second + 1)*inputFileArraySize) {
-            long long numRead = std::min<long long>(inputFileArraySize, mergeTask->files[topPair.second].second - inputFilePos[topPair.second]);
-            if (numRead) {
-              //Point to the beginning of the buffer for this input file
-              inputFileArrayPos[topPair.second] = topPair.second*inputFileArraySize;
-              //Read the data
-              inputFiles[topPair.second]->read(reinterpret_cast<char *>(&(dataVec_[threadId][inputFileArrayPos[topPair.second]])), sizeof(key)* numRead);
-            }
+      //Input files whose key ranges overlap are merged together, the clusters follow each other in the merged file
+      std::vector<std::vector<long long>> clusters = mergeClusters(*mergeTask);
+
+      if (memoryMappedIo_ && MappedFile::isSupported()) {
+        //The keys are merged in place, from the mapped input files to the mapped merged file
+        std::vector<long long> mappedPos(numMerges);
+        std::vector<long long> mappedEnd(numMerges);
+        for (long long i = 0; i < numMerges; i++) {
+          mappedPos[i] = fileOffsets[i] + inputFilePos[i];
+          mappedEnd[i] = fileOffsets[i] + inputFileEnd[i];
+        }
+        mergeMappedFiles(*mergeTask, inputFiles, mappedPos, mappedEnd, mergedFilePos, mergedFile, clusters);
+      }
+      else {
+        //Open the merged file in write mode, the parts of a split merge write in the file created by a CreateFileTask
+        if (!mergedFile.open(mergeTask->mergedFileName, fileMode(mergeTask->mergedFileName, (mergeTask->numParts > 1) ? (File::Write | File::Keep) : File::Write))) {
+          throw std::ios_base::failure("Could not open file " + mergeTask->mergedFileName);
+        }
+
+        if (isCompressedRun(mergeTask->mergedFileName)) mergedWriter = std::unique_ptr<RunWriter<key>>(new RunWriter<key>(mergedFile, sizeof(key)*mergedBlockSize));
+
+        key *data = &(*threadData(threadId));
+        key *mergedFileArray = data + numMerges*inputFileArraySize;
+
+        //With io_uring the reads and writes are requests in flight identified by the input file index (numMerges for the merged file)
+        //The compressed files are decoded and encoded by the background I/O thread instead
+        bool useIoRing = ioUring_ && ring.init(ioQueueDepth_);
+
+        //The clusters of a single file are copied from the input file without going through the data of this thread
+        //unless one of the files is compressed
+        std::vector<bool> copiedInputs(numMerges, false);
+        for (auto &cluster : clusters) {
+          if ((cluster.size() == 1) && !inputReaders[cluster[0]] && !mergedWriter) copiedInputs[cluster[0]] = true;
+        }
+
+        //Block being loaded for each input file (double buffering only): block index, number of keys and pending read
+        std::vector<int> loadingBlock(numMerges, 0);
+        std::vector<long long> loadingSize(numMerges, 0);
+        std::vector<std::future<void>> pendingReads(numMerges);
+
+        //Load the next block of input file i in block b, in the background with double buffering
+        //Returns the number of keys loaded
+        auto loadBlock = [&](long long i, int b) -> long long {
+          long long numRead = std::min<long long>(inputBlockSize, inputFileEnd[i] - inputFilePos[i]);
+          if (numRead <= 0) return 0;
+          //A range starting on an unaligned position reads less so that the next blocks are aligned for direct I/O
+          long long alignment = directIoKeys();
+          long long filePos = fileOffsets[i] + inputFilePos[i];
+          if ((inputBlockSize >= alignment) && (filePos % alignment)) numRead = std::min(numRead, inputBlockSize - filePos % alignment);
+          File *inputFile = inputFiles[i].get();
+          RunReader<key> *inputReader = inputReaders[i].get();
+          key *buffer = data + i*inputFileArraySize + b*inputBlockSize;
+          long long offset = sizeof(key)*filePos;
+          inputFilePos[i] += numRead;
+          auto readOperation = [=]() {
+            if (inputReader) inputReader->read(buffer, numRead);
+            else inputFile->read(buffer, sizeof(key)* numRead, offset);
+          };
+          if (useIoRing && !inputReader) {
+            ring.read(*inputFile, buffer, sizeof(key)* numRead, offset, i);
+            if (numBlocks == 1) ring.wait(i);
+          }
+          else if (numBlocks == 1) readOperation();
+          else pendingReads[i] = io.submit(readOperation);
+          return numRead;
+        };
+
+        //Start loading the first block of each input file
+        if (numBlocks == 2) {
+          for (long long i = 0; i < numMerges; i++) {
+            if (!copiedInputs[i]) loadingSize[i] = loadBlock(i, 0);
           }
-          //Add to the queue
-          mergeQueue.push(std::make_pair(dataVec_[threadId][inputFileArrayPos[topPair.second]], topPair.second));
+          //The first blocks are submitted in a single batch
+          if (useIoRing) ring.submit();
         }
-        //Write the merged data if the output buffer is full or the queue is empty
-        if ((mergedFileArrayPos == dataSizePerThread_) || mergeQueue.empty()) {
-          long long numWrite = mergedFileArrayPos - numMerges*inputFileArraySize;
-          mergedFile.write(reinterpret_cast<char *>(&(dataVec_[threadId][numMerges*inputFileArraySize])), sizeof(key)* numWrite);
-          mergedFileArrayPos = numMerges*inputFileArraySize;
+
+        //Give the next block of input file i to the merge
+        MergeRefillFunction<key> refill = [&](long long i, MergeRun<key> &run) {
+          int b = 0;
+          long long numRead;
+          if (numBlocks == 1) numRead = loadBlock(i, 0);
+          else {
+            //Wait for the block being loaded and start loading the next one in the other block
+            b = loadingBlock[i];
+            numRead = loadingSize[i];
+            if (!numRead) return false;
+            if (pendingReads[i].valid()) pendingReads[i].get();
+            else ring.wait(i);
+            loadingBlock[i] = 1 - b;
+            loadingSize[i] = loadBlock(i, 1 - b);
+            if (useIoRing) ring.submit();
+          }
+          if (!numRead) return false;
+          run.begin = data + i*inputFileArraySize + b*inputBlockSize;
+          run.end = run.begin + numRead;
+          return true;
+        };
+
+        MergeOutput<key> output;
+        output.begin = output.pos = mergedFileArray;
+        output.end = mergedFileArray + mergedBlockSize;
+
+        //Pending write of the merged file (double buffering only)
+        std::future<void> pendingWrite;
+
+        //Write the merged data, in the background with double buffering
+        MergeFlushFunction<key> flush = [&](MergeOutput<key> &out) {
+          long long numWrite = out.pos - out.begin;
+          key *buffer = out.begin;
+          long long offset = sizeof(key)*mergedFilePos;
+          mergedFilePos += numWrite;
+          RunWriter<key> *writer = mergedWriter.get();
+          auto writeOperation = [=, &mergedFile]() {
+            if (writer) writer->write(buffer, numWrite);
+            else mergedFile.write(buffer, sizeof(key)* numWrite, offset);
+          };
+          if (numBlocks == 1) {
+            if (useIoRing && !writer) {
+              ring.write(mergedFile, buffer, sizeof(key)* numWrite, offset, numMerges);
+              ring.wait(numMerges);
+            }
+            else writeOperation();
+            out.pos = out.begin;
+            return;
+          }
+          //Wait for the previous write so that its block can be reused then merge in this block
+          if (useIoRing && !writer) {
+            ring.wait(numMerges);
+            ring.write(mergedFile, buffer, sizeof(key)* numWrite, offset, numMerges);
+            ring.submit();
+          }
+          else {
+            if (pendingWrite.valid()) pendingWrite.get();
+            pendingWrite = io.submit(writeOperation);
+          }
+          out.begin = out.pos = (out.begin == mergedFileArray) ? mergedFileArray + mergedBlockSize : mergedFileArray;
+          out.end = out.begin + mergedBlockSize;
+        };
+
+        for (auto &cluster : clusters) {
+          if (copiedInputs[cluster[0]]) {
+            long long i = cluster[0];
+            long long numCopied = inputFileEnd[i] - inputFilePos[i];
+            mergedFile.copyFrom(*inputFiles[i], sizeof(key)*numCopied, sizeof(key)*(fileOffsets[i] + inputFilePos[i]), sizeof(key)*mergedFilePos);
+            inputFilePos[i] = inputFileEnd[i];
+            mergedFilePos += numCopied;
+            continue;
+          }
+
+          //Each input file buffer starts empty so that data is loaded by the first refill
+          std::vector<MergeRun<key>> runs(cluster.size());
+          for (size_t j = 0; j < cluster.size(); j++) runs[j].begin = runs[j].end = data + cluster[j]*inputFileArraySize;
+          MergeRefillFunction<key> clusterRefill = [&](long long j, MergeRun<key> &run) { return refill(cluster[j], run); };
+
+          //Perform N-way merge of the input files of the cluster, the merged keys are flushed at the end
+          mergeRuns(mergeKernel_, runs, output, clusterRefill, flush);
         }
+
+        //Wait for the last write
+        if (pendingWrite.valid()) pendingWrite.get();
+        io.join();
+        if (useIoRing) ring.waitAll();
+        if (mergedWriter) mergedWriter->close();
       }
+
       //Close the merged file
-      if (mergedFile.is_open()) mergedFile.close();
+      mergedFile.close();
 
-      //Close and remove the input files
-      for (auto &f : inputFiles) {
-        if (f->is_open()) f->close();
+      //The merged file is a sorted run from the smallest first key to the largest last key of the input files
+      std::vector<std::pair<key, key>> ranges;
+      if ((mergeTask->numParts == 1) && getRunRanges(*mergeTask, ranges)) {
+        std::pair<key, key> mergedRange = ranges[0];
+        for (auto &range : ranges) {
+          if (KeyOrder<key>::less(range.first, mergedRange.first)) mergedRange.first = range.first;
+          if (KeyOrder<key>::less(mergedRange.second, range.second)) mergedRange.second = range.second;
+        }
+        setRunRange(mergeTask->mergedFileName, 0, mergedRange.first, mergedRange.second);
       }
-      for (auto fileInfo : mergeTask->files) {
-        remove(fileInfo.first.c_str());
+
+      //Close and remove the input files, unless other parts of the merge still need them
+      for (auto &f : inputFiles) f->close();
+      if (mergeTask->numParts == 1) {
+        for (auto fileInfo : mergeTask->files) removeMergedFile(fileInfo.first);
       }
     }
     catch (...) {
+      //Wait for the background operations before closing the files
+      io.join();
+      try {
+        ring.waitAll();
+      }
+      catch (...) {
+      }
+
       //Close and remove the merged file
-      if (mergedFile.is_open()) mergedFile.close();
+      mergedFile.close();
       remove(mergeTask->mergedFileName.c_str());
 
       //Close and remove the input files
       for (auto &f : inputFiles) {
-        if (f->is_open()) f->close();
-      }
-      for (auto fileInfo : mergeTask->files) {
-        remove(fileInfo.first.c_str());
+        if (f) f->close();
       }
+      for (auto fileInfo : mergeTask->files) removeMergedFile(fileInfo.first);
       throw;
     }
   }
 
+  template<typename key>
+  void ExternalMergeSort<key>::mergeMappedFiles(const MergeFilesTask &mergeTask, std::vector<std::unique_ptr<File>> &inputFiles, const std::vector<long long> &inputFilePos,
+    const std::vector<long long> &inputFileEnd, long long mergedFilePos, File &mergedFile, const std::vector<std::vector<long long>> &clusters) {
+    long long numMerges = inputFiles.size();
+
+    //Each run is the whole mapped range of its input file, there is nothing to refill
+    std::vector<MappedFile> mappedInputs(numMerges);
+    std::vector<MergeRun<key>> runs(numMerges);
+    long long numMerged = 0;
+    for (long long i = 0; i < numMerges; i++) {
+      long long numKeys = inputFileEnd[i] - inputFilePos[i];
+      mappedInputs[i].map(*inputFiles[i], sizeof(key)*inputFilePos[i], sizeof(key)*numKeys, false);
+      runs[i].begin = static_cast<const key *>(mappedInputs[i].data());
+      runs[i].end = runs[i].begin + numKeys;
+      numMerged += numKeys;
+    }
+    MergeRefillFunction<key> refill = [](long long, MergeRun<key> &) { return false; };
+
+    //The parts of a split merge write in the file created by a CreateFileTask with its final size
+    int mode = (mergeTask.numParts > 1) ? (File::Read | File::Write | File::Keep) : (File::Read | File::Write);
+    if (!mergedFile.open(mergeTask.mergedFileName, mode)) throw std::ios_base::failure("Could not open file " + mergeTask.mergedFileName);
+    if (mergeTask.numParts == 1) mergedFile.resize(sizeof(key)*numMerged);
+
+    //The output is the whole mapped range of the merged keys, it is only flushed once full at the end
+    MappedFile mappedOutput;
+    mappedOutput.map(mergedFile, sizeof(key)*mergedFilePos, sizeof(key)*numMerged, true);
+    MergeOutput<key> output;
+    output.begin = output.pos = static_cast<key *>(mappedOutput.data());
+    output.end = output.begin + numMerged;
+    MergeFlushFunction<key> flush = [](MergeOutput<key> &) {};
+
+    //The clusters are merged one after the other in the mapped range
+    for (auto &cluster : clusters) {
+      std::vector<MergeRun<key>> clusterRuns;
+      for (long long i : cluster) clusterRuns.push_back(runs[i]);
+      mergeRuns(mergeKernel_, clusterRuns, output, refill, flush);
+    }
+  }
+
   template<typename key>
   void ExternalMergeSort<key>::allocateData() {
     dataVec_.clear();
     dataVec_.resize(numThreads_);
-    for (auto &vec : dataVec_) vec.resize(dataSizePerThread_);
+    //Room to align the start of the data if direct I/O is enabled later
+    long long alignmentKeys = std::max<long long>(1, directIoAlignment / sizeof(key));
+    for (auto &vec : dataVec_) vec.resize(dataSizePerThread_ + alignmentKeys - 1);
+  }
+
+  template<typename key>
+  typename std::vector<key>::iterator ExternalMergeSort<key>::threadData(int threadId) {
+    std::vector<key> &data = dataVec_[threadId];
+    long long alignment = directIoKeys();
+    if (alignment == 1) return data.begin();
+    long long misalignment = reinterpret_cast<uintptr_t>(data.data()) % directIoAlignment;
+    if (!misalignment || ((directIoAlignment - misalignment) % sizeof(key))) return data.begin();
+    return data.begin() + (directIoAlignment - misalignment) / sizeof(key);
+  }
+
+  template<typename key>
+  long long ExternalMergeSort<key>::directIoKeys() const {
+    return (directIo_ && !(directIoAlignment % sizeof(key))) ? directIoAlignment / sizeof(key) : 1;
+  }
+
+  template<typename key>
+  long long ExternalMergeSort<key>::alignKeys(long long numKeys) const {
+    long long alignment = directIoKeys();
+    return (numKeys < alignment) ? numKeys : numKeys - numKeys % alignment;
+  }
+
+  template<typename key>
+  bool ExternalMergeSort<key>::isCompressedRun(const std::string &fileName) const {
+    //The memory mapped merges read the keys in place
+    return compressTemporaryFiles_ && RunCodec<key>::isSupported && !(memoryMappedIo_ && MappedFile::isSupported()) && (fileName != outputFileName_) && (fileName != inputFileName_);
+  }
+
+  template<typename key>
+  void ExternalMergeSort<key>::setRunRange(const std::string &fileName, long long offset, const key &first, const key &last) {
+    std::lock_guard<std::mutex> lock(runRangesMutex_);
+    runRanges_[std::make_pair(fileName, offset)] = std::make_pair(first, last);
+  }
+
+  template<typename key>
+  bool ExternalMergeSort<key>::getRunRanges(const MergeFilesTask &mergeTask, std::vector<std::pair<key, key>> &ranges) {
+    std::lock_guard<std::mutex> lock(runRangesMutex_);
+    ranges.clear();
+    for (size_t i = 0; i < mergeTask.files.size(); i++) {
+      long long offset = (i < mergeTask.fileOffsets.size()) ? mergeTask.fileOffsets[i] : 0;
+      auto rangeIt = runRanges_.find(std::make_pair(mergeTask.files[i].first, offset));
+      if (rangeIt == runRanges_.end()) return false;
+      ranges.push_back(rangeIt->second);
+    }
+    return true;
+  }
+
+  template<typename key>
+  std::vector<std::vector<long long>> ExternalMergeSort<key>::mergeClusters(const MergeFilesTask &mergeTask) {
+    long long numFiles = mergeTask.files.size();
+    std::vector<std::vector<long long>> clusters;
+    std::vector<std::pair<key, key>> ranges;
+    if (!getRunRanges(mergeTask, ranges)) {
+      clusters.resize(1);
+      for (long long i = 0; i < numFiles; i++) clusters[0].push_back(i);
+      return clusters;
+    }
+
+    //In order of first key, a file starting before the largest last key of the current cluster overlaps it
+    std::vector<long long> order(numFiles);
+    for (long long i = 0; i < numFiles; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](long long a, long long b) { return KeyOrder<key>::less(ranges[a].first, ranges[b].first); });
+    key clusterLast = key();
+    for (long long i : order) {
+      if (clusters.empty() || !KeyOrder<key>::less(ranges[i].first, clusterLast)) {
+        clusters.push_back(std::vector<long long>());
+        clusterLast = ranges[i].second;
+      }
+      clusters.back().push_back(i);
+      if (KeyOrder<key>::less(clusterLast, ranges[i].second)) clusterLast = ranges[i].second;
+    }
+    return clusters;
+  }
+
+  //A single pass tells whether the keys are sorted in either order, it stops as soon as both are ruled out
+  template<typename key>
+  void ExternalMergeSort<key>::sortChunk(typename std::vector<key>::iterator begin, typename std::vector<key>::iterator end, const SortFunction<key> &sortFunc) {
+    if (!adaptiveSort_ || (end - begin < 2)) {
+      sortFunc(begin, end);
+      return;
+    }
+
+    bool ascending = true;
+    bool descending = true;
+    for (typename std::vector<key>::iterator it = begin + 1; (it != end) && (ascending || descending); ++it) {
+      if (KeyOrder<key>::less(*it, *(it - 1))) ascending = false;
+      else if (KeyOrder<key>::less(*(it - 1), *it)) descending = false;
+    }
+    if (ascending) return;
+    if (descending) {
+      std::reverse(begin, end);
+      return;
+    }
+    if (FewUniqueKeysSort<key>::sort(begin, end)) return;
+    sortFunc(begin, end);
+  }
+
+  //Each thread scans a contiguous range of the input, the boundaries between the ranges are checked afterwards
+  template<typename key>
+  bool ExternalMergeSort<key>::findNaturalRuns(long long numValues, long long maxRuns, std::vector<long long> &runStarts, std::vector<std::shared_ptr<Task>> &completedTasks) {
+    long long rangeSize = (numValues + numThreads_ - 1) / numThreads_;
+    long long numRanges = (numValues + rangeSize - 1) / rangeSize;
+    std::vector<std::shared_ptr<ScanRunsTask>> scanTasks;
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (long long i = 0; i < numRanges; i++) {
+      std::shared_ptr<ScanRunsTask> scanTask = std::make_shared<ScanRunsTask>();
+      scanTask->startInd = i*rangeSize;
+      scanTask->numValues = std::min(rangeSize, numValues - scanTask->startInd);
+      scanTask->maxDescents = maxRuns - 1;
+      pool_.addTask(scanTask);
+      scanTasks.push_back(scanTask);
+      tasks.push_back(scanTask);
+    }
+    if (!waitForTasks(tasks, completedTasks)) return false;
+
+    runStarts.assign(1, 0);
+    for (long long i = 0; i < numRanges; i++) {
+      if (scanTasks[i]->tooManyDescents) return false;
+      if (i > 0) {
+        key last, first;
+        inFile_.read(&last, sizeof(key), sizeof(key)*(scanTasks[i]->startInd - 1));
+        inFile_.read(&first, sizeof(key), sizeof(key)*scanTasks[i]->startInd);
+        if (KeyOrder<key>::less(first, last)) runStarts.push_back(scanTasks[i]->startInd);
+      }
+      runStarts.insert(runStarts.end(), scanTasks[i]->descents.begin(), scanTasks[i]->descents.end());
+      if (static_cast<long long>(runStarts.size()) > maxRuns) return false;
+    }
+    return true;
+  }
+
+  template<typename key>
+  long long ExternalMergeSort<key>::partRank(long long numValues, long long part, long long numParts, const std::string &mergedFileName) const {
+    long long rank = numValues * part / numParts;
+    //The parts written with direct I/O start on aligned positions
+    if ((part < numParts) && (fileMode(mergedFileName, 0) & File::Direct)) rank -= rank % directIoKeys();
+    return rank;
+  }
+
+  template<typename key>
+  void ExternalMergeSort<key>::handleCreateFileTask(int threadId, Task *task) {
+    CreateFileTask *createTask = dynamic_cast<CreateFileTask *>(task);
+    if (!createTask) return;
+
+    File createdFile;
+    if (!createdFile.open(createTask->fileName, File::Write)) throw std::ios_base::failure("Could not create file " + createTask->fileName);
+    if (createTask->fileSize > 0) createdFile.resize(createTask->fileSize);
+    createdFile.close();
+  }
+
+  //The range is read by blocks in the data of this thread, with double buffering the next block
+  //is loaded by a background I/O thread while the current one is counted
+  template<typename key>
+  void ExternalMergeSort<key>::handleCountKeysTask(int threadId, Task *task) {
+    CountKeysTask *countTask = dynamic_cast<CountKeysTask *>(task);
+    if (!countTask) return;
+    typedef CountingSortTraits<key> Traits;
+
+    AsyncIo io;
+    key *data = &(*threadData(threadId));
+    int numBlocks = (doubleBuffering_ && (dataSizePerThread_ >= 2)) ? 2 : 1;
+    long long blockSize = alignKeys(dataSizePerThread_ / numBlocks);
+
+    countTask->counts.assign(Traits::numBuckets, 0);
+    long long *counts = countTask->counts.data();
+
+    //Start loading the first block
+    long long numLoading = std::min(blockSize, countTask->numValues);
+    std::future<void> pendingRead;
+    auto load = [&](long long startInd, long long numRead, int b) {
+      key *buffer = data + b*blockSize;
+      long long offset = sizeof(key)*(countTask->startInd + startInd);
+      if (numBlocks == 1) inFile_.read(buffer, sizeof(key)*numRead, offset);
+      else pendingRead = io.submit([=]() { inFile_.read(buffer, sizeof(key)*numRead, offset); });
+    };
+    load(0, numLoading, 0);
+
+    int b = 0;
+    for (long long pos = 0; pos < countTask->numValues;) {
+      long long numRead = numLoading;
+      if (pendingRead.valid()) pendingRead.get();
+
+      //Start loading the next block then count the current one
+      numLoading = std::min(blockSize, countTask->numValues - pos - numRead);
+      int nextBlock = (numBlocks == 2) ? 1 - b : b;
+      const key *block = data + b*blockSize;
+      if (numBlocks == 1) {
+        for (long long i = 0; i < numRead; i++) counts[Traits::bucket(block[i])]++;
+        if (numLoading > 0) load(pos + numRead, numLoading, nextBlock);
+      }
+      else {
+        if (numLoading > 0) load(pos + numRead, numLoading, nextBlock);
+        for (long long i = 0; i < numRead; i++) counts[Traits::bucket(block[i])]++;
+      }
+      pos += numRead;
+      b = nextBlock;
+    }
+  }
+
+  //The keys of the range are generated by blocks in the data of this thread from the counts of all the input ranges
+  //With double buffering each block is written by a background I/O thread while the next one is generated
+  template<typename key>
+  void ExternalMergeSort<key>::handleWriteKeysTask(int threadId, Task *task) {
+    WriteKeysTask *writeTask = dynamic_cast<WriteKeysTask *>(task);
+    if (!writeTask) return;
+    typedef CountingSortTraits<key> Traits;
+
+    //Sum the counts of the input ranges
+    std::vector<long long> counts(Traits::numBuckets, 0);
+    for (auto &countTask : writeTask->countTasks) {
+      for (long long v = 0; v < Traits::numBuckets; v++) counts[v] += countTask->counts[v];
+    }
+    long long numValues = 0;
+    for (auto count : counts) numValues += count;
+
+    long long startRank = partRank(numValues, writeTask->part, writeTask->numParts, writeTask->fileName);
+    long long endRank = partRank(numValues, writeTask->part + 1, writeTask->numParts, writeTask->fileName);
+    if (startRank == endRank) return;
+
+    File outFile;
+    if (!outFile.open(writeTask->fileName, fileMode(writeTask->fileName, File::Write | File::Keep))) {
+      throw std::ios_base::failure("Could not open file " + writeTask->fileName);
+    }
+
+    //Declared after the file so that it is stopped before the file is closed
+    AsyncIo io;
+    key *data = &(*threadData(threadId));
+    int numBlocks = (doubleBuffering_ && (dataSizePerThread_ >= 2)) ? 2 : 1;
+    long long blockSize = alignKeys(dataSizePerThread_ / numBlocks);
+
+    //Bucket of the key at startRank and number of its keys before startRank
+    long long bucket = 0;
+    long long bucketPos = startRank;
+    while (bucketPos >= counts[bucket]) {
+      bucketPos -= counts[bucket];
+      bucket++;
+    }
+
+    std::future<void> pendingWrite;
+    int b = 0;
+    for (long long pos = startRank; pos < endRank;) {
+      //The write in flight, if any, is the one of the other block
+      key *block = data + b*blockSize;
+
+      long long numKeys = std::min(blockSize, endRank - pos);
+      for (long long filled = 0; filled < numKeys;) {
+        long long numRepeated = std::min(counts[bucket] - bucketPos, numKeys - filled);
+        std::fill(block + filled, block + filled + numRepeated, Traits::value(bucket));
+        filled += numRepeated;
+        bucketPos += numRepeated;
+        if (bucketPos == counts[bucket]) {
+          bucket++;
+          bucketPos = 0;
+        }
+      }
+
+      long long offset = sizeof(key)*pos;
+      if (numBlocks == 1) outFile.write(block, sizeof(key)*numKeys, offset);
+      else {
+        if (pendingWrite.valid()) pendingWrite.get();
+        pendingWrite = io.submit([=, &outFile]() { outFile.write(block, sizeof(key)*numKeys, offset); });
+      }
+      pos += numKeys;
+      b = (numBlocks == 2) ? 1 - b : b;
+    }
+
+    //Wait for the last write
+    if (pendingWrite.valid()) pendingWrite.get();
+  }
+
+  //The range is read by blocks in the data of this thread, the first ones small so that an unsorted input is rejected early
+  template<typename key>
+  void ExternalMergeSort<key>::handleScanRunsTask(int threadId, Task *task) {
+    ScanRunsTask *scanTask = dynamic_cast<ScanRunsTask *>(task);
+    if (!scanTask) return;
+
+    key *data = &(*threadData(threadId));
+    long long blockSize = std::min<long long>(4096, dataSizePerThread_);
+    key previous = key();
+    for (long long pos = 0; pos < scanTask->numValues;) {
+      long long numRead = std::min(blockSize, scanTask->numValues - pos);
+      inFile_.read(data, sizeof(key)*numRead, sizeof(key)*(scanTask->startInd + pos));
+
+      //A descent is the first key of a natural run, the comparison with the previous block covers the first key
+      for (long long i = 0; i < numRead; i++) {
+        if ((i > 0) ? KeyOrder<key>::less(data[i], data[i - 1]) : ((pos > 0) && KeyOrder<key>::less(data[0], previous))) {
+          scanTask->descents.push_back(scanTask->startInd + pos + i);
+          if (static_cast<long long>(scanTask->descents.size()) > scanTask->maxDescents) {
+            scanTask->tooManyDescents = true;
+            return;
+          }
+        }
+      }
+      previous = data[numRead - 1];
+      pos += numRead;
+      blockSize = std::min(2 * blockSize, dataSizePerThread_);
+    }
+  }
+
+  template<typename key>
+  void ExternalMergeSort<key>::handleSortSliceTask(int threadId, Task *task, SortFunction<key> sortFunc) {
+    SortSliceTask *sliceTask = dynamic_cast<SortSliceTask *>(task);
+    if (!sliceTask) return;
+
+    //The slice stays in the data of thread slice until it is merged
+    typename std::vector<key>::iterator data = threadData(sliceTask->slice);
+    inFile_.read(&(*data), sizeof(key)*sliceTask->numValues, sliceTask->startInd * sizeof(key));
+    sortChunk(data, data + sliceTask->numValues, sortFunc);
+  }
+
+  template<typename key>
+  void ExternalMergeSort<key>::handleMergeSlicesTask(int threadId, Task *task) {
+    MergeSlicesTask *mergeTask = dynamic_cast<MergeSlicesTask *>(task);
+    if (!mergeTask) return;
+
+    //Find the range of each slice for this part
+    long long numValues = 0;
+    for (auto sliceSize : mergeTask->sliceSizes) numValues += sliceSize;
+    long long startRank = partRank(numValues, mergeTask->part, mergeTask->numParts, mergeTask->mergedFileName);
+    long long endRank = partRank(numValues, mergeTask->part + 1, mergeTask->numParts, mergeTask->mergedFileName);
+    if (startRank == endRank) return;
+
+    //Sorted slices in the data of the threads
+    long long numSlices = mergeTask->sliceSizes.size();
+    std::vector<const key *> slices(numSlices);
+    for (long long i = 0; i < numSlices; i++) slices[i] = &(*threadData(i));
+
+    auto keyAt = [&](long long i, long long pos) {
+      return slices[i][pos];
+    };
+    std::vector<long long> sliceStart = multiSequenceSelect<key>(mergeTask->sliceSizes, startRank, keyAt);
+    std::vector<long long> sliceEnd = multiSequenceSelect<key>(mergeTask->sliceSizes, endRank, keyAt);
+
+    //The slices are merged in place, there is nothing to refill
+    std::vector<MergeRun<key>> runs(numSlices);
+    for (long long i = 0; i < numSlices; i++) {
+      runs[i].begin = slices[i] + sliceStart[i];
+      runs[i].end = slices[i] + sliceEnd[i];
+    }
+    MergeRefillFunction<key> refill = [](long long, MergeRun<key> &) { return false; };
+
+    //The merged keys go through a small buffer written at their position in the output file
+    File mergedFile;
+    if (!mergedFile.open(mergeTask->mergedFileName, fileMode(mergeTask->mergedFileName, File::Write | File::Keep))) {
+      throw std::ios_base::failure("Could not open file " + mergeTask->mergedFileName);
+    }
+    //With direct I/O the buffer is aligned, it has room to move its start to an aligned address
+    long long mergedBufferSize = std::min<long long>(endRank - startRank, 1 << 16);
+    std::vector<key> mergedBuffer(mergedBufferSize + directIoKeys() - 1);
+    key *mergedBufferBegin = mergedBuffer.data();
+    long long misalignment = reinterpret_cast<uintptr_t>(mergedBufferBegin) % directIoAlignment;
+    if (mergedFile.isDirect() && misalignment && !((directIoAlignment - misalignment) % sizeof(key))) mergedBufferBegin += (directIoAlignment - misalignment) / sizeof(key);
+    long long mergedFilePos = startRank;
+
+    MergeOutput<key> output;
+    output.begin = output.pos = mergedBufferBegin;
+    output.end = mergedBufferBegin + mergedBufferSize;
+
+    MergeFlushFunction<key> flush = [&](MergeOutput<key> &out) {
+      long long numMerged = out.pos - out.begin;
+      mergedFile.write(out.begin, sizeof(key)*numMerged, sizeof(key)*mergedFilePos);
+      mergedFilePos += numMerged;
+      out.pos = out.begin;
+    };
+
+    mergeRuns(mergeKernel_, runs, output, refill, flush);
+  }
+
+  //A sample of evenly spaced keys rejects most inputs before the keys are counted
+  //The distinct keys are kept sorted by their radix, the search is skipped for runs of equal keys
+  //The keys are rebuilt from their radix, which only NaNs do not survive: RadixTraits maps them all to the largest
+  //radix, losing their sign and payload, so the chunks holding a NaN are left to the sort function
+  template<typename key>
+  bool FewUniqueKeysSort<key, true>::sort(typename std::vector<key>::iterator begin, typename std::vector<key>::iterator end) {
+    typedef RadixTraits<key> Traits;
+    typedef typename Traits::type radix;
+    long long numValues = end - begin;
+    std::vector<radix> values;
+    std::vector<long long> counts;
+    values.reserve(fewUniqueKeys + 1);
+    counts.reserve(fewUniqueKeys + 1);
+
+    //Index of the distinct key k of radix r, inserted if needed, -1 if there are too many distinct keys or k is a NaN
+    auto findValue = [&](const key &k, radix r) -> long long {
+      if ((r == ~radix(0)) && std::isnan(k)) return -1;
+      typename std::vector<radix>::iterator pos = std::lower_bound(values.begin(), values.end(), r);
+      long long ind = pos - values.begin();
+      if ((pos == values.end()) || (*pos != r)) {
+        if (static_cast<long long>(values.size()) == fewUniqueKeys) return -1;
+        values.insert(pos, r);
+        counts.insert(counts.begin() + ind, 0);
+      }
+      return ind;
+    };
+
+    long long step = std::max<long long>(1, numValues / 1024);
+    for (long long i = 0; i < numValues; i += step) {
+      if (findValue(begin[i], Traits::toRadix(begin[i])) < 0) return false;
+    }
+
+    long long lastInd = -1;
+    radix lastValue = 0;
+    for (typename std::vector<key>::iterator it = begin; it != end; ++it) {
+      radix r = Traits::toRadix(*it);
+      if ((lastInd < 0) || (r != lastValue)) {
+        lastInd = findValue(*it, r);
+        if (lastInd < 0) return false;
+        lastValue = r;
+      }
+      counts[lastInd]++;
+    }
+
+    for (size_t v = 0; v < values.size(); v++) {
+      begin = std::fill_n(begin, counts[v], Traits::fromRadix(values[v]));
+    }
+    return true;
   }
 
 } //namespace ems
@@ -5,10 +5,69 @@
 #pragma once
 
 #include "ExternalMergeSortBase.h"
+#include "KeyOrder.h"
+#include "RadixSort.h"
+#include "RunCodec.h"
+
+#include <map>
 
 namespace ems {
   template<typename key> using SortFunction = std::function < void(typename std::vector<key>::iterator, typename std::vector<key>::iterator) >;
 
+  //Default sort function: radixSort for the integral and floating point keys, std::sort by KeyOrder otherwise
+  template<typename key, bool useRadixSort = RadixTraits<key>::isSupported>
+  struct DefaultSortFunction {
+    static SortFunction<key> get() {
+      return [](typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt) { std::sort(beginIt, endIt, KeyLess<key>()); };
+    }
+  };
+  template<typename key>
+  struct DefaultSortFunction<key, true> {
+    static SortFunction<key> get() {
+      return radixSort<key>;
+    }
+  };
+
+  //Keys sorted by counting: integers of at most 16 bits, whose mapping by RadixTraits indexes the buckets
+  template<typename key, bool isNarrowInteger = std::is_integral<key>::value && !std::is_same<key, bool>::value && (sizeof(key) <= 2)>
+  struct CountingSortTraits {
+    static const bool isSupported = false;
+    static const long long numBuckets = 0;
+    static inline long long bucket(const key &) {
+      return 0;
+    }
+    static inline key value(long long) {
+      return key();
+    }
+  };
+  template<typename key>
+  struct CountingSortTraits<key, true> {
+    static const bool isSupported = true;
+    static const long long numBuckets = 1LL << (8 * sizeof(key));
+    static inline long long bucket(const key &k) {
+      return RadixTraits<key>::toRadix(k);
+    }
+    static inline key value(long long b) {
+      return RadixTraits<key>::fromRadix(static_cast<typename RadixTraits<key>::type>(b));
+    }
+  };
+
+  //Maximum number of distinct keys of a chunk sorted by counting by the adaptive sort
+  const long long fewUniqueKeys = 64;
+
+  //Sort of the keys holding at most fewUniqueKeys distinct keys by counting, the keys are told apart by their RadixTraits mapping
+  //sort returns false, leaving the keys unchanged, if they hold more, a NaN or if the keys have no such mapping
+  template<typename key, bool isSupported = RadixTraits<key>::isSupported>
+  struct FewUniqueKeysSort {
+    static bool sort(typename std::vector<key>::iterator, typename std::vector<key>::iterator) {
+      return false;
+    }
+  };
+  template<typename key>
+  struct FewUniqueKeysSort<key, true> {
+    static bool sort(typename std::vector<key>::iterator begin, typename std::vector<key>::iterator end);
+  };
+
   template<typename key>
   class ExternalMergeSort : public ExternalMergeSortBase
   {
@@ -17,12 +76,14 @@ namespace ems {
 
     //Set the sort function for the given thread
     //If threadId is -1, set this function as default for all threads
-    //Initially default sort function is std::sort
-    void setSortFunction(SortFunction<key> sortFunc, int threadId = -1);
+    //Initially default sort function is radixSort for integral and floating point keys and std::sort otherwise
+    //The chunks must be sorted in KeyOrder, the order of the merges: plain std::sort does not place the NaNs
+    //Note that radixSort allocates a temporary buffer as large as the chunks
+    virtual void setSortFunction(SortFunction<key> sortFunc, int threadId = -1);
 
     //Reset the sort functions for the given thread
     //If threadId is -1, clear all thread-specific sort functions, keeping only the default one
-    void clearSortFunction(int threadId = -1);
+    virtual void clearSortFunction(int threadId = -1);
 
     //Perform the external merge sort
     //Returns true if successful
@@ -32,14 +93,107 @@ namespace ems {
     //Function to sort a chunk
     virtual void handleSortChunkTask(int threadId, Task *task, SortFunction<key> sortFunc);
 
+    //Function to sort chunks in a pipeline
+    virtual void handleSortPipelineTask(int threadId, Task *task, SortFunction<key> sortFunc);
+
+    //Function to generate sorted files with replacement selection
+    virtual void handleReplacementSelectionTask(int threadId, Task *task, SortFunction<key> sortFunc);
+
     //Function to merge a chunl
     virtual void handleMergeFilesTask(int threadId, Task *task);
 
+    //Function to load and sort a slice of an input sorted in memory
+    virtual void handleSortSliceTask(int threadId, Task *task, SortFunction<key> sortFunc);
+
+    //Function to merge a range of the sorted slices of an input sorted in memory
+    virtual void handleMergeSlicesTask(int threadId, Task *task);
+
+    //Merge the ranges [inputFilePos, inputFileEnd) of the input files in place in memory mapped files
+    //The merged keys are written from mergedFilePos in the merged file
+    //The clusters of input files are merged one after the other
+    void mergeMappedFiles(const MergeFilesTask &mergeTask, std::vector<std::unique_ptr<File>> &inputFiles, const std::vector<long long> &inputFilePos,
+      const std::vector<long long> &inputFileEnd, long long mergedFilePos, File &mergedFile, const std::vector<std::vector<long long>> &clusters);
+
+    //Function to count the keys of a range of the input for a counting sort
+    virtual void handleCountKeysTask(int threadId, Task *task);
+
+    //Function to write a range of the output of a counting sort
+    virtual void handleWriteKeysTask(int threadId, Task *task);
+
+    //Function to find the natural runs of a range of the input
+    virtual void handleScanRunsTask(int threadId, Task *task);
+
+    //Function to create the file written by the parts of a split merge
+    virtual void handleCreateFileTask(int threadId, Task *task);
+
     //Allocate the data for the threads
     virtual void allocateData();
 
+    //Size in bytes of the keys sorted
+    virtual long long keySize() const {
+      return sizeof(key);
+    }
+
+    //First key of the data of a thread, aligned for direct I/O when it is enabled
+    typename std::vector<key>::iterator threadData(int threadId);
+
+    //Number of keys in directIoAlignment bytes when direct I/O is enabled, 1 otherwise
+    long long directIoKeys() const;
+
+    //Round a number of keys down to a multiple of directIoKeys, unless it is smaller
+    long long alignKeys(long long numKeys) const;
+
+    //Is the file a compressed run?
+    bool isCompressedRun(const std::string &fileName) const;
+
+    //First rank of a part of a split merge, aligned if the merged file is written with direct I/O
+    long long partRank(long long numValues, long long part, long long numParts, const std::string &mergedFileName) const;
+
+    //Sort the keys of a chunk with sortFunc, or in linear time if the adaptive sort finds them sorted,
+    //sorted in reverse order or with few distinct keys
+    void sortChunk(typename std::vector<key>::iterator begin, typename std::vector<key>::iterator end, const SortFunction<key> &sortFunc);
+
+    //Scan the input for natural runs if it has at most maxRuns of them, runStarts is then the first position of each run
+    //Returns false if there are more natural runs
+    bool findNaturalRuns(long long numValues, long long maxRuns, std::vector<long long> &runStarts, std::vector<std::shared_ptr<Task>> &completedTasks);
+
+    //Record the first and last key of a sorted run written by the sort, starting at offset in the file
+    //Can be called concurrently by the threads
+    void setRunRange(const std::string &fileName, long long offset, const key &first, const key &last);
+
+    //First and last key of each of the input runs of a merge
+    //Returns false if the range of one of them is not known
+    bool getRunRanges(const MergeFilesTask &mergeTask, std::vector<std::pair<key, key>> &ranges);
+
+    //Split the input runs of a merge in clusters of runs whose key ranges overlap, in key order
+    //The clusters follow each other in the merged file, a cluster of a single run is copied
+    //All the runs form a single cluster if the range of one of them is not known
+    std::vector<std::vector<long long>> mergeClusters(const MergeFilesTask &mergeTask);
+
+    //Sort an input of numValues keys which fits in the data of all the threads, without temporary files
+    //Returns true if successful
+    bool sortInMemory(long long numValues);
+
+    //Sort an input of numValues narrow integer keys by counting, without temporary files
+    //Returns true if successful
+    bool sortByCounting(long long numValues);
+
+    //Wait until all the given tasks are completed, the completed tasks are kept in completedTasks if profiling
+    //Returns false if the workers stopped before
+    bool waitForTasks(const std::vector<std::shared_ptr<Task>> &tasks, std::vector<std::shared_ptr<Task>> &completedTasks);
+
+    //Reset the handlers of a task type for the given thread (see clearSortFunction)
+    template<typename TaskType>
+    void clearTaskHandler(int threadId);
+
     //vector of keys for each thread
     std::vector< std::vector<key> > dataVec_;
+
+    //First and last key of the sorted runs of the current sort, by file name and offset
+    std::map<std::pair<std::string, long long>, std::pair<key, key>> runRanges_;
+
+    //Used to serialize the accesses to the ranges
+    std::mutex runRangesMutex_;
   };
 
 } //namespace ems
@@ -13,8 +13,18 @@
 #include <memory>
 
 #include "ThreadPool.h"
+#include "Util.h"
+#include "FileIo.h"
+#include "IoRing.h"
+#include "MergeKernel.h"
 
 namespace ems {
+  //Fan-in for which a memory budget keeps merge blocks of at least minIoSize bytes, by reducing the number of threads
+  const long long minBudgetMerges = 8;
+
+  //Maximum fan-in set by a memory budget, more inputs per merge would mostly add seeks
+  const long long maxBudgetMerges = 64;
+
   //Tasks for sorting chunks
   struct SortChunkTask : public Task {
     long long startInd;
@@ -22,24 +32,148 @@ namespace ems {
     std::string sortedFileName;
   };
 
+  //Task for generating sorted runs from a range of the input with replacement selection
+  struct ReplacementSelectionTask : public Task {
+    long long startInd;
+    long long numValues;
+    //Generated runs (file name and number of values)
+    std::vector<std::pair<std::string, long long>> runs;
+  };
+
+  //Chunks sorted by pipelined workers
+  struct SortPipeline {
+    SortPipeline() : nextChunk(0), stop(false) {}
+
+    //Tasks describing the chunks, pushed to the completed tasks once sorted
+    std::vector<std::shared_ptr<SortChunkTask>> chunks;
+
+    //Index of the next chunk to be claimed by a worker
+    std::atomic<long long> nextChunk;
+
+    //Set when a worker failed so that the other workers stop claiming chunks
+    std::atomic<bool> stop;
+  };
+
+  //Task for sorting chunks in a pipeline: the worker loads the next chunk and writes
+  //the previous one while sorting the current one
+  struct SortPipelineTask : public Task {
+    std::shared_ptr<SortPipeline> pipeline;
+  };
+
   //Task for merging files
   struct MergeFilesTask : public Task {
+    MergeFilesTask() : level(0), part(0), numParts(1) {}
+
     std::vector<std::pair<std::string,long long>> files;
+    //Position of the first key of each file, the files start at their beginning if empty
+    //Natural runs of a presorted input are ranges of the input file
+    std::vector<long long> fileOffsets;
     int level;
     std::string mergedFileName;
+
+    //When a merge is split between numParts tasks, each task merges a range of keys and writes it
+    //at its position in the merged file. The input files are then removed once all parts are completed.
+    int part;
+    int numParts;
+  };
+
+  //Task for loading and sorting a slice of an input which fits in the data of all the threads
+  //The slice is kept in memory, in the data of thread slice
+  struct SortSliceTask : public Task {
+    long long startInd;
+    long long numValues;
+    int slice;
+  };
+
+  //Task for merging a range of keys of the sorted slices and writing it at its position in the output file
+  //The keys are split between numParts tasks in ranges of equal size
+  struct MergeSlicesTask : public Task {
+    MergeSlicesTask() : part(0), numParts(1) {}
+
+    std::vector<long long> sliceSizes;
+    std::string mergedFileName;
+    int part;
+    int numParts;
+  };
+
+  //Task for finding the natural runs of a range of the input: the positions of the keys smaller than the previous key
+  //The scan stops once more than maxDescents positions are found, the range is then too disordered
+  struct ScanRunsTask : public Task {
+    ScanRunsTask() : startInd(0), numValues(0), maxDescents(0), tooManyDescents(false) {}
+
+    long long startInd;
+    long long numValues;
+    long long maxDescents;
+    std::vector<long long> descents;
+    bool tooManyDescents;
+  };
+
+  //Task for counting the keys of a range of the input, counts[b] is the number of keys of bucket b
+  struct CountKeysTask : public Task {
+    long long startInd;
+    long long numValues;
+    std::vector<long long> counts;
+  };
+
+  //Task for writing a range of the output of a counting sort at its position in the output file
+  //The keys are split between numParts tasks in ranges of equal size, the counts of all the ranges are summed
+  struct WriteKeysTask : public Task {
+    WriteKeysTask() : part(0), numParts(1) {}
+
+    std::vector<std::shared_ptr<CountKeysTask>> countTasks;
+    std::string fileName;
+    int part;
+    int numParts;
+  };
+
+  //Task for creating a file of fileSize bytes, or resizing it, before several tasks write their part of it
+  struct CreateFileTask : public Task {
+    CreateFileTask() : fileSize(0) {}
+
+    std::string fileName;
+    long long fileSize;
   };
 
   class ExternalMergeSortBase
   {
   public:
+    //Phases whose files can bypass the page cache, can be combined
+    enum DirectIoPhase {
+      //Reads of the input file
+      DirectInput = 1,
+      //Writes and reads of the sorted chunks and intermediate merges
+      DirectTemporaryFiles = 2,
+      //Writes of the output file
+      DirectOutput = 4
+    };
+
     ExternalMergeSortBase() :
       numThreads_(4),
       dataSizePerThread_(10000000),
-      numMergesPerThread_(10)
+      numMergesPerThread_(10),
+      memoryBudget_(0),
+      minIoSize_(1 << 20),
+      mergeKernel_(MergeKernel::Cascade),
+      doubleBuffering_(true),
+      pipelinedSort_(false),
+      replacementSelection_(false),
+      parallelFinalMerge_(true),
+      inMemorySort_(true),
+      countingSort_(true),
+      adaptiveSort_(true),
+      memoryMappedIo_(false),
+      ioUring_(false),
+      ioQueueDepth_(32),
+      directIo_(0),
+      compressTemporaryFiles_(false),
+      tmpFileId_(0)
     {
       if (std::thread::hardware_concurrency()) numThreads_ = std::thread::hardware_concurrency();
     }
 
+    //The sorts can be deleted through a pointer to their base class
+    virtual ~ExternalMergeSortBase() {}
+
     //Set/get the input file name
     inline void setInputFileName(const char *fileName) {
       inputFileName_ = fileName ? fileName : "";
@@ -92,6 +226,166 @@ namespace ems {
       return numMergesPerThread_;
     };
 
+    //Set/get the memory budget of the sort in bytes (default 0, no budget)
+    //A budget sets the number of threads, the data size per thread (and thus the chunk size) and the number of merges
+    //per thread, which can still be changed afterwards. It is capped to 3/4 of the memory available to the process (physical memory or cgroup limit).
+    //Each thread is counted twice its data, for the buffer of the radix sort or the encoded blocks of the compressed files.
+    //The threads are as many as the hardware threads, or fewer so that the merge blocks are at least minIoSize bytes
+    //for a fan-in of 8, and the fan-in is as large as these blocks allow, up to maxBudgetMerges
+    inline void setMemoryBudget(long long numBytes) {
+      memoryBudget_ = std::max(0LL, numBytes);
+      applyMemoryBudget();
+    }
+    inline long long getMemoryBudget() const {
+      return memoryBudget_;
+    }
+
+    //Set/get the minimum size in bytes of the merge blocks for a memory budget (default 1MB)
+    inline void setMinIoSize(long long numBytes) {
+      minIoSize_ = std::max(1LL, numBytes);
+      applyMemoryBudget();
+    }
+    inline long long getMinIoSize() const {
+      return minIoSize_;
+    }
+
+    //Set/get the kernel used to merge the sorted chunks (default cascade of two-way merges)
+    inline void setMergeKernel(MergeKernel kernel) {
+      mergeKernel_ = kernel;
+    }
+    inline MergeKernel getMergeKernel() const {
+      return mergeKernel_;
+    }
+
+    //Enable/disable double buffering in the merge tasks (default enabled)
+    //When enabled, the buffers of the merged files are split in two blocks so that the next block
+    //of each input file is loaded and the previous merged block is written while merging
+    inline void setDoubleBuffering(bool doubleBuffering) {
+      doubleBuffering_ = doubleBuffering;
+    }
+    inline bool getDoubleBuffering() const {
+      return doubleBuffering_;
+    }
+
+    //Enable/disable pipelined sorting of the chunks (default disabled)
+    //When enabled, the data of each thread is split in three slots so that a worker
+    //loads the next chunk and writes the previous one while sorting the current one
+    //The chunks (and thus the initial sorted files) are three times smaller
+    inline void setPipelinedSort(bool pipelinedSort) {
+      pipelinedSort_ = pipelinedSort;
+    }
+    inline bool getPipelinedSort() const {
+      return pipelinedSort_;
+    }
+
+    //Enable/disable replacement selection to generate the initial sorted files (default disabled)
+    //Instead of sorting fixed size chunks, each thread streams a range of the input through a heap
+    //of about dataSizePerThread keys. The sorted files are twice as large on average for random input
+    //and nearly sorted input gives a single file per thread. Takes precedence over pipelined sorting.
+    inline void setReplacementSelection(bool replacementSelection) {
+      replacementSelection_ = replacementSelection;
+    }
+    inline bool getReplacementSelection() const {
+      return replacementSelection_;
+    }
+
+    //Enable/disable splitting the final merge between all the threads (default enabled)
+    //The keys are split in ranges of equal size by multisequence selection in the merged files
+    //and each thread merges one range directly at its position in the output file
+    inline void setParallelFinalMerge(bool parallelFinalMerge) {
+      parallelFinalMerge_ = parallelFinalMerge;
+    }
+    inline bool getParallelFinalMerge() const {
+      return parallelFinalMerge_;
+    }
+
+    //Enable/disable sorting in memory the inputs which fit in the data of all the threads (default enabled)
+    //Each thread loads and sorts a slice of the input, then the slices are merged in parallel
+    //directly to the output file, without any temporary file
+    inline void setInMemorySort(bool inMemorySort) {
+      inMemorySort_ = inMemorySort;
+    }
+    inline bool getInMemorySort() const {
+      return inMemorySort_;
+    }
+
+    //Enable/disable the counting sort of the 8 and 16-bit integer keys (default enabled)
+    //The threads count the keys of their range of the input in parallel, then write their range
+    //of the output from the counts, in a single read and a single write without any temporary file
+    inline void setCountingSort(bool countingSort) {
+      countingSort_ = countingSort;
+    }
+    inline bool getCountingSort() const {
+      return countingSort_;
+    }
+
+    //Enable/disable the adaptive sort of presorted inputs (default enabled)
+    //The chunks already sorted are not sorted again, the chunks sorted in reverse order are reversed and the chunks
+    //with at most fewUniqueKeys distinct keys are sorted by counting. Before planning the chunks, the threads scan the input
+    //for natural runs (ascending ranges): if there are fewer natural runs than chunks they are merged directly from the input
+    //file, without sorting and writing the chunks. The scan of a random input stops after a few keys per thread.
+    inline void setAdaptiveSort(bool adaptiveSort) {
+      adaptiveSort_ = adaptiveSort;
+    }
+    inline bool getAdaptiveSort() const {
+      return adaptiveSort_;
+    }
+
+    //Enable/disable memory mapped I/O (default disabled)
+    //When enabled, the chunks are copied from the mapped input and to the mapped sorted files, and the merges
+    //read the keys in place in the mapped input files and write them in place in the mapped merged file
+    //The merges then do not use the data of the threads but rely on the page cache
+    //Ignored on platforms without memory mapped files
+    inline void setMemoryMappedIo(bool memoryMappedIo) {
+      memoryMappedIo_ = memoryMappedIo;
+    }
+    inline bool getMemoryMappedIo() const {
+      return memoryMappedIo_;
+    }
+
+    //Enable/disable io_uring for the I/O of the chunks and merges (default disabled)
+    //Each task submits its reads and writes in batches of requests of at most 1MB, up to ioQueueDepth
+    //requests in flight, instead of one blocking request at a time
+    //Falls back to positional reads and writes when io_uring is not available, memory mapped I/O takes precedence
+    inline void setIoUring(bool ioUring) {
+      ioUring_ = ioUring;
+    }
+    inline bool getIoUring() const {
+      return ioUring_;
+    }
+
+    //Set/get the maximum number of io_uring requests in flight for each task (default 32)
+    inline void setIoQueueDepth(int queueDepth) {
+      ioQueueDepth_ = std::max(1, queueDepth);
+    }
+    inline int getIoQueueDepth() const {
+      return ioQueueDepth_;
+    }
+
+    //Set/get the phases using direct I/O, a combination of DirectIoPhase flags (default none)
+    //The files of these phases are opened in Direct mode and the chunks, merge blocks and split points are
+    //aligned so that most of their I/O bypasses the page cache, for example DirectTemporaryFiles alone keeps
+    //the temporary runs out of the cache while the final output stays buffered
+    //Memory mapped I/O ignores this setting
+    inline void setDirectIo(int phases) {
+      directIo_ = phases & (DirectInput | DirectTemporaryFiles | DirectOutput);
+    }
+    inline int getDirectIo() const {
+      return directIo_;
+    }
+
+    //Enable/disable the compression of the temporary files (default disabled)
+    //The sorted chunks and intermediate merges are written as blocks of bit-packed deltas (see RunCodec.h),
+    //decoded by the merges reading them. Each merge input and output has its own buffer of encoded blocks
+    //in addition to the data of the threads. Only for the keys supported by RadixTraits, memory mapped I/O
+    //takes precedence and the merges reading compressed files do not use io_uring
+    inline void setCompressTemporaryFiles(bool compressTemporaryFiles) {
+      compressTemporaryFiles_ = compressTemporaryFiles;
+    }
+    inline bool getCompressTemporaryFiles() const {
+      return compressTemporaryFiles_;
+    }
+
     //Perform the external merge sort
     //Returns true if successful
     virtual bool sort() = 0;
@@ -100,13 +394,58 @@ namespace ems {
     //Allocate the data for the threads
     virtual void allocateData() = 0;
 
+    //Size in bytes of the keys sorted
+    virtual long long keySize() const = 0;
+
+    //Set the number of threads, data size and number of merges per thread from the memory budget, if any
+    inline void applyMemoryBudget() {
+      if (!memoryBudget_) return;
+      long long budget = memoryBudget_;
+      long long limit = processMemoryLimit();
+      if (limit) budget = std::min(budget, limit - limit / 4);
+
+      //Double buffered blocks of minIoSize bytes for 8 inputs and the merged file, twice for the radix sort buffer
+      long long keyBytes = keySize();
+      long long blockKeys = std::max(1LL, minIoSize_ / keyBytes);
+      long long minThreadBytes = 2 * keyBytes * 2 * blockKeys * (minBudgetMerges + 1);
+      long long numThreads = std::max(1u, std::thread::hardware_concurrency());
+      numThreads = std::max(1LL, std::min(numThreads, budget / minThreadBytes));
+
+      numThreads_ = static_cast<int>(numThreads);
+      dataSizePerThread_ = std::max(3LL, budget / (2 * keyBytes * numThreads));
+      numMergesPerThread_ = std::min(maxBudgetMerges, dataSizePerThread_ / (2 * blockKeys) - 1);
+      numMergesPerThread_ = std::min(dataSizePerThread_ - 1, std::max(2LL, numMergesPerThread_));
+      allocateData();
+    }
+
+    //Find an available name for a temporary file, can be called concurrently by the threads
+    //Returns an empty string if no name is available
+    inline std::string getTemporaryFileName() {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(tmpFileMutex_);
+      std::string fileName = findAvailableFileName(outputFileName_, tmpFileId_);
+      tmpFileId_++;
+      return fileName;
+      //Release lock
+    }
+
+    //Mode to open a file written and read by the sort, Direct if its phase uses direct I/O
+    inline int fileMode(const std::string &fileName, int mode) const {
+      int phase = (fileName == outputFileName_) ? DirectOutput : ((fileName == inputFileName_) ? DirectInput : DirectTemporaryFiles);
+      return (directIo_ & phase) ? (mode | File::Direct) : mode;
+    }
+
+    //Remove a file read by a merge, unless it is the input file
+    inline void removeMergedFile(const std::string &fileName) const {
+      if (!fileName.empty() && (fileName != inputFileName_)) remove(fileName.c_str());
+    }
+
     //Close the open files and remove the intermediate files
     inline void cleanup() {
       pool_.stopHandlingTasks();
       pool_.join();
 
-      if (inFile_.is_open()) inFile_.close();
-      inFile_.clear();
+      inFile_.close();
 
       std::shared_ptr<Task> task;
 
@@ -115,7 +454,7 @@ namespace ems {
         task = pool_.getTask(false, false);
         if (!task) task = pool_.getCompletedTask(false, false);
         while (!task && storedTasks_.size()) {
-          auto taskList = storedTasks_.back();
+          auto &taskList = storedTasks_.back();
           if (!taskList.size()) storedTasks_.pop_back();
           else {
             task = taskList.back();
@@ -125,21 +464,29 @@ namespace ems {
         if (task) {
           SortChunkTask *sortTask = dynamic_cast<SortChunkTask *>(task.get());
           if (sortTask) {
-            if (!sortTask->sortedFileName.empty()) remove(sortTask->sortedFileName.c_str());
+            removeMergedFile(sortTask->sortedFileName);
           }
           else {
             MergeFilesTask *mergeTask = dynamic_cast<MergeFilesTask *>(task.get());
+            ReplacementSelectionTask *selectionTask = dynamic_cast<ReplacementSelectionTask *>(task.get());
             if (mergeTask) {
-              for (auto fileInfo : mergeTask->files) {
-                if (!fileInfo.first.empty()) remove(fileInfo.first.c_str());
-              }
+              for (auto fileInfo : mergeTask->files) removeMergedFile(fileInfo.first);
               if (!mergeTask->mergedFileName.empty()) remove(mergeTask->mergedFileName.c_str());
             }
+            else if (selectionTask) {
+              for (auto runInfo : selectionTask->runs) remove(runInfo.first.c_str());
+            }
           }
         }
       } while (task);
     }
 
+    //Clean up after a sort which did not complete and remove its partial output, unless it is the input file
+    inline void cleanupFailedSort() {
+      cleanup();
+      if (outputFileName_ != inputFileName_) remove(outputFileName_.c_str());
+    }
+
     //Input file name
     std::string inputFileName_;
 
@@ -158,17 +505,65 @@ namespace ems {
     //Maximum amount of chunks merged per thread (default 10)
     long long numMergesPerThread_;
 
+    //Memory budget of the sort in bytes, 0 if none
+    long long memoryBudget_;
+
+    //Minimum size in bytes of the merge blocks for a memory budget
+    long long minIoSize_;
+
+    //Kernel used by the merge tasks
+    MergeKernel mergeKernel_;
+
+    //Indicates whether the merge tasks overlap I/O and merging
+    bool doubleBuffering_;
+
+    //Indicates whether the chunks are sorted by pipelined workers
+    bool pipelinedSort_;
+
+    //Indicates whether the sorted files are generated by replacement selection
+    bool replacementSelection_;
+
+    //Indicates whether the final merge is split between the threads
+    bool parallelFinalMerge_;
+
+    //Indicates whether the inputs which fit in the data of all the threads are sorted in memory
+    bool inMemorySort_;
+
+    //Indicates whether the narrow integer keys are sorted by counting
+    bool countingSort_;
+
+    //Indicates whether the presorted chunks and natural runs are detected
+    bool adaptiveSort_;
+
+    //Indicates whether the chunks and merges use memory mapped files
+    bool memoryMappedIo_;
+
+    //Indicates whether the chunks and merges use io_uring
+    bool ioUring_;
+
+    //Maximum number of io_uring requests in flight for each task
+    int ioQueueDepth_;
+
+    //Phases using direct I/O
+    int directIo_;
+
+    //Indicates whether the temporary files are compressed
+    bool compressTemporaryFiles_;
+
+    //Unique id used for temporary files
+    int tmpFileId_;
+
+    //Used to serialize the choice of temporary file names
+    std::mutex tmpFileMutex_;
+
     //The pool containing the worker threads
     ThreadPool pool_;
 
     //Tasks stored by the main thread for future merge
     std::vector< std::vector< std::shared_ptr<Task> > > storedTasks_;
 
-    //The input file
-    std::fstream inFile_;
-
-    //Used to serialize access to the input file by the threads
-    std::mutex inFileMutex_;
+    //The input file, read concurrently by the threads with positional reads
+    File inFile_;
   };
 
 } //namespace ems
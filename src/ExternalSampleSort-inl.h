@@ -0,0 +1,377 @@
+#pragma once
+
+#include "Util.h"
+#include "AsyncIo.h"
+
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <deque>
+
+namespace ems {
+
+  template<typename key>
+  ExternalSampleSort<key>::ExternalSampleSort() {
+    //The base class sets its own handlers, the buckets are sorted with the default sort function
+    setSortFunction(DefaultSortFunction<key>::get());
+    this->pool_.template addTaskHandler<PartitionTask<key>>(std::bind(&ExternalSampleSort<key>::handlePartitionTask, this, std::placeholders::_1, std::placeholders::_2));
+  }
+
+  template<typename key>
+  void ExternalSampleSort<key>::setSortFunction(SortFunction<key> sortFunc, int threadId) {
+    ExternalMergeSort<key>::setSortFunction(sortFunc, threadId);
+    this->pool_.template addTaskHandler<SortBucketTask<key>>(std::bind(&ExternalSampleSort<key>::handleSortBucketTask, this, std::placeholders::_1, std::placeholders::_2, sortFunc), threadId);
+  }
+
+  template<typename key>
+  void ExternalSampleSort<key>::clearSortFunction(int threadId) {
+    ExternalMergeSort<key>::clearSortFunction(threadId);
+    this->template clearTaskHandler<SortBucketTask<key>>(threadId);
+  }
+
+  template<typename key>
+  long long upperSplitter(const key *splitters, long long numSplitters, const key &k) {
+    if (!numSplitters) return 0;
+    //The range keeps its first element not greater than k, if any, and halves at each step
+    const key *base = splitters;
+    long long n = numSplitters;
+    while (n > 1) {
+      long long half = n / 2;
+      base = KeyOrder<key>::less(k, base[half]) ? base : base + half;
+      n -= half;
+    }
+    return (base - splitters) + (KeyOrder<key>::less(k, *base) ? 0 : 1);
+  }
+
+  template<typename key>
+  bool ExternalSampleSort<key>::sort() {
+    try {
+      if ((this->inputFileName_.empty()) || (this->outputFileName_.empty())) {
+        std::cerr << "ExternalSampleSort::sort No input or output file specified" << std::endl;
+        this->cleanup();
+        return false;
+      }
+
+      //Open the input file
+      if (!this->inFile_.open(this->inputFileName_, (this->directIo_ & ExternalMergeSortBase::DirectInput) ? (File::Read | File::Direct) : File::Read)) {
+        std::cerr << "ExternalSampleSort::sort Could not open file " << this->inputFileName_ << std::endl;
+        this->cleanup();
+        return false;
+      }
+
+      //File size should be a multiple of sizeof(key)
+      long long dataLength = this->inFile_.size();
+      if ((dataLength < 0) || (dataLength % sizeof(key))) {
+        std::cerr << "ExternalSampleSort::sort Invalid file size" << std::endl;
+        this->cleanup();
+        return false;
+      }
+      long long numValues = dataLength / sizeof(key);
+      long long dataSize = this->dataSizePerThread_;
+      int numThreads = this->numThreads_;
+
+      //Sorts without temporary files
+      if ((this->countingSort_ && CountingSortTraits<key>::isSupported && (numValues > 0)) ||
+        (this->inMemorySort_ && (numThreads > 1) && (numValues > 0) && (numValues <= numThreads * dataSize))) {
+        this->inFile_.close();
+        return ExternalMergeSort<key>::sort();
+      }
+
+      //Unique id used for temporary files
+      this->tmpFileId_ = 0;
+      bucketFileNames_.clear();
+
+      //Clear all previous tasks in the pool
+      this->pool_.clearTasks();
+      this->pool_.clearCompletedTasks();
+
+      //Set up profiling if the a profiling file has been specified
+      std::vector<std::shared_ptr<Task>> completedTasks;
+      bool profile = !this->profilingFileName_.empty();
+      this->pool_.setProfile(profile);
+
+      //The output file is sized first, its content is kept since it may be the input file
+      //The buckets are only written once the whole input is partitioned
+      File outFile;
+      if (!outFile.open(this->outputFileName_, File::Write | File::Keep)) throw std::ios_base::failure("Could not open file " + this->outputFileName_);
+      outFile.resize(sizeof(key)*numValues);
+      outFile.close();
+
+      this->pool_.handleTasks(numThreads);
+
+      //Buckets still to be sorted or partitioned, starting with the whole input
+      std::deque<std::shared_ptr<SortBucketTask<key>>> buckets;
+      std::shared_ptr<SortBucketTask<key>> inputBucket = std::make_shared<SortBucketTask<key>>();
+      inputBucket->numValues = numValues;
+      if (numValues > 0) buckets.push_back(inputBucket);
+
+      //The sorted buckets are only waited for at the end, the partitions one at a time
+      long long numBucketTasks = 0;
+      long long numBucketTasksCompleted = 0;
+      auto waitForPartition = [&](size_t numTasks) {
+        while (numTasks) {
+          std::shared_ptr<Task> completedTask = this->pool_.getCompletedTask();
+          if (!completedTask) return false;
+          if (profile) completedTasks.push_back(completedTask);
+          if (dynamic_cast<PartitionTask<key> *>(completedTask.get())) numTasks--;
+          else numBucketTasksCompleted++;
+        }
+        return true;
+      };
+
+      //A failed wait leaves the output incomplete, the bucket files and the output are removed
+      auto failSort = [&]() {
+        std::cerr << "ExternalSampleSort::sort The sort tasks did not complete" << std::endl;
+        this->cleanupFailedSort();
+        for (auto &fileName : bucketFileNames_) remove(fileName.c_str());
+        bucketFileNames_.clear();
+        return false;
+      };
+
+      //Fixed seed so that a sort is reproducible
+      std::mt19937_64 gen(numValues);
+      while (!buckets.empty()) {
+        std::shared_ptr<SortBucketTask<key>> bucket = buckets.front();
+        buckets.pop_front();
+        if (bucket->isSorted || (bucket->numValues <= dataSize)) {
+          this->pool_.addTask(bucket);
+          numBucketTasks++;
+          continue;
+        }
+
+        //One range of the bucket per thread, the partitions go before the sorts to keep the threads busy
+        std::shared_ptr<SamplePartition<key>> partition = createPartition(*bucket, gen);
+        long long rangeSize = (bucket->numValues + numThreads - 1) / numThreads;
+        long long numRanges = (bucket->numValues + rangeSize - 1) / rangeSize;
+        for (long long i = 0; i < numRanges; i++) {
+          std::shared_ptr<PartitionTask<key>> partitionTask = std::make_shared<PartitionTask<key>>();
+          partitionTask->partition = partition;
+          partitionTask->startInd = bucket->startInd + i*rangeSize;
+          partitionTask->numValues = std::min(rangeSize, bucket->numValues - i*rangeSize);
+          this->pool_.addTask(partitionTask, 1);
+        }
+        if (!waitForPartition(static_cast<size_t>(numRanges))) return failSort();
+
+        //The partitioned bucket file is not needed anymore
+        partition->file.close();
+        if (!partition->fileName.empty()) remove(partition->fileName.c_str());
+
+        //The buckets follow each other in the output from the position of the partitioned bucket
+        long long outputInd = bucket->outputInd;
+        long long numSplitters = partition->splitters.size();
+        for (long long b = 0; b <= 2 * numSplitters; b++) {
+          long long bucketSize = partition->bucketSizes[b];
+          partition->bucketFiles[b]->close();
+          if (!bucketSize) {
+            remove(partition->bucketFileNames[b].c_str());
+            continue;
+          }
+
+          std::shared_ptr<SortBucketTask<key>> subBucket = std::make_shared<SortBucketTask<key>>();
+          subBucket->fileName = partition->bucketFileNames[b];
+          subBucket->numValues = bucketSize;
+          subBucket->outputInd = outputInd;
+          subBucket->isSorted = (b % 2);
+          buckets.push_back(subBucket);
+          outputInd += bucketSize;
+        }
+      }
+
+      //Wait for the sorted buckets, the bucket files are removed once read
+      while (numBucketTasksCompleted < numBucketTasks) {
+        std::shared_ptr<Task> completedTask = this->pool_.getCompletedTask();
+        if (!completedTask) return failSort();
+        if (profile) completedTasks.push_back(completedTask);
+        numBucketTasksCompleted++;
+      }
+
+      //Stop handling and join the threads
+      this->cleanup();
+      bucketFileNames_.clear();
+
+      //Write profiling information
+      if (profile) {
+        writeProfilingFile(this->profilingFileName_, numThreads, this->pool_.getStartTime(), this->pool_.getEndTime(), completedTasks);
+      }
+
+      return true;
+    }
+    catch (...) {
+      //Make sure we cleanup before exiting
+      std::cerr << "ExternalSampleSort::sort exception occured " << std::endl;
+      this->cleanup();
+      for (auto &fileName : bucketFileNames_) remove(fileName.c_str());
+      bucketFileNames_.clear();
+      throw;
+    }
+  }
+
+  template<typename key>
+  std::shared_ptr<SamplePartition<key>> ExternalSampleSort<key>::createPartition(const SortBucketTask<key> &bucket, std::mt19937_64 &gen) {
+    std::shared_ptr<SamplePartition<key>> partition = std::make_shared<SamplePartition<key>>();
+    partition->fileName = bucket.fileName;
+    File *file = &this->inFile_;
+    if (!bucket.fileName.empty()) {
+      if (!partition->file.open(bucket.fileName, this->fileMode(bucket.fileName, File::Read))) throw std::ios_base::failure("Could not open file " + bucket.fileName);
+      file = &partition->file;
+    }
+
+    //Buckets of half the data of a thread on average so that most of them fit despite the sampling error
+    //Each bucket file has a buffer in the data of the partitioning threads, which bounds their number
+    long long dataSize = this->dataSizePerThread_;
+    long long bucketSize = std::max(1LL, dataSize / 2);
+    long long maxSplitters = std::max(1LL, std::min(255LL, dataSize / 16));
+    long long numSplitters = std::max(1LL, std::min(maxSplitters, (bucket.numValues + bucketSize - 1) / bucketSize - 1));
+
+    //32 samples per bucket, read by groups of 8 consecutive keys at random positions
+    long long groupSize = std::min(8LL, bucket.numValues);
+    long long numGroups = 4 * (numSplitters + 1);
+    std::vector<key> samples(numGroups * groupSize);
+    std::uniform_int_distribution<long long> posDist(0, bucket.numValues - groupSize);
+    for (long long g = 0; g < numGroups; g++) {
+      file->read(&samples[g*groupSize], sizeof(key)*groupSize, sizeof(key)*(bucket.startInd + posDist(gen)));
+    }
+    std::sort(samples.begin(), samples.end(), KeyLess<key>());
+
+    //Evenly spaced samples, the duplicates are merged in a single bucket of equal keys
+    for (long long i = 1; i <= numSplitters; i++) {
+      partition->splitters.push_back(samples[i * samples.size() / (numSplitters + 1)]);
+    }
+    auto equal = [](const key &a, const key &b) { return !KeyOrder<key>::less(a, b) && !KeyOrder<key>::less(b, a); };
+    partition->splitters.erase(std::unique(partition->splitters.begin(), partition->splitters.end(), equal), partition->splitters.end());
+    numSplitters = partition->splitters.size();
+
+    partition->bucketSizes.reset(new std::atomic<long long>[2 * numSplitters + 1]);
+    for (long long b = 0; b <= 2 * numSplitters; b++) partition->bucketSizes[b] = 0;
+    for (long long b = 0; b <= 2 * numSplitters; b++) {
+      std::string fileName = this->getTemporaryFileName();
+      if (fileName.empty()) throw std::ios_base::failure("No temporary file name available");
+      bucketFileNames_.push_back(fileName);
+      partition->bucketFileNames.push_back(fileName);
+      partition->bucketFiles.emplace_back(new File());
+      if (!partition->bucketFiles.back()->open(fileName, this->fileMode(fileName, File::Read | File::Write))) throw std::ios_base::failure("Could not open file " + fileName);
+    }
+    return partition;
+  }
+
+  //The data of this thread holds a buffer per bucket file and the blocks of the range being read
+  //With double buffering the next block is loaded by a background I/O thread while the current one is partitioned
+  template<typename key>
+  void ExternalSampleSort<key>::handlePartitionTask(int threadId, Task *task) {
+    PartitionTask<key> *partitionTask = dynamic_cast<PartitionTask<key> *>(task);
+    if (!partitionTask || !partitionTask->partition) return;
+    SamplePartition<key> &partition = *partitionTask->partition;
+    File &inputFile = partition.fileName.empty() ? this->inFile_ : partition.file;
+    const key *splitters = partition.splitters.data();
+    long long numSplitters = partition.splitters.size();
+    long long numFiles = 2 * numSplitters + 1;
+
+    //With a few keys per thread the data cannot hold a buffer per bucket file, a temporary one is used instead
+    key *data = &(*this->threadData(threadId));
+    long long dataSize = this->dataSizePerThread_;
+    std::vector<key> smallData;
+    if (dataSize < numFiles + 1) {
+      dataSize = numFiles + 1;
+      smallData.resize(dataSize);
+      data = smallData.data();
+    }
+    long long bufferSize = dataSize / (numFiles + 1);
+    long long readSize = dataSize - numFiles * bufferSize;
+    int numBlocks = (this->doubleBuffering_ && (readSize >= 2)) ? 2 : 1;
+    long long blockSize = readSize / numBlocks;
+    key *blocks = data + numFiles * bufferSize;
+
+    std::vector<long long> numBuffered(numFiles, 0);
+
+    //Reserve room for the buffered keys at the end of the bucket and write them there
+    auto flush = [&](long long f) {
+      long long bucketPos = partition.bucketSizes[f].fetch_add(numBuffered[f]);
+      partition.bucketFiles[f]->write(data + f*bufferSize, sizeof(key)*numBuffered[f], sizeof(key)*bucketPos);
+      numBuffered[f] = 0;
+    };
+
+    AsyncIo io;
+    std::future<void> pendingRead;
+    auto load = [&](long long startInd, long long numRead, int b) {
+      key *buffer = blocks + b*blockSize;
+      long long offset = sizeof(key)*(partitionTask->startInd + startInd);
+      if (numBlocks == 1) inputFile.read(buffer, sizeof(key)*numRead, offset);
+      else pendingRead = io.submit([=, &inputFile]() { inputFile.read(buffer, sizeof(key)*numRead, offset); });
+    };
+    long long numLoading = std::min(blockSize, partitionTask->numValues);
+    load(0, numLoading, 0);
+
+    int b = 0;
+    for (long long pos = 0; pos < partitionTask->numValues;) {
+      long long numRead = numLoading;
+      if (pendingRead.valid()) pendingRead.get();
+
+      //Start loading the next block in the other buffer, a single buffer is only reloaded once partitioned
+      numLoading = std::min(blockSize, partitionTask->numValues - pos - numRead);
+      int nextBlock = (numBlocks == 2) ? 1 - b : b;
+      if ((numBlocks == 2) && (numLoading > 0)) load(pos + numRead, numLoading, nextBlock);
+
+      const key *block = blocks + b*blockSize;
+      for (long long i = 0; i < numRead; i++) {
+        const key &k = block[i];
+        long long s = upperSplitter(splitters, numSplitters, k);
+        long long f = (s && !KeyOrder<key>::less(splitters[s - 1], k)) ? 2 * s - 1 : 2 * s;
+        data[f*bufferSize + numBuffered[f]] = k;
+        if (++numBuffered[f] == bufferSize) flush(f);
+      }
+
+      if ((numBlocks == 1) && (numLoading > 0)) load(pos + numRead, numLoading, nextBlock);
+      pos += numRead;
+      b = nextBlock;
+    }
+
+    for (long long f = 0; f < numFiles; f++) {
+      if (numBuffered[f]) flush(f);
+    }
+  }
+
+  template<typename key>
+  void ExternalSampleSort<key>::handleSortBucketTask(int threadId, Task *task, SortFunction<key> sortFunc) {
+    SortBucketTask<key> *bucketTask = dynamic_cast<SortBucketTask<key> *>(task);
+    if (!bucketTask) return;
+
+    typename std::vector<key>::iterator dataIt = this->threadData(threadId);
+    key *data = &(*dataIt);
+    long long numBytes = sizeof(key)*bucketTask->numValues;
+
+    //The input is only read by a single bucket, the bucket files are removed once read
+    File bucketFile;
+    if (!bucketTask->fileName.empty() && !bucketFile.open(bucketTask->fileName, this->fileMode(bucketTask->fileName, File::Read))) {
+      throw std::ios_base::failure("Could not open file " + bucketTask->fileName);
+    }
+    File &inputFile = bucketTask->fileName.empty() ? this->inFile_ : bucketFile;
+
+    if (!bucketTask->isSorted) {
+      //Load and sort the bucket
+      inputFile.read(data, numBytes, sizeof(key)*bucketTask->startInd);
+      this->sortChunk(dataIt, dataIt + bucketTask->numValues, sortFunc);
+    }
+
+    File outFile;
+    if (!outFile.open(this->outputFileName_, this->fileMode(this->outputFileName_, File::Write | File::Keep))) {
+      throw std::ios_base::failure("Could not open file " + this->outputFileName_);
+    }
+    if (!bucketTask->isSorted) outFile.write(data, numBytes, sizeof(key)*bucketTask->outputInd);
+    else {
+      //The keys equal to a splitter are copied by blocks, they may not fit in the data of the thread
+      long long blockSize = this->dataSizePerThread_;
+      for (long long pos = 0; pos < bucketTask->numValues; pos += blockSize) {
+        long long numKeys = std::min(blockSize, bucketTask->numValues - pos);
+        inputFile.read(data, sizeof(key)*numKeys, sizeof(key)*(bucketTask->startInd + pos));
+        outFile.write(data, sizeof(key)*numKeys, sizeof(key)*(bucketTask->outputInd + pos));
+      }
+    }
+    outFile.close();
+
+    if (!bucketTask->fileName.empty()) {
+      bucketFile.close();
+      remove(bucketTask->fileName.c_str());
+    }
+  }
+
+} //namespace ems
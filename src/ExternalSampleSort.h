@@ -0,0 +1,96 @@
+//Templated class for ExternalSampleSort
+//This class performs multithreaded external sample sort (distribution sort) on a binary file
+//Splitters picked in a random sample of the input partition it in one parallel pass into bucket files,
+//then each bucket is sorted in memory and written directly at its position in the output file
+//Buckets which do not fit in the data of a thread are partitioned again in the same way
+
+#pragma once
+
+#include "ExternalMergeSort.h"
+
+#include <random>
+
+namespace ems {
+
+  //Partition of the input or of a bucket file by sorted splitters, compared with KeyOrder
+  //The keys between splitters i-1 and i go to bucket 2i and the keys equal to splitter i to bucket 2i+1
+  //Each bucket is written in a file, the keys equal to a splitter are written back as they are since they
+  //may differ from it (-0 and +0, NaNs of various payloads, keys whose order only depends on a part of them)
+  template<typename key>
+  struct SamplePartition {
+    //Partitioned file, empty for the input file
+    std::string fileName;
+    File file;
+
+    std::vector<key> splitters;
+
+    //Files of the buckets, bucket b is written in file b
+    std::vector<std::string> bucketFileNames;
+    std::vector<std::unique_ptr<File>> bucketFiles;
+
+    //Number of keys of each bucket, the tasks reserve the positions where they write their keys
+    std::unique_ptr<std::atomic<long long>[]> bucketSizes;
+  };
+
+  //Task for partitioning a range of a file by the splitters of a partition
+  template<typename key>
+  struct PartitionTask : public Task {
+    std::shared_ptr<SamplePartition<key>> partition;
+    long long startInd;
+    long long numValues;
+  };
+
+  //Task for sorting a bucket in memory and writing it at its position in the output file
+  template<typename key>
+  struct SortBucketTask : public Task {
+    SortBucketTask() : startInd(0), numValues(0), outputInd(0), isSorted(false) {}
+
+    //File of the bucket, empty for the input file
+    std::string fileName;
+    long long startInd;
+    long long numValues;
+    long long outputInd;
+
+    //The keys are all equal to a splitter, the bucket is copied to the output without being sorted
+    bool isSorted;
+  };
+
+  template<typename key>
+  class ExternalSampleSort : public ExternalMergeSort<key>
+  {
+  public:
+    ExternalSampleSort();
+
+    //Set the sort function for the given thread (see ExternalMergeSort::setSortFunction)
+    virtual void setSortFunction(SortFunction<key> sortFunc, int threadId = -1);
+
+    //Reset the sort functions for the given thread (see ExternalMergeSort::clearSortFunction)
+    virtual void clearSortFunction(int threadId = -1);
+
+    //Perform the external sample sort
+    //The narrow integer keys sorted by counting and the inputs sorted in memory are handled as by ExternalMergeSort
+    //The buckets use positional reads and writes, memory mapped I/O, io_uring and compression are ignored
+    //Returns true if successful
+    virtual bool sort();
+
+  protected:
+    //Function to partition a range of a file
+    virtual void handlePartitionTask(int threadId, Task *task);
+
+    //Function to sort a bucket
+    virtual void handleSortBucketTask(int threadId, Task *task, SortFunction<key> sortFunc);
+
+    //Pick the splitters of a bucket in a random sample of its keys and create its bucket files
+    std::shared_ptr<SamplePartition<key>> createPartition(const SortBucketTask<key> &bucket, std::mt19937_64 &gen);
+
+    //Temporary files created by the current sort, removed if it fails
+    std::vector<std::string> bucketFileNames_;
+  };
+
+  //Index of the first splitter greater than k, without branches in the search loop
+  template<typename key>
+  long long upperSplitter(const key *splitters, long long numSplitters, const key &k);
+
+} //namespace ems
+
+#include "ExternalSampleSort-inl.h"
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <ios>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif //_WIN32
+
+#include <vector>
+
+namespace ems {
+
+  inline File::File() :
+    fd_(-1),
+    directFd_(-1)
+  {
+  }
+
+  inline File::~File() {
+    close();
+  }
+
+  inline bool File::open(const std::string &fileName, int mode) {
+    close();
+#ifdef _WIN32
+    int flags = _O_BINARY;
+    if ((mode & Read) && (mode & Write)) flags |= _O_RDWR | _O_CREAT;
+    else if (mode & Write) flags |= _O_WRONLY | _O_CREAT;
+    else flags |= _O_RDONLY;
+    if ((mode & Write) && !(mode & Keep)) flags |= _O_TRUNC;
+    fd_ = _open(fileName.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    int flags = O_CLOEXEC;
+    if ((mode & Read) && (mode & Write)) flags |= O_RDWR | O_CREAT;
+    else if (mode & Write) flags |= O_WRONLY | O_CREAT;
+    else flags |= O_RDONLY;
+    if ((mode & Write) && !(mode & Keep)) flags |= O_TRUNC;
+    fd_ = ::open(fileName.c_str(), flags, 0644);
+#ifdef O_DIRECT
+    //Second descriptor for the aligned accesses, the file system may not support it
+    if ((fd_ >= 0) && (mode & Direct)) directFd_ = ::open(fileName.c_str(), (flags & ~(O_CREAT | O_TRUNC)) | O_DIRECT);
+#endif //O_DIRECT
+#endif //_WIN32
+    return fd_ >= 0;
+  }
+
+  inline void File::close() {
+    if (fd_ < 0) return;
+#ifdef _WIN32
+    _close(fd_);
+#else
+    ::close(fd_);
+    if (directFd_ >= 0) ::close(directFd_);
+#endif //_WIN32
+    fd_ = -1;
+    directFd_ = -1;
+  }
+
+  inline long long File::size() const {
+    if (fd_ < 0) return -1;
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(fd_, &st)) return -1;
+#else
+    struct stat st;
+    if (fstat(fd_, &st)) return -1;
+#endif //_WIN32
+    return st.st_size;
+  }
+
+  inline void File::read(void *buffer, long long numBytes, long long offset) {
+    char *pos = static_cast<char *>(buffer);
+    long long headBytes, middleBytes;
+    splitDirect(buffer, numBytes, offset, headBytes, middleBytes);
+    if (headBytes) readRange(fd_, pos, headBytes, offset);
+    if (middleBytes) readRange(directFd_, pos + headBytes, middleBytes, offset + headBytes);
+    long long tailBytes = numBytes - headBytes - middleBytes;
+    if (tailBytes) readRange(fd_, pos + headBytes + middleBytes, tailBytes, offset + headBytes + middleBytes);
+  }
+
+  inline void File::write(const void *buffer, long long numBytes, long long offset) {
+    const char *pos = static_cast<const char *>(buffer);
+    long long headBytes, middleBytes;
+    splitDirect(buffer, numBytes, offset, headBytes, middleBytes);
+    if (headBytes) writeRange(fd_, pos, headBytes, offset);
+    if (middleBytes) writeRange(directFd_, pos + headBytes, middleBytes, offset + headBytes);
+    long long tailBytes = numBytes - headBytes - middleBytes;
+    if (tailBytes) writeRange(fd_, pos + headBytes + middleBytes, tailBytes, offset + headBytes + middleBytes);
+  }
+
+  inline void File::splitDirect(const void *buffer, long long numBytes, long long offset, long long &headBytes, long long &middleBytes) const {
+    //Everything goes through the page cache unless the buffer and the offset can be aligned together
+    headBytes = numBytes;
+    middleBytes = 0;
+    if (directFd_ < 0) return;
+    long long alignedHeadBytes = (directIoAlignment - offset % directIoAlignment) % directIoAlignment;
+    if (alignedHeadBytes >= numBytes) return;
+    if ((reinterpret_cast<uintptr_t>(buffer) + alignedHeadBytes) % directIoAlignment) return;
+    headBytes = alignedHeadBytes;
+    middleBytes = (numBytes - headBytes) / directIoAlignment * directIoAlignment;
+  }
+
+  inline void File::readRange(int fd, char *buffer, long long numBytes, long long offset) {
+    char *pos = buffer;
+#ifdef _WIN32
+    //Acquire lock
+    std::lock_guard<std::mutex> lock(fdMutex_);
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) throw std::ios_base::failure("File::read seek failed");
+#endif //_WIN32
+    //Read until all the bytes are read, the system may return less bytes than requested
+    while (numBytes > 0) {
+#ifdef _WIN32
+      long long numRead = _read(fd, pos, static_cast<unsigned int>(std::min<long long>(numBytes, 1 << 30)));
+#else
+      long long numRead = pread(fd, pos, numBytes, offset);
+#endif //_WIN32
+      if (numRead < 0) {
+        if (errno == EINTR) continue;
+        throw std::ios_base::failure("File::read failed");
+      }
+      //Unexpected end of file
+      if (numRead == 0) throw std::ios_base::failure("File::read end of file reached");
+      pos += numRead;
+      offset += numRead;
+      numBytes -= numRead;
+    }
+  }
+
+  inline void File::writeRange(int fd, const char *buffer, long long numBytes, long long offset) {
+    const char *pos = buffer;
+#ifdef _WIN32
+    //Acquire lock
+    std::lock_guard<std::mutex> lock(fdMutex_);
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) throw std::ios_base::failure("File::write seek failed");
+#endif //_WIN32
+    while (numBytes > 0) {
+#ifdef _WIN32
+      long long numWritten = _write(fd, pos, static_cast<unsigned int>(std::min<long long>(numBytes, 1 << 30)));
+#else
+      long long numWritten = pwrite(fd, pos, numBytes, offset);
+#endif //_WIN32
+      if (numWritten < 0) {
+        if (errno == EINTR) continue;
+        throw std::ios_base::failure("File::write failed");
+      }
+      pos += numWritten;
+      offset += numWritten;
+      numBytes -= numWritten;
+    }
+  }
+
+  inline void File::copyFrom(File &source, long long numBytes, long long sourceOffset, long long offset) {
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    //In kernel copy between the buffered descriptors, falls back to the buffer if the file systems do not support it
+    while (numBytes > 0) {
+      long long sourcePos = sourceOffset;
+      long long pos = offset;
+      long long numCopied = syscall(SYS_copy_file_range, source.fd_, &sourcePos, fd_, &pos, static_cast<size_t>(std::min<long long>(numBytes, 1 << 30)), 0u);
+      if (numCopied < 0) {
+        if (errno == EINTR) continue;
+        if ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) || (errno == EOPNOTSUPP)) break;
+        throw std::ios_base::failure("File::copyFrom failed");
+      }
+      if (numCopied == 0) throw std::ios_base::failure("File::copyFrom end of file reached");
+      sourceOffset += numCopied;
+      offset += numCopied;
+      numBytes -= numCopied;
+    }
+#endif //__linux__ && SYS_copy_file_range
+    std::vector<char> buffer(static_cast<size_t>(std::min<long long>(std::max(numBytes, 0LL), 1 << 20)));
+    while (numBytes > 0) {
+      long long numRead = std::min<long long>(numBytes, buffer.size());
+      source.readRange(source.fd_, buffer.data(), numRead, sourceOffset);
+      writeRange(fd_, buffer.data(), numRead, offset);
+      sourceOffset += numRead;
+      offset += numRead;
+      numBytes -= numRead;
+    }
+  }
+
+  inline void File::resize(long long numBytes) {
+#ifdef _WIN32
+    if (_chsize_s(fd_, numBytes)) throw std::ios_base::failure("File::resize failed");
+#else
+    int res;
+    do {
+      res = ftruncate(fd_, numBytes);
+    } while (res && (errno == EINTR));
+    if (res) throw std::ios_base::failure("File::resize failed");
+#endif //_WIN32
+  }
+
+  inline MappedFile::MappedFile() :
+    mapping_(nullptr),
+    mappingSize_(0),
+    data_(nullptr),
+    size_(0)
+  {
+  }
+
+  inline MappedFile::~MappedFile() {
+    unmap();
+  }
+
+  inline bool MappedFile::isSupported() {
+#ifdef _WIN32
+    return false;
+#else
+    return true;
+#endif //_WIN32
+  }
+
+  inline void MappedFile::map(File &file, long long offset, long long numBytes, bool writable) {
+    unmap();
+    if (numBytes <= 0) return;
+#ifdef _WIN32
+    throw std::ios_base::failure("MappedFile::map not supported");
+#else
+    //The mapping starts on a page boundary
+    long long pageSize = sysconf(_SC_PAGESIZE);
+    long long mappingOffset = offset - offset % pageSize;
+    long long mappingSize = numBytes + (offset - mappingOffset);
+    void *mapping = mmap(nullptr, mappingSize, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, file.fd_, mappingOffset);
+    if (mapping == MAP_FAILED) throw std::ios_base::failure("MappedFile::map failed");
+    //Only a hint, the mapping works without it
+    posix_madvise(mapping, mappingSize, POSIX_MADV_SEQUENTIAL);
+
+    mapping_ = mapping;
+    mappingSize_ = mappingSize;
+    data_ = static_cast<char *>(mapping) + (offset - mappingOffset);
+    size_ = numBytes;
+#endif //_WIN32
+  }
+
+  inline void MappedFile::unmap() {
+    if (!mapping_) return;
+#ifndef _WIN32
+    munmap(mapping_, mappingSize_);
+#endif //_WIN32
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+} //namespace ems
@@ -0,0 +1,146 @@
+//Binary file accessed with positional reads and writes
+//Positional accesses do not move a shared file pointer, so several threads can read or write
+//different parts of the same file concurrently without any locking
+//Ranges of a file can also be mapped in memory to access the keys in place in the page cache
+//Files opened with the Direct mode bypass the page cache for the parts of the accesses aligned on
+//directIoAlignment (buffer, offset and size), the unaligned head and tail of an access go through the page cache
+
+#pragma once
+
+#include <string>
+#include <mutex>
+
+namespace ems {
+
+  //Alignment of the buffers, offsets and sizes of the accesses bypassing the page cache
+  const long long directIoAlignment = 4096;
+
+  class File
+  {
+  public:
+    //Open modes, can be combined
+    enum OpenMode {
+      //Open for reading
+      Read = 1,
+      //Open for writing, the file is created if needed and truncated
+      Write = 2,
+      //With Write, keep the content of an existing file
+      Keep = 4,
+      //Bypass the page cache for the aligned accesses, ignored if not supported by the platform or file system
+      Direct = 8
+    };
+
+    File();
+
+    //Close the file if needed
+    ~File();
+
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+
+    //Open the file with a combination of OpenMode flags
+    //Returns false if the file could not be opened
+    bool open(const std::string &fileName, int mode);
+
+    //Is the file open?
+    inline bool isOpen() const {
+      return fd_ >= 0;
+    }
+
+    //Close the file
+    void close();
+
+    //Do the aligned accesses bypass the page cache?
+    inline bool isDirect() const {
+      return directFd_ >= 0;
+    }
+
+    //Size of the file in bytes
+    long long size() const;
+
+    //Read numBytes bytes at offset into buffer
+    //Throws std::ios_base::failure if the bytes could not all be read
+    void read(void *buffer, long long numBytes, long long offset);
+
+    //Write numBytes bytes from buffer at offset
+    //Throws std::ios_base::failure if the bytes could not all be written
+    void write(const void *buffer, long long numBytes, long long offset);
+
+    //Copy numBytes bytes at sourceOffset in source to offset in this file
+    //The bytes are copied by the kernel when the platform supports it, through a buffer otherwise
+    //Throws std::ios_base::failure if the bytes could not all be copied
+    void copyFrom(File &source, long long numBytes, long long sourceOffset, long long offset);
+
+    //Set the size of the file to numBytes bytes, extended with zeros
+    //Throws std::ios_base::failure if the size could not be changed
+    void resize(long long numBytes);
+
+  private:
+    friend class MappedFile;
+    friend class IoRing;
+
+    //Read or write numBytes bytes at offset with the given descriptor
+    void readRange(int fd, char *buffer, long long numBytes, long long offset);
+    void writeRange(int fd, const char *buffer, long long numBytes, long long offset);
+
+    //Split an access in an unaligned head, a middle part which can bypass the page cache and an unaligned tail
+    void splitDirect(const void *buffer, long long numBytes, long long offset, long long &headBytes, long long &middleBytes) const;
+
+    //File descriptor, -1 if closed
+    int fd_;
+
+    //Descriptor bypassing the page cache, -1 if the file is not open in Direct mode
+    int directFd_;
+
+#ifdef _WIN32
+    //No positional reads on Windows CRT descriptors, seek and read/write are serialized
+    std::mutex fdMutex_;
+#endif //_WIN32
+  };
+
+  //Range of a file mapped in memory, the mapping is advised for sequential access
+  class MappedFile
+  {
+  public:
+    MappedFile();
+
+    //Unmap the range if needed
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    //Are memory mapped files supported on this platform?
+    static bool isSupported();
+
+    //Map numBytes bytes of the file from offset, the offset does not need to be aligned
+    //A writable mapping needs the file to be open for reading and writing and the range to be in the file
+    //Throws std::ios_base::failure if the range could not be mapped
+    void map(File &file, long long offset, long long numBytes, bool writable);
+
+    //Unmap the range, the changes of a writable mapping are written back by the system
+    void unmap();
+
+    //First byte of the range, null if nothing is mapped
+    inline void *data() const {
+      return data_;
+    }
+
+    //Size of the range in bytes
+    inline long long size() const {
+      return size_;
+    }
+
+  private:
+    //Start and size of the mapping, aligned on pages
+    void *mapping_;
+    long long mappingSize_;
+
+    //Mapped range
+    char *data_;
+    long long size_;
+  };
+
+} //namespace ems
+
+#include "FileIo-inl.h"
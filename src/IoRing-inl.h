@@ -0,0 +1,265 @@
+#pragma once
+
+#include <ios>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef EMS_IO_URING
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif //EMS_IO_URING
+
+namespace ems {
+
+  inline IoRing::IoRing() :
+    ringFd_(-1),
+    requestSize_(1 << 20),
+    numQueued_(0),
+    sqRing_(nullptr),
+    sqRingSize_(0),
+    cqRing_(nullptr),
+    cqRingSize_(0),
+    sqes_(nullptr),
+    sqesSize_(0)
+  {
+  }
+
+  inline IoRing::~IoRing() {
+    //The kernel may still write in the buffers of the requests in flight
+    try {
+      waitAll();
+    }
+    catch (...) {
+    }
+    release();
+  }
+
+  inline bool IoRing::init(unsigned queueDepth, long long requestSize) {
+    release();
+#ifdef EMS_IO_URING
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, std::max(1u, queueDepth), &params));
+    if (fd < 0) return false;
+    ringFd_ = fd;
+
+    //Map the submission and completion rings, they share a single mapping on recent kernels
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+    bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#else
+    bool singleMapping = false;
+#endif //IORING_FEAT_SINGLE_MMAP
+    if (singleMapping) sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+      sqRing_ = nullptr;
+      release();
+      return false;
+    }
+    if (singleMapping) cqRing_ = sqRing_;
+    else {
+      cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cqRing_ == MAP_FAILED) {
+        cqRing_ = nullptr;
+        release();
+        return false;
+      }
+    }
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      sqes_ = nullptr;
+      release();
+      return false;
+    }
+
+    char *sq = static_cast<char *>(sqRing_);
+    sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = cq + params.cq_off.cqes;
+
+    //One slot per submission queue entry so that the queues never overflow
+    //Requests are a multiple of the alignment so that an aligned operation stays aligned
+    requestSize_ = std::max(directIoAlignment, requestSize / directIoAlignment * directIoAlignment);
+    requests_.assign(params.sq_entries, Request());
+    freeSlots_.clear();
+    for (int i = params.sq_entries - 1; i >= 0; i--) freeSlots_.push_back(i);
+    numQueued_ = 0;
+    return true;
+#else
+    return false;
+#endif //EMS_IO_URING
+  }
+
+  inline void IoRing::read(File &file, void *buffer, long long numBytes, long long offset, unsigned long long id) {
+    queue(file, static_cast<char *>(buffer), numBytes, offset, false, id);
+  }
+
+  inline void IoRing::write(File &file, const void *buffer, long long numBytes, long long offset, unsigned long long id) {
+    queue(file, static_cast<char *>(const_cast<void *>(buffer)), numBytes, offset, true, id);
+  }
+
+  inline void IoRing::submit() {
+    if (numQueued_) enter(0);
+  }
+
+  inline void IoRing::wait(unsigned long long id) {
+    while (numPendingRequests_.count(id)) reap();
+    auto errorIt = errors_.find(id);
+    if (errorIt != errors_.end()) {
+      int error = errorIt->second;
+      errors_.erase(errorIt);
+      throw std::ios_base::failure(error ? std::string("IoRing request failed: ") + std::strerror(error) : "IoRing end of file reached");
+    }
+  }
+
+  inline void IoRing::waitAll() {
+    while (!numPendingRequests_.empty()) reap();
+    if (!errors_.empty()) {
+      errors_.clear();
+      throw std::ios_base::failure("IoRing request failed");
+    }
+  }
+
+  inline void IoRing::queue(File &file, char *buffer, long long numBytes, long long offset, bool write, unsigned long long id) {
+    if (!isInitialized()) throw std::ios_base::failure("IoRing not initialized");
+    while (numBytes > 0) {
+      //Wait for a free slot
+      while (freeSlots_.empty()) reap();
+      int slot = freeSlots_.back();
+      freeSlots_.pop_back();
+
+      Request &request = requests_[slot];
+      request.fd = request.bufferedFd = file.fd_;
+      request.buffer = buffer;
+      request.numBytes = std::min(numBytes, requestSize_);
+      //Bypass the page cache for the aligned requests, the unaligned tail of the operation is buffered
+      if (file.isDirect() && !(reinterpret_cast<uintptr_t>(buffer) % directIoAlignment) && !(offset % directIoAlignment) && (request.numBytes >= directIoAlignment)) {
+        request.fd = file.directFd_;
+        request.numBytes -= request.numBytes % directIoAlignment;
+      }
+      request.offset = offset;
+      request.write = write;
+      request.id = id;
+      numPendingRequests_[id]++;
+      prepare(slot);
+
+      buffer += request.numBytes;
+      offset += request.numBytes;
+      numBytes -= request.numBytes;
+    }
+  }
+
+  inline void IoRing::prepare(int slot) {
+#ifdef EMS_IO_URING
+    Request &request = requests_[slot];
+    request.iov.iov_base = request.buffer;
+    request.iov.iov_len = request.numBytes;
+
+    unsigned tail = *sqTail_;
+    unsigned index = tail & *sqMask_;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes_) + index;
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = request.fd;
+    sqe->off = request.offset;
+    sqe->addr = reinterpret_cast<unsigned long long>(&request.iov);
+    sqe->len = 1;
+    sqe->user_data = slot;
+    sqArray_[index] = index;
+    //Publish the entry before the new tail
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    numQueued_++;
+#endif //EMS_IO_URING
+  }
+
+  inline void IoRing::enter(unsigned minComplete) {
+#ifdef EMS_IO_URING
+    while (true) {
+      long res = syscall(__NR_io_uring_enter, ringFd_, numQueued_, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (res < 0) {
+        if (errno == EINTR) continue;
+        //The kernel is short of resources, the caller retries after reaping the available completions
+        if ((errno == EAGAIN) || (errno == EBUSY)) return;
+        throw std::ios_base::failure(std::string("IoRing submission failed: ") + std::strerror(errno));
+      }
+      numQueued_ -= std::min<unsigned>(numQueued_, static_cast<unsigned>(res));
+      if (!numQueued_ || minComplete) return;
+    }
+#endif //EMS_IO_URING
+  }
+
+  inline void IoRing::reap() {
+#ifdef EMS_IO_URING
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      //No completion available, submit the queued requests and wait for one
+      enter(1);
+      tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    }
+    else if (numQueued_) enter(0);
+
+    for (; head != tail; head++) {
+      io_uring_cqe *cqe = static_cast<io_uring_cqe *>(cqes_) + (head & *cqMask_);
+      int slot = static_cast<int>(cqe->user_data);
+      int res = cqe->res;
+      Request &request = requests_[slot];
+
+      if ((res == -EINTR) || (res == -EAGAIN)) {
+        //Retry the request
+        prepare(slot);
+        continue;
+      }
+      if ((res > 0) && (res < request.numBytes)) {
+        //Partial transfer, queue the remaining bytes
+        request.buffer += res;
+        request.offset += res;
+        request.numBytes -= res;
+        //The rest of a direct request may not be aligned anymore
+        if ((request.numBytes % directIoAlignment) || (request.offset % directIoAlignment)) request.fd = request.bufferedFd;
+        prepare(slot);
+        continue;
+      }
+      //Failed request, or unexpected end of file for a read
+      if ((res < 0) || ((res == 0) && request.numBytes)) errors_[request.id] = (res < 0) ? -res : 0;
+
+      auto pendingIt = numPendingRequests_.find(request.id);
+      if (!--pendingIt->second) numPendingRequests_.erase(pendingIt);
+      freeSlots_.push_back(slot);
+    }
+    //Release the completion entries
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+#else
+    throw std::ios_base::failure("IoRing not supported");
+#endif //EMS_IO_URING
+  }
+
+  inline void IoRing::release() {
+#ifdef EMS_IO_URING
+    if (sqes_) munmap(sqes_, sqesSize_);
+    if (cqRing_ && (cqRing_ != sqRing_)) munmap(cqRing_, cqRingSize_);
+    if (sqRing_) munmap(sqRing_, sqRingSize_);
+    if (ringFd_ >= 0) close(ringFd_);
+#endif //EMS_IO_URING
+    sqes_ = sqRing_ = cqRing_ = nullptr;
+    ringFd_ = -1;
+    requests_.clear();
+    freeSlots_.clear();
+    numPendingRequests_.clear();
+    errors_.clear();
+    numQueued_ = 0;
+  }
+
+} //namespace ems
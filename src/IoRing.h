@@ -0,0 +1,134 @@
+//Asynchronous positional I/O with Linux io_uring, without liburing
+//Operations are split in requests of at most requestSize bytes which are submitted in batches, up to
+//queueDepth requests in flight. Completions are reaped from the shared ring without a system call
+//when they are already available.
+//Requests on a file opened in Direct mode bypass the page cache when they are aligned
+//Define EMS_NO_IO_URING to build without io_uring, init then always fails so that callers use File directly
+
+#pragma once
+
+#include "FileIo.h"
+
+#include <vector>
+#include <unordered_map>
+
+#if !defined(EMS_NO_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define EMS_IO_URING 1
+#endif
+#endif
+
+#ifdef EMS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif //EMS_IO_URING
+
+namespace ems {
+
+  class IoRing
+  {
+  public:
+    IoRing();
+
+    //Wait for the requests in flight and release the ring
+    ~IoRing();
+
+    IoRing(const IoRing &) = delete;
+    IoRing &operator=(const IoRing &) = delete;
+
+    //Create the ring, returns false if io_uring is not available (not built in, old kernel or not permitted)
+    bool init(unsigned queueDepth = 32, long long requestSize = 1 << 20);
+
+    //Is the ring created?
+    inline bool isInitialized() const {
+      return ringFd_ >= 0;
+    }
+
+    //Queue the read of numBytes bytes at offset into buffer, the operation is identified by id
+    //The requests are submitted by wait or when the queue is full
+    void read(File &file, void *buffer, long long numBytes, long long offset, unsigned long long id);
+
+    //Queue the write of numBytes bytes from buffer at offset, the operation is identified by id
+    void write(File &file, const void *buffer, long long numBytes, long long offset, unsigned long long id);
+
+    //Submit the queued requests without waiting
+    void submit();
+
+    //Submit the queued requests and wait until the operation id is completed
+    //Throws std::ios_base::failure if one of its requests failed
+    void wait(unsigned long long id);
+
+    //Submit the queued requests and wait until all the operations are completed
+    void waitAll();
+
+  private:
+    //Request in flight or queued
+    struct Request {
+      int fd;
+      //Descriptor through the page cache when fd bypasses it
+      int bufferedFd;
+      char *buffer;
+      long long numBytes;
+      long long offset;
+      bool write;
+      unsigned long long id;
+#ifdef EMS_IO_URING
+      iovec iov;
+#endif //EMS_IO_URING
+    };
+
+    //Queue an operation split in requests
+    void queue(File &file, char *buffer, long long numBytes, long long offset, bool write, unsigned long long id);
+
+    //Put a request in the submission queue
+    void prepare(int slot);
+
+    //Submit the queued requests and wait for at least minComplete completions
+    void enter(unsigned minComplete);
+
+    //Handle the available completions, waiting for one if there are none
+    void reap();
+
+    //Release the ring
+    void release();
+
+    //Descriptor of the ring, -1 if not created
+    int ringFd_;
+
+    //Maximum size of a request
+    long long requestSize_;
+
+    //Requests by slot and free slots
+    std::vector<Request> requests_;
+    std::vector<int> freeSlots_;
+
+    //Number of requests not completed for each operation
+    std::unordered_map<unsigned long long, long long> numPendingRequests_;
+
+    //Number of requests put in the submission queue and not submitted yet
+    unsigned numQueued_;
+
+    //Error of a failed operation, reported by wait
+    std::unordered_map<unsigned long long, int> errors_;
+
+    //Mapped rings
+    void *sqRing_;
+    long long sqRingSize_;
+    void *cqRing_;
+    long long cqRingSize_;
+    void *sqes_;
+    long long sqesSize_;
+
+    //Pointers in the rings
+    unsigned *sqTail_;
+    unsigned *sqMask_;
+    unsigned *sqArray_;
+    unsigned *cqHead_;
+    unsigned *cqTail_;
+    unsigned *cqMask_;
+    void *cqes_;
+  };
+
+} //namespace ems
+
+#include "IoRing-inl.h"
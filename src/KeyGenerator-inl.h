@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+namespace ems {
+
+  inline uint64_t SplitMix64::operator()() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  inline Xoshiro256::Xoshiro256(uint64_t seed) {
+    SplitMix64 seeder(seed);
+    for (int i = 0; i < 4; i++) state_[i] = seeder();
+  }
+
+  inline Xoshiro256::result_type Xoshiro256::operator()() {
+    auto rotl = [](uint64_t x, int k) { return (x << k) | (x >> (64 - k)); };
+    const uint64_t result = rotl(state_[1] * 5, 7) * 9;
+    const uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = rotl(state_[3], 45);
+    return result;
+  }
+
+  inline double Xoshiro256::uniform() {
+    return static_cast<double>((*this)() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  inline bool parseKeyDistribution(const std::string &name, KeyDistribution &distribution) {
+    if (name == "uniform") distribution = KeyDistribution::Uniform;
+    else if (name == "sorted") distribution = KeyDistribution::Sorted;
+    else if (name == "reverse") distribution = KeyDistribution::Reverse;
+    else if (name == "nearlysorted") distribution = KeyDistribution::NearlySorted;
+    else if (name == "fewunique") distribution = KeyDistribution::FewUnique;
+    else if (name == "zipf") distribution = KeyDistribution::Zipf;
+    else if (name == "equal") distribution = KeyDistribution::Equal;
+    else return false;
+    return true;
+  }
+
+  //Keys of the type from random bits, and increasing mapping of [0, 1) to the keys of the type
+  template<typename key, bool isFloatingPoint = std::is_floating_point<key>::value>
+  struct KeyScale {
+    static key random(Xoshiro256 &gen) {
+      uint64_t bits = gen();
+      key k;
+      std::memcpy(&k, &bits, sizeof(key));
+      return k;
+    }
+    //The fraction scales the number of keys of the type, added to the lowest key with unsigned arithmetic
+    static key fromFraction(double fraction) {
+      fraction = std::min(std::max(fraction, 0.0), 1.0 - std::numeric_limits<double>::epsilon() / 2);
+      uint64_t offset = static_cast<uint64_t>(fraction * std::ldexp(1.0, 8 * sizeof(key)));
+      return static_cast<key>(static_cast<uint64_t>(std::numeric_limits<key>::lowest()) + offset);
+    }
+  };
+  template<typename key>
+  struct KeyScale<key, true> {
+    static key random(Xoshiro256 &gen) {
+      return fromFraction(gen.uniform());
+    }
+    static key fromFraction(double fraction) {
+      return static_cast<key>((2 * fraction - 1) * static_cast<double>(std::numeric_limits<key>::max()));
+    }
+  };
+
+  //Fraction in [0, 1) from the 53 high bits of an integer
+  inline double fractionFromBits(uint64_t bits) {
+    return static_cast<double>(bits >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  //Generate the chunk of keys starting at the key first of the sequence
+  template<typename key>
+  void generateChunk(key *keys, long long first, long long numKeys, long long totalKeys, const KeyGeneratorOptions &options) {
+    typedef KeyScale<key> Scale;
+    long long chunkIndex = first / std::max(1LL, options.chunkSize);
+    Xoshiro256 gen(options.seed ^ (0x9e3779b97f4a7c15ULL * static_cast<uint64_t>(chunkIndex + 1)));
+    double numValues = static_cast<double>(totalKeys);
+
+    switch (options.distribution) {
+    case KeyDistribution::Uniform:
+      for (long long i = 0; i < numKeys; i++) keys[i] = Scale::random(gen);
+      break;
+    case KeyDistribution::Sorted:
+    case KeyDistribution::NearlySorted:
+      //Key i is uniform in the i-th of totalKeys equal parts of the range
+      for (long long i = 0; i < numKeys; i++) keys[i] = Scale::fromFraction((first + i + gen.uniform()) / numValues);
+      if (options.distribution == KeyDistribution::NearlySorted) {
+        long long numSwaps = std::llround(numKeys * std::max(0.0, options.swapPercent) / 200);
+        for (long long s = 0; s < numSwaps; s++) {
+          long long a = gen() % numKeys;
+          long long b = gen() % numKeys;
+          key tmp = keys[a];
+          keys[a] = keys[b];
+          keys[b] = tmp;
+        }
+      }
+      break;
+    case KeyDistribution::Reverse:
+      for (long long i = 0; i < numKeys; i++) keys[i] = Scale::fromFraction((totalKeys - 1 - first - i + gen.uniform()) / numValues);
+      break;
+    case KeyDistribution::FewUnique: {
+      long long numUniqueKeys = std::max(1LL, options.numUniqueKeys);
+      for (long long i = 0; i < numKeys; i++) keys[i] = Scale::fromFraction((gen() % numUniqueKeys + 0.5) / numUniqueKeys);
+      break;
+    }
+    case KeyDistribution::Zipf: {
+      //Inversion of the continuous approximation of the distribution of the ranks in [1, totalKeys]
+      double s = options.zipfExponent;
+      bool harmonic = std::fabs(s - 1) < 1e-9;
+      double logRange = std::log(numValues + 1);
+      double powRange = harmonic ? 0 : std::pow(numValues + 1, 1 - s) - 1;
+      for (long long i = 0; i < numKeys; i++) {
+        double u = gen.uniform();
+        double x = harmonic ? std::exp(u * logRange) : std::pow(u * powRange + 1, 1 / (1 - s));
+        long long rank = std::min(totalKeys, std::max(1LL, static_cast<long long>(x)));
+        //The ranks are scattered over the keys, the most frequent keys are not the smallest ones
+        keys[i] = Scale::fromFraction(fractionFromBits(SplitMix64(options.seed ^ static_cast<uint64_t>(rank))()));
+      }
+      break;
+    }
+    case KeyDistribution::Equal:
+      std::fill(keys, keys + numKeys, Scale::fromFraction(fractionFromBits(SplitMix64(options.seed)())));
+      break;
+    }
+  }
+
+  template<typename key>
+  void generateKeys(key *keys, long long first, long long numKeys, long long totalKeys, const KeyGeneratorOptions &options) {
+    long long chunkSize = std::max(1LL, options.chunkSize);
+    for (long long pos = first; pos < first + numKeys; pos += chunkSize) {
+      generateChunk(keys + (pos - first), pos, std::min(chunkSize, first + numKeys - pos), totalKeys, options);
+    }
+  }
+
+} //namespace ems
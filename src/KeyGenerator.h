@@ -0,0 +1,104 @@
+//Generation of test keys with various distributions, reproducible from a seed
+//The keys are generated by blocks of chunkSize keys, each block with its own xoshiro256** generator seeded from
+//the seed and the block index by splitmix64. The blocks can therefore be generated in any order by any number of
+//threads, the keys only depend on the seed, the chunk size and the options of the distribution.
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace ems {
+
+  //splitmix64 generator, used to seed the xoshiro256** generators and to mix integers
+  class SplitMix64
+  {
+  public:
+    explicit SplitMix64(uint64_t seed) : state_(seed) {}
+
+    uint64_t operator()();
+
+  private:
+    uint64_t state_;
+  };
+
+  //xoshiro256** generator, fast and with a period of 2^256-1
+  //Satisfies the requirements of the standard uniform random bit generators
+  class Xoshiro256
+  {
+  public:
+    typedef uint64_t result_type;
+
+    //The state is filled from a splitmix64 generator so that any seed gives a valid state
+    explicit Xoshiro256(uint64_t seed);
+
+    static constexpr result_type min() {
+      return 0;
+    }
+    static constexpr result_type max() {
+      return ~result_type(0);
+    }
+
+    result_type operator()();
+
+    //Uniform double in [0, 1) with 53 random bits
+    double uniform();
+
+  private:
+    uint64_t state_[4];
+  };
+
+  //Distributions of the generated keys
+  enum class KeyDistribution {
+    //Uniform over all the keys of the type, over [-max, max] for the floating point types (no NaN nor infinity)
+    Uniform,
+    //Uniform keys in increasing order
+    Sorted,
+    //Uniform keys in decreasing order
+    Reverse,
+    //Sorted keys of which swapPercent percent are swapped with another key of the same chunk
+    NearlySorted,
+    //Uniform picks among numUniqueKeys keys spread over the range of the type
+    FewUnique,
+    //Key of rank r drawn with a probability proportional to 1/r^zipfExponent, the ranks spread over the range of the type
+    Zipf,
+    //A single key repeated
+    Equal
+  };
+
+  //Options of the key generation
+  struct KeyGeneratorOptions {
+    KeyGeneratorOptions() :
+      distribution(KeyDistribution::Uniform),
+      seed(0),
+      chunkSize(1 << 16),
+      swapPercent(1),
+      numUniqueKeys(16),
+      zipfExponent(1),
+      numThreads(0) {}
+
+    KeyDistribution distribution;
+    uint64_t seed;
+    //Number of keys generated and written at once, the keys depend on it
+    long long chunkSize;
+    //NearlySorted: percentage of the keys swapped
+    double swapPercent;
+    //FewUnique: number of distinct keys
+    long long numUniqueKeys;
+    //Zipf: exponent of the ranks, the larger the more skewed
+    double zipfExponent;
+    //Threads generating and writing the chunks, the hardware concurrency if not positive
+    int numThreads;
+  };
+
+  //Parse the name of a distribution (uniform, sorted, reverse, nearlysorted, fewunique, zipf or equal)
+  //Returns false if the name is unknown
+  bool parseKeyDistribution(const std::string &name, KeyDistribution &distribution);
+
+  //Generate the keys [first, first+numKeys) of a sequence of totalKeys keys, first must start a chunk
+  template<typename key>
+  void generateKeys(key *keys, long long first, long long numKeys, long long totalKeys, const KeyGeneratorOptions &options);
+
+} //namespace ems
+
+#include "KeyGenerator-inl.h"
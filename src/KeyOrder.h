@@ -0,0 +1,37 @@
+//Order of the keys shared by all the stages of the sorts (chunk sorts, scans, merges, selections and partitions)
+//The floating point keys are ordered as by the radix sort: NaNs come after all other values whatever their sign
+//or payload. operator< alone does not order the NaNs, the merges of runs holding NaNs would not be sorted.
+
+#pragma once
+
+#include <type_traits>
+
+namespace ems {
+
+  //Strict weak order of the keys, operator< for the keys which are not floating point
+  //NaNs are equivalent to each other and -0 to +0, so that keys sorted by radixSort, or by std::sort if they hold
+  //no NaN, are sorted in this order
+  template<typename key, bool isFloatingPoint = std::is_floating_point<key>::value>
+  struct KeyOrder {
+    static inline bool less(const key &a, const key &b) {
+      return a < b;
+    }
+  };
+
+  template<typename key>
+  struct KeyOrder<key, true> {
+    //A key is also lower than a NaN unless it is a NaN, evaluated without branches for the merge kernels
+    static inline bool less(const key &a, const key &b) {
+      return (a < b) | ((b != b) & (a == a));
+    }
+  };
+
+  //Function object of the order of the keys, for the standard algorithms
+  template<typename key>
+  struct KeyLess {
+    inline bool operator()(const key &a, const key &b) const {
+      return KeyOrder<key>::less(a, b);
+    }
+  };
+
+} //namespace ems
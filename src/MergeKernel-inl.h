@@ -0,0 +1,312 @@
+#pragma once
+
+#include <queue>
+#include <utility>
+#include <algorithm>
+
+namespace ems {
+
+  template<typename key>
+  LoserTree<key>::LoserTree(const std::vector<MergeRun<key>> &runs) :
+    numRuns_(runs.size()),
+    tree_(std::max<long long>(1, runs.size()))
+  {
+    //Leaf i is node numRuns_+i and the parent of node n is n/2
+    //The winners of the matches are only needed during the construction
+    std::vector<Node> winners(2 * numRuns_);
+    for (long long i = 0; i < numRuns_; i++) {
+      Node &leaf = winners[numRuns_ + i];
+      leaf.run = i;
+      leaf.exhausted = (runs[i].begin == runs[i].end);
+      leaf.head = leaf.exhausted ? key() : *runs[i].begin;
+    }
+    if (numRuns_ == 0) {
+      tree_[0].run = 0;
+      tree_[0].exhausted = true;
+      return;
+    }
+    if (numRuns_ == 1) {
+      tree_[0] = winners[1];
+      return;
+    }
+
+    //Play the matches bottom-up
+    for (long long n = numRuns_ - 1; n >= 1; n--) {
+      const Node &a = winners[2 * n];
+      const Node &b = winners[2 * n + 1];
+      if (beats(b, a)) {
+        winners[n] = b;
+        tree_[n] = a;
+      }
+      else {
+        winners[n] = a;
+        tree_[n] = b;
+      }
+    }
+    tree_[0] = winners[1];
+  }
+
+  template<typename key>
+  void LoserTree<key>::replay(const key &head, bool exhausted) {
+    Node w = tree_[0];
+    w.head = head;
+    w.exhausted = exhausted;
+    //The winner plays against the losers stored on the path to the root
+    for (long long n = (numRuns_ + w.run) >> 1; n >= 1; n >>= 1) {
+      if (beats(tree_[n], w)) std::swap(tree_[n], w);
+    }
+    tree_[0] = w;
+  }
+
+  template<typename key>
+  void heapMerge(std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush) {
+    //Priority queue keeping track of the values at the current pointers in the run buffers, equal keys by run index
+    typedef std::pair<key, long long> HeapEntry;
+    auto greater = [](const HeapEntry &a, const HeapEntry &b) {
+      return KeyOrder<key>::less(b.first, a.first) || (!KeyOrder<key>::less(a.first, b.first) && (b.second < a.second));
+    };
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, decltype(greater)> mergeQueue(greater);
+
+    for (long long i = 0; i < (long long)runs.size(); i++) {
+      if (runs[i].begin != runs[i].end) mergeQueue.push(std::make_pair(*runs[i].begin, i));
+    }
+
+    //While the queue is not empty, dequeue the top element, add it to the result and try to fetch another value from the same run
+    while (!mergeQueue.empty()) {
+      auto topPair = mergeQueue.top();
+      mergeQueue.pop();
+      *(output.pos++) = topPair.first;
+      if (output.pos == output.end) flush(output);
+
+      MergeRun<key> &run = runs[topPair.second];
+      run.begin++;
+      if ((run.begin != run.end) || refill(topPair.second, run)) {
+        mergeQueue.push(std::make_pair(*run.begin, topPair.second));
+      }
+    }
+  }
+
+  template<typename key>
+  void loserTreeMerge(std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush) {
+    LoserTree<key> tree(runs);
+
+    while (!tree.empty()) {
+      long long i = tree.winner();
+      MergeRun<key> &run = runs[i];
+      *(output.pos++) = *(run.begin++);
+      if (output.pos == output.end) flush(output);
+
+      if ((run.begin != run.end) || refill(i, run)) tree.replay(*run.begin, false);
+      else tree.replay(key(), true);
+    }
+  }
+
+  //Prefetch distance of the two-way merges in bytes, ahead of the hardware prefetcher for the interleaved streams
+  const long long twoWayMergePrefetchBytes = 512;
+
+  //Size in bytes of the buffers between the two-way merges of a cascade, small enough to stay in the L1/L2 caches
+  const long long cascadeBufferBytes = 1 << 14;
+
+  template<typename key, typename PullFunction>
+  bool twoWayMerge(MergeRun<key> *inputs, bool *hasKeys, PullFunction pull, key *&pos, key *end) {
+    const long long prefetchDistance = std::max<long long>(1, twoWayMergePrefetchBytes / sizeof(key));
+    while (hasKeys[0] || hasKeys[1]) {
+      if (pos == end) return true;
+      if (hasKeys[0] && hasKeys[1]) {
+        const key *a = inputs[0].begin;
+        const key *b = inputs[1].begin;
+        key *out = pos;
+        //Each step consumes a single key, n steps can neither overrun a run nor the output
+        long long n = std::min<long long>(std::min<long long>(inputs[0].end - a, inputs[1].end - b), end - out);
+        while (n > 0) {
+#if defined(__GNUC__)
+          __builtin_prefetch(a + prefetchDistance);
+          __builtin_prefetch(b + prefetchDistance);
+#endif
+          for (long long step = std::min<long long>(n, 16); step > 0; step--) {
+            key x = *a;
+            key y = *b;
+            bool takeB = KeyOrder<key>::less(y, x);
+            *out++ = takeB ? y : x;
+            a += !takeB;
+            b += takeB;
+          }
+          n = std::min<long long>(std::min<long long>(inputs[0].end - a, inputs[1].end - b), end - out);
+        }
+        inputs[0].begin = a;
+        inputs[1].begin = b;
+        pos = out;
+      }
+      else {
+        MergeRun<key> &run = inputs[hasKeys[0] ? 0 : 1];
+        long long numCopied = std::min<long long>(run.end - run.begin, end - pos);
+        pos = std::copy(run.begin, run.begin + numCopied, pos);
+        run.begin += numCopied;
+      }
+
+      for (long long i = 0; i < 2; i++) {
+        if (hasKeys[i] && (inputs[i].begin == inputs[i].end)) hasKeys[i] = pull(i, inputs[i]);
+      }
+    }
+    return false;
+  }
+
+  //Node of a cascade of two-way merges, merging its two children into its buffer
+  template<typename key>
+  struct CascadeNode {
+    MergeRun<key> inputs[2];
+    bool hasKeys[2];
+    std::vector<key> buffer;
+  };
+
+  //Refill the buffer of the node n of a cascade from its children, returns false once both children are exhausted
+  template<typename key>
+  bool fillCascadeNode(std::vector<CascadeNode<key>> &nodes, long long n, MergeRun<key> &run, const MergeRefillFunction<key> &refill) {
+    long long numRuns = nodes.size();
+    if (n >= numRuns) return refill(n - numRuns, run);
+
+    CascadeNode<key> &node = nodes[n];
+    key *pos = node.buffer.data();
+    auto pull = [&](long long i, MergeRun<key> &input) { return fillCascadeNode(nodes, 2 * n + i, input, refill); };
+    twoWayMerge(node.inputs, node.hasKeys, pull, pos, node.buffer.data() + node.buffer.size());
+    run.begin = node.buffer.data();
+    run.end = pos;
+    return run.begin != run.end;
+  }
+
+  template<typename key>
+  void cascadeMerge(std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush) {
+    long long numRuns = runs.size();
+    if (numRuns < 2) {
+      if (numRuns == 1) copyRun(runs[0], output, refill, flush);
+      return;
+    }
+
+    //Internal nodes 1 to numRuns-1, the leaves start with the run buffers and the other nodes with an empty buffer
+    std::vector<CascadeNode<key>> nodes(numRuns);
+    for (long long n = numRuns - 1; n >= 1; n--) {
+      CascadeNode<key> &node = nodes[n];
+      if (n > 1) node.buffer.resize(std::max<long long>(64, cascadeBufferBytes / sizeof(key)));
+      for (long long i = 0; i < 2; i++) {
+        long long child = 2 * n + i;
+        if (child >= numRuns) node.inputs[i] = runs[child - numRuns];
+        else node.inputs[i].begin = node.inputs[i].end = nullptr;
+        node.hasKeys[i] = (node.inputs[i].begin != node.inputs[i].end);
+      }
+    }
+    //The buffers are filled bottom-up, the children of a node have higher indices
+    for (long long n = numRuns - 1; n >= 1; n--) {
+      for (long long i = 0; i < 2; i++) {
+        long long child = 2 * n + i;
+        if (child < numRuns) nodes[n].hasKeys[i] = fillCascadeNode(nodes, child, nodes[n].inputs[i], refill);
+      }
+    }
+
+    //The root merges directly in the output
+    CascadeNode<key> &root = nodes[1];
+    auto pull = [&](long long i, MergeRun<key> &input) { return fillCascadeNode(nodes, 2 + i, input, refill); };
+    while (twoWayMerge(root.inputs, root.hasKeys, pull, output.pos, output.end)) flush(output);
+  }
+
+  template<typename key>
+  void copyRun(MergeRun<key> &run, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush) {
+    while ((run.begin != run.end) || refill(0, run)) {
+      long long numCopied = std::min<long long>(run.end - run.begin, output.end - output.pos);
+      output.pos = std::copy(run.begin, run.begin + numCopied, output.pos);
+      run.begin += numCopied;
+      if (output.pos == output.end) flush(output);
+    }
+  }
+
+  template<typename key>
+  void mergeRuns(MergeKernel kernel, std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush) {
+    //Load the initial data
+    for (long long i = 0; i < (long long)runs.size(); i++) {
+      if (runs[i].begin == runs[i].end) refill(i, runs[i]);
+    }
+
+    //A single run is copied to the output and two runs are merged by a two-way merge, whatever the kernel
+    if (runs.size() == 1) copyRun(runs[0], output, refill, flush);
+    else if (runs.size() == 2) cascadeMerge(runs, output, refill, flush);
+    else switch (kernel) {
+    case MergeKernel::Heap:
+      heapMerge(runs, output, refill, flush);
+      break;
+    case MergeKernel::LoserTree:
+      loserTreeMerge(runs, output, refill, flush);
+      break;
+    case MergeKernel::Cascade:
+      cascadeMerge(runs, output, refill, flush);
+      break;
+    }
+
+    //Write the remaining merged data
+    if (output.pos != output.begin) flush(output);
+  }
+
+  template<typename key, typename KeyAccessor>
+  std::vector<long long> multiSequenceSelect(const std::vector<long long> &sizes, long long rank, KeyAccessor keyAt) {
+    long long numSeqs = sizes.size();
+
+    //Window of candidate split positions in each sequence
+    //Every key before lo in a sequence is lower or equal to every key from hi in any sequence
+    std::vector<long long> lo(numSeqs, 0);
+    std::vector<long long> hi(sizes);
+    std::vector<long long> lower(numSeqs);
+    std::vector<long long> upper(numSeqs);
+
+    while (true) {
+      //Take the pivot in the middle of the largest window
+      long long largest = -1;
+      long long largestSize = 0;
+      for (long long i = 0; i < numSeqs; i++) {
+        if (hi[i] - lo[i] > largestSize) {
+          largest = i;
+          largestSize = hi[i] - lo[i];
+        }
+      }
+      //All windows are empty, the split is at the windows position
+      if (largest < 0) return lo;
+      key pivot = keyAt(largest, lo[largest] + largestSize / 2);
+
+      //Count the keys lower than the pivot and lower or equal to the pivot
+      long long numLower = 0;
+      long long numUpper = 0;
+      for (long long i = 0; i < numSeqs; i++) {
+        //Binary search for the first key not lower than the pivot
+        long long first = lo[i];
+        long long last = hi[i];
+        while (first < last) {
+          long long mid = first + (last - first) / 2;
+          if (KeyOrder<key>::less(keyAt(i, mid), pivot)) first = mid + 1;
+          else last = mid;
+        }
+        lower[i] = first;
+        //Binary search for the first key greater than the pivot
+        last = hi[i];
+        while (first < last) {
+          long long mid = first + (last - first) / 2;
+          if (KeyOrder<key>::less(pivot, keyAt(i, mid))) last = mid;
+          else first = mid + 1;
+        }
+        upper[i] = first;
+        numLower += lower[i];
+        numUpper += upper[i];
+      }
+
+      if (rank < numLower) hi = lower;
+      else if (rank > numUpper) lo = upper;
+      else {
+        //The keys equal to the pivot are split between the sequences
+        long long remaining = rank - numLower;
+        for (long long i = 0; i < numSeqs; i++) {
+          long long numTaken = std::min(remaining, upper[i] - lower[i]);
+          lower[i] += numTaken;
+          remaining -= numTaken;
+        }
+        return lower;
+      }
+    }
+  }
+
+} //namespace ems
@@ -0,0 +1,132 @@
+//Kernels performing the k-way merge of sorted runs, all of them compare the keys with KeyOrder
+//The runs are read directly from their buffers, the kernels call back when a run buffer
+//is empty or when the output buffer is full so that they can be used with any I/O scheme
+
+#pragma once
+
+#include "KeyOrder.h"
+
+#include <vector>
+#include <functional>
+
+namespace ems {
+
+  //Kernels available to merge the runs
+  enum class MergeKernel {
+    //Binary heap (std::priority_queue) of (key, run index) pairs
+    Heap,
+    //Tournament tree of losers, one leaf to root replay per merged key
+    LoserTree,
+    //Binary tree of branchless two-way merges through small buffers, for low fan-ins
+    Cascade
+  };
+
+  //Buffered part of a run being merged
+  //The keys in [begin, end) have not been merged yet
+  template<typename key>
+  struct MergeRun {
+    const key *begin;
+    const key *end;
+  };
+
+  //Output buffer of a merge
+  //Merged keys are written at pos, the buffer is full when pos reaches end
+  template<typename key>
+  struct MergeOutput {
+    key *begin;
+    key *pos;
+    key *end;
+  };
+
+  //Called when the buffer of a run is empty with the run index and the run buffer
+  //Must refill the buffer and return true, or return false if the run is exhausted
+  template<typename key> using MergeRefillFunction = std::function<bool(long long, MergeRun<key> &)>;
+
+  //Called when the output buffer is full or when the merge is done
+  //Must consume the keys in [begin, pos) and reset pos (the buffer itself may be swapped)
+  template<typename key> using MergeFlushFunction = std::function<void(MergeOutput<key> &)>;
+
+  //Tournament tree of losers over the heads of a set of runs
+  //Leaf i holds the run i, internal nodes hold the run which lost the match at this node
+  //and node 0 holds the overall winner. Exhausted runs lose every match.
+  //The head key of each run is cached in the nodes so that a replay does not touch the run buffers
+  template<typename key>
+  class LoserTree
+  {
+  public:
+    //Build the tree over the runs, runs with an empty buffer are considered exhausted
+    explicit LoserTree(const std::vector<MergeRun<key>> &runs);
+
+    //Returns true when all the runs are exhausted
+    inline bool empty() const {
+      return tree_[0].exhausted;
+    }
+
+    //Index of the run holding the smallest head
+    inline long long winner() const {
+      return tree_[0].run;
+    }
+
+    //Replay the matches from the winner leaf to the root
+    //Must be called after the head of the winner run changed
+    //head is the new head of the run, exhausted indicates that the run has no more keys
+    void replay(const key &head, bool exhausted);
+
+  private:
+    //Player of the tournament: a run and its head
+    struct Node {
+      key head;
+      long long run;
+      bool exhausted;
+    };
+
+    //Returns true if player a beats player b
+    static inline bool beats(const Node &a, const Node &b) {
+      return !a.exhausted && (b.exhausted || KeyOrder<key>::less(a.head, b.head));
+    }
+
+    //Number of runs (leaves)
+    long long numRuns_;
+
+    //Losers of each internal node (1 to numRuns_-1) and winner (0)
+    std::vector<Node> tree_;
+  };
+
+  //Merge the runs using a binary heap
+  template<typename key>
+  void heapMerge(std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush);
+
+  //Merge the runs using a loser tree
+  template<typename key>
+  void loserTreeMerge(std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush);
+
+  //Merge the runs using a cascade of two-way merges, node n merges the outputs of nodes 2n and 2n+1 and leaf numRuns+i is the run i
+  //Two runs are merged by a single two-way merge, without intermediate buffer
+  template<typename key>
+  void cascadeMerge(std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush);
+
+  //Merge two runs in [pos, end) until the output is full or both runs are exhausted, returns false once both runs are exhausted
+  //hasKeys[i] indicates that the run i is not exhausted, pull(i, run) is called when its buffer is empty as a refill function
+  //The keys are selected without branch, the runs must be sorted by KeyOrder
+  template<typename key, typename PullFunction>
+  bool twoWayMerge(MergeRun<key> *inputs, bool *hasKeys, PullFunction pull, key *&pos, key *end);
+
+  //Copy a single run to the output, refilled and flushed as by the kernels
+  template<typename key>
+  void copyRun(MergeRun<key> &run, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush);
+
+  //Merge the runs using the given kernel, a single run is copied and two runs use a two-way merge
+  //Runs with an empty buffer are refilled first, the output is flushed once all runs are exhausted
+  template<typename key>
+  void mergeRuns(MergeKernel kernel, std::vector<MergeRun<key>> &runs, MergeOutput<key> &output, const MergeRefillFunction<key> &refill, const MergeFlushFunction<key> &flush);
+
+  //Multisequence selection: split sorted sequences so that the keys before the split positions are the rank smallest keys
+  //sizes holds the size of each sequence and keyAt(i, pos) must return the key at position pos of sequence i
+  //Returns the split position in each sequence, keys equal to the last selected key are taken from the first sequences
+  //The split only depends on the keys, so consecutive ranks split independently give consecutive ranges
+  template<typename key, typename KeyAccessor>
+  std::vector<long long> multiSequenceSelect(const std::vector<long long> &sizes, long long rank, KeyAccessor keyAt);
+
+} //namespace ems
+
+#include "MergeKernel-inl.h"
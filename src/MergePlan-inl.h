@@ -0,0 +1,56 @@
+#pragma once
+
+#include <queue>
+#include <tuple>
+#include <functional>
+#include <algorithm>
+
+namespace ems {
+
+  //The runs waiting to be merged are in a min-heap ordered by size, estimated ready time then index
+  inline std::vector<PlannedMerge> planMerges(const std::vector<long long> &runSizes, const std::vector<double> &runReadyTimes, long long fanIn) {
+    typedef std::tuple<long long, double, long long> Run;
+    std::priority_queue<Run, std::vector<Run>, std::greater<Run>> runs;
+    long long numRuns = runSizes.size();
+    for (long long i = 0; i < numRuns; i++) {
+      runs.push(Run(runSizes[i], runReadyTimes.empty() ? 0 : runReadyTimes[i], i));
+    }
+    fanIn = std::max(2LL, fanIn);
+
+    //Level of each run, 0 for the initial runs
+    std::vector<int> levels(numRuns, 0);
+
+    std::vector<PlannedMerge> plan;
+    if (numRuns < 2) return plan;
+
+    //Each merge replaces fanIn runs by one, the first one takes the remainder
+    long long numInputs = (numRuns - 1) % (fanIn - 1) + 1;
+    if (numInputs == 1) numInputs = fanIn;
+    while (runs.size() > 1) {
+      PlannedMerge merge;
+      int level = 0;
+      for (long long i = 0; (i < numInputs) && !runs.empty(); i++) {
+        const Run &run = runs.top();
+        merge.inputs.push_back(std::get<2>(run));
+        merge.numValues += std::get<0>(run);
+        merge.readyTime = std::max(merge.readyTime, std::get<1>(run));
+        level = std::max(level, levels[std::get<2>(run)]);
+        runs.pop();
+      }
+      merge.level = level + 1;
+      merge.readyTime += merge.numValues;
+      runs.push(Run(merge.numValues, merge.readyTime, numRuns + plan.size()));
+      levels.push_back(merge.level);
+      plan.push_back(merge);
+      numInputs = fanIn;
+    }
+    return plan;
+  }
+
+  inline long long intermediateMergeSize(const std::vector<PlannedMerge> &plan) {
+    long long numValues = 0;
+    for (size_t i = 0; i + 1 < plan.size(); i++) numValues += plan[i].numValues;
+    return numValues;
+  }
+
+} //namespace ems
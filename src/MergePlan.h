@@ -0,0 +1,40 @@
+//Planning of the merges of sorted runs into a single run
+//The plan is a merge tree built like a Huffman code of fan-in fanIn: the smallest runs are merged first so that
+//the keys of the large runs are rewritten by as few merges as possible
+
+#pragma once
+
+#include <vector>
+
+namespace ems {
+
+  //Merge of a plan
+  //The inputs are indices of runs: the initial runs first, then the runs produced by the merges in the order of the plan
+  struct PlannedMerge {
+    PlannedMerge() : numValues(0), level(1), readyTime(0) {}
+
+    std::vector<long long> inputs;
+    long long numValues;
+
+    //1 for a merge of initial runs only, otherwise one more than the highest level of its inputs
+    int level;
+
+    //Estimated time at which the merged run is written (see planMerges)
+    double readyTime;
+  };
+
+  //Plan the merges of runs of runSizes keys into a single run with at most fanIn inputs per merge,
+  //minimizing the number of keys written by the merges
+  //The first merge takes just enough runs for all the next ones to take fanIn runs
+  //Among runs of the same size the ones estimated to be ready first are merged first, so that a merge is not held
+  //by an input written late: a merge is ready once its last input is ready and it has merged its keys at one key per time unit
+  //runReadyTimes is the estimated time at which each initial run is written, all are ready at time 0 if empty
+  //The last merge of the plan writes the final run, the plan is empty for less than 2 runs
+  std::vector<PlannedMerge> planMerges(const std::vector<long long> &runSizes, const std::vector<double> &runReadyTimes, long long fanIn);
+
+  //Number of keys written by the merges of a plan, without the final merge
+  long long intermediateMergeSize(const std::vector<PlannedMerge> &plan);
+
+} //namespace ems
+
+#include "MergePlan-inl.h"
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+
+namespace ems {
+
+  template<typename key>
+  void radixSort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt) {
+    static_assert(RadixTraits<key>::isSupported, "radixSort: unsupported key type");
+    typedef RadixTraits<key> Traits;
+    typedef typename Traits::type radix;
+
+    long long numValues = endIt - beginIt;
+    if (numValues < 2) return;
+
+    //The histograms are not worth it for small ranges
+    if (numValues < 64) {
+      std::sort(beginIt, endIt, [](const key &a, const key &b) { return Traits::toRadix(a) < Traits::toRadix(b); });
+      return;
+    }
+
+    //Temporary buffer of this thread
+    static thread_local std::vector<key> buffer;
+    if ((long long)buffer.size() < numValues) buffer.resize(numValues);
+
+    //Histograms of all the bytes, computed in a single pass
+    const int numBytes = sizeof(key);
+    long long counts[numBytes][256] = {};
+    key *data = &(*beginIt);
+    for (long long i = 0; i < numValues; i++) {
+      radix r = Traits::toRadix(data[i]);
+      for (int b = 0; b < numBytes; b++) counts[b][(r >> (8 * b)) & 0xFF]++;
+    }
+
+    key *src = data;
+    key *dst = &buffer[0];
+    radix firstRadix = Traits::toRadix(data[0]);
+    for (int b = 0; b < numBytes; b++) {
+      long long *count = counts[b];
+
+      //Skip the pass if all the keys have the same byte
+      if (count[(firstRadix >> (8 * b)) & 0xFF] == numValues) continue;
+
+      //Starting position of each bucket
+      long long sum = 0;
+      for (int d = 0; d < 256; d++) {
+        long long c = count[d];
+        count[d] = sum;
+        sum += c;
+      }
+
+      //Scatter the keys in their bucket
+      const int shift = 8 * b;
+      for (key *pos = src; pos != src + numValues; pos++) {
+        dst[count[(Traits::toRadix(*pos) >> shift) & 0xFF]++] = *pos;
+      }
+      std::swap(src, dst);
+    }
+
+    //Copy back if the last pass ended in the temporary buffer
+    if (src != data) std::copy(src, src + numValues, data);
+  }
+
+} //namespace ems
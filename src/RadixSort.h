@@ -0,0 +1,85 @@
+//LSD radix sort of integral and floating point keys
+//Keys are mapped to unsigned integers of the same size preserving their order and are sorted
+//byte by byte, least significant first. Passes whose byte is the same for all keys are skipped.
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace ems {
+
+  //Unsigned integer type of the given size in bytes
+  template<size_t size> struct RadixUnsigned;
+  template<> struct RadixUnsigned<1> { typedef uint8_t type; };
+  template<> struct RadixUnsigned<2> { typedef uint16_t type; };
+  template<> struct RadixUnsigned<4> { typedef uint32_t type; };
+  template<> struct RadixUnsigned<8> { typedef uint64_t type; };
+
+  //Mapping of the keys to unsigned integers preserving their order
+  //isSupported is false for the key types which cannot be radix sorted
+  template<typename key, typename Enable = void>
+  struct RadixTraits {
+    static const bool isSupported = false;
+  };
+
+  //Unsigned integers are used as is
+  template<typename key>
+  struct RadixTraits<key, typename std::enable_if<std::is_integral<key>::value && std::is_unsigned<key>::value && !std::is_same<key, bool>::value>::type> {
+    static const bool isSupported = true;
+    typedef typename RadixUnsigned<sizeof(key)>::type type;
+    static inline type toRadix(key k) {
+      return static_cast<type>(k);
+    }
+    static inline key fromRadix(type r) {
+      return static_cast<key>(r);
+    }
+  };
+
+  //Signed integers have their sign bit flipped so that negative values come first
+  template<typename key>
+  struct RadixTraits<key, typename std::enable_if<std::is_integral<key>::value && std::is_signed<key>::value>::type> {
+    static const bool isSupported = true;
+    typedef typename RadixUnsigned<sizeof(key)>::type type;
+    static inline type toRadix(key k) {
+      return static_cast<type>(k) ^ (type(1) << (8 * sizeof(key) - 1));
+    }
+    static inline key fromRadix(type r) {
+      return static_cast<key>(static_cast<type>(r ^ (type(1) << (8 * sizeof(key) - 1))));
+    }
+  };
+
+  //Negative floating point numbers have all their bits flipped, positive ones their sign bit
+  //All NaNs are mapped to the largest integer so that they come after +infinity whatever their sign or payload,
+  //which fromRadix maps back to a single NaN
+  template<typename key>
+  struct RadixTraits<key, typename std::enable_if<std::is_floating_point<key>::value && ((sizeof(key) == 4) || (sizeof(key) == 8))>::type> {
+    static const bool isSupported = true;
+    typedef typename RadixUnsigned<sizeof(key)>::type type;
+    static inline type toRadix(key k) {
+      if (k != k) return ~type(0);
+      type bits;
+      std::memcpy(&bits, &k, sizeof(key));
+      const type signBit = type(1) << (8 * sizeof(key) - 1);
+      return (bits & signBit) ? ~bits : (bits | signBit);
+    }
+    static inline key fromRadix(type r) {
+      const type signBit = type(1) << (8 * sizeof(key) - 1);
+      type bits = (r & signBit) ? (r ^ signBit) : ~r;
+      key k;
+      std::memcpy(&k, &bits, sizeof(key));
+      return k;
+    }
+  };
+
+  //Sort the keys in [beginIt, endIt) with an LSD radix sort, the sort is stable
+  //Uses a temporary buffer as large as the range, kept by each thread between calls
+  //NaNs are placed after all other values, the keys are sorted in KeyOrder
+  template<typename key>
+  void radixSort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt);
+
+} //namespace ems
+
+#include "RadixSort-inl.h"
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <ios>
+#include <cstring>
+#include <algorithm>
+
+namespace ems {
+
+  //Size of the block header: number of keys, number of keys stored raw, bit width and padding (16 bits each)
+  //then first key (64 bits)
+  const long long runBlockHeaderBytes = 16;
+
+  //Size of the footer: number of blocks and number of keys
+  const long long runFooterBytes = 16;
+
+  template<typename key>
+  long long maxRunBlockBytes() {
+    return runBlockHeaderBytes + runBlockKeys * static_cast<long long>(sizeof(key));
+  }
+
+  //Encoding of the blocks, only instantiated for the supported key types
+  template<typename key, bool isSupported = RunCodec<key>::isSupported>
+  struct RunBlockCodec {
+    static long long encode(const key *, long long, char *) {
+      throw std::ios_base::failure("RunCodec unsupported key type");
+    }
+    static long long decode(const char *, key *) {
+      throw std::ios_base::failure("RunCodec unsupported key type");
+    }
+  };
+
+  template<typename key>
+  struct RunBlockCodec<key, true> {
+    static long long encode(const key *keys, long long numKeys, char *out) {
+      typedef RadixTraits<key> Traits;
+      typedef typename Traits::type radix;
+
+      //NaNs are stored raw after the header since the mapping to integers loses their payload. In a sorted
+      //block they are at the end, if a NaN comes before another key the whole block is stored raw.
+      long long numPacked = numKeys;
+      while ((numPacked > 0) && (keys[numPacked - 1] != keys[numPacked - 1])) numPacked--;
+      for (long long i = 0; i < numPacked; i++) {
+        if (keys[i] != keys[i]) {
+          numPacked = 0;
+          break;
+        }
+      }
+      long long numRaw = numKeys - numPacked;
+
+      //Deltas between consecutive keys, they wrap around if the keys are not sorted
+      radix deltas[runBlockKeys];
+      radix previous = numPacked ? Traits::toRadix(keys[0]) : radix(0);
+      uint64_t allBits = 0;
+      for (long long i = 1; i < numPacked; i++) {
+        radix current = Traits::toRadix(keys[i]);
+        deltas[i - 1] = static_cast<radix>(current - previous);
+        allBits |= deltas[i - 1];
+        previous = current;
+      }
+      uint32_t bitWidth = 0;
+      while ((bitWidth < 64) && (allBits >> bitWidth)) bitWidth++;
+
+      uint16_t header[4] = { static_cast<uint16_t>(numKeys), static_cast<uint16_t>(numRaw), static_cast<uint16_t>(bitWidth), 0 };
+      uint64_t first = numPacked ? Traits::toRadix(keys[0]) : 0;
+      std::memcpy(out, header, sizeof(header));
+      std::memcpy(out + sizeof(header), &first, sizeof(first));
+      char *pos = out + runBlockHeaderBytes;
+      if (numRaw) std::memcpy(pos, keys + numPacked, numRaw * sizeof(key));
+      pos += numRaw * sizeof(key);
+      if (!bitWidth) return pos - out;
+
+      //Pack the deltas in 64-bit words, the last word is truncated to its used bytes
+      uint64_t word = 0;
+      uint32_t wordBits = 0;
+      for (long long i = 0; i < numPacked - 1; i++) {
+        uint64_t delta = deltas[i];
+        word |= delta << wordBits;
+        wordBits += bitWidth;
+        if (wordBits >= 64) {
+          std::memcpy(pos, &word, sizeof(word));
+          pos += sizeof(word);
+          wordBits -= 64;
+          word = wordBits ? (delta >> (bitWidth - wordBits)) : 0;
+        }
+      }
+      std::memcpy(pos, &word, (wordBits + 7) / 8);
+      pos += (wordBits + 7) / 8;
+      return pos - out;
+    }
+
+    static long long decode(const char *in, key *keys) {
+      typedef RadixTraits<key> Traits;
+      typedef typename Traits::type radix;
+
+      uint16_t header[4];
+      uint64_t first;
+      std::memcpy(header, in, sizeof(header));
+      std::memcpy(&first, in + sizeof(header), sizeof(first));
+      long long numKeys = header[0];
+      long long numRaw = header[1];
+      long long numPacked = numKeys - numRaw;
+      uint32_t bitWidth = header[2];
+      const char *payload = in + runBlockHeaderBytes + numRaw * sizeof(key);
+      if (numRaw) std::memcpy(keys + numPacked, in + runBlockHeaderBytes, numRaw * sizeof(key));
+      if (!numPacked) return numKeys;
+
+      //Unpack the deltas, each one with unaligned 64-bit loads and no data dependent branch
+      radix deltas[runBlockKeys];
+      uint64_t mask = (bitWidth < 64) ? (uint64_t(1) << bitWidth) - 1 : ~uint64_t(0);
+      if (!bitWidth) {
+        for (long long i = 0; i < numPacked - 1; i++) deltas[i] = 0;
+      }
+      else if (bitWidth <= 57) {
+        //A delta always fits in the 64 bits loaded from its first byte
+        for (long long i = 0; i < numPacked - 1; i++) {
+          uint64_t bitPos = i * bitWidth;
+          uint64_t word;
+          std::memcpy(&word, payload + (bitPos >> 3), sizeof(word));
+          deltas[i] = static_cast<radix>((word >> (bitPos & 7)) & mask);
+        }
+      }
+      else {
+        //Wide deltas may span two words
+        for (long long i = 0; i < numPacked - 1; i++) {
+          uint64_t bitPos = i * bitWidth;
+          uint64_t shift = bitPos & 63;
+          uint64_t low, high;
+          std::memcpy(&low, payload + (bitPos >> 6) * 8, sizeof(low));
+          uint64_t delta = low >> shift;
+          if (shift + bitWidth > 64) {
+            std::memcpy(&high, payload + (bitPos >> 6) * 8 + 8, sizeof(high));
+            delta |= high << (64 - shift);
+          }
+          deltas[i] = static_cast<radix>(delta & mask);
+        }
+      }
+
+      //Prefix sum of the deltas
+      radix current = static_cast<radix>(first);
+      keys[0] = Traits::fromRadix(current);
+      for (long long i = 1; i < numPacked; i++) {
+        current = static_cast<radix>(current + deltas[i - 1]);
+        keys[i] = Traits::fromRadix(current);
+      }
+      return numKeys;
+    }
+  };
+
+  template<typename key>
+  long long encodeRunBlock(const key *keys, long long numKeys, char *out) {
+    return RunBlockCodec<key>::encode(keys, numKeys, out);
+  }
+
+  template<typename key>
+  long long decodeRunBlock(const char *in, key *keys) {
+    return RunBlockCodec<key>::decode(in, keys);
+  }
+
+  template<typename key>
+  RunWriter<key>::RunWriter(File &file, long long bufferBytes) :
+    file_(file),
+    pending_(runBlockKeys),
+    numPending_(0),
+    buffer_(std::max(bufferBytes, maxRunBlockBytes<key>())),
+    bufferSize_(0),
+    filePos_(0),
+    numKeys_(0)
+  {
+  }
+
+  template<typename key>
+  void RunWriter<key>::write(const key *keys, long long numKeys) {
+    while (numKeys > 0) {
+      if (!numPending_ && (numKeys >= runBlockKeys)) {
+        //Whole block, encoded without copy
+        if (bufferSize_ + maxRunBlockBytes<key>() > (long long)buffer_.size()) flush();
+        index_.push_back(numKeys_);
+        index_.push_back(filePos_ + bufferSize_);
+        bufferSize_ += encodeRunBlock(keys, runBlockKeys, buffer_.data() + bufferSize_);
+        numKeys_ += runBlockKeys;
+        keys += runBlockKeys;
+        numKeys -= runBlockKeys;
+        continue;
+      }
+      long long numCopied = std::min(numKeys, runBlockKeys - numPending_);
+      std::copy(keys, keys + numCopied, pending_.begin() + numPending_);
+      numPending_ += numCopied;
+      numKeys_ += numCopied;
+      keys += numCopied;
+      numKeys -= numCopied;
+      if (numPending_ == runBlockKeys) encodePending();
+    }
+  }
+
+  template<typename key>
+  void RunWriter<key>::close() {
+    encodePending();
+    flush();
+
+    //Index then footer
+    std::vector<int64_t> trailer(index_.begin(), index_.end());
+    trailer.push_back(static_cast<int64_t>(index_.size() / 2));
+    trailer.push_back(numKeys_);
+    file_.write(trailer.data(), sizeof(int64_t)*trailer.size(), filePos_);
+    filePos_ += sizeof(int64_t)*trailer.size();
+  }
+
+  template<typename key>
+  void RunWriter<key>::encodePending() {
+    if (!numPending_) return;
+    if (bufferSize_ + maxRunBlockBytes<key>() > (long long)buffer_.size()) flush();
+    index_.push_back(numKeys_ - numPending_);
+    index_.push_back(filePos_ + bufferSize_);
+    bufferSize_ += encodeRunBlock(pending_.data(), numPending_, buffer_.data() + bufferSize_);
+    numPending_ = 0;
+  }
+
+  template<typename key>
+  void RunWriter<key>::flush() {
+    if (!bufferSize_) return;
+    file_.write(buffer_.data(), bufferSize_, filePos_);
+    filePos_ += bufferSize_;
+    bufferSize_ = 0;
+  }
+
+  template<typename key>
+  RunReader<key>::RunReader(long long bufferBytes) :
+    file_(nullptr),
+    bufferBytes_(bufferBytes),
+    numKeys_(0),
+    bufferFirstBlock_(0),
+    bufferEndBlock_(0),
+    nextBlock_(0),
+    decoded_(runBlockKeys),
+    decodedSize_(0),
+    decodedPos_(0),
+    randomKeys_(runBlockKeys),
+    randomBlockInd_(-1)
+  {
+  }
+
+  template<typename key>
+  void RunReader<key>::open(File &file) {
+    file_ = &file;
+    long long fileSize = file.size();
+    int64_t footer[2];
+    if (fileSize < runFooterBytes) throw std::ios_base::failure("RunReader invalid run");
+    file.read(footer, sizeof(footer), fileSize - runFooterBytes);
+    long long numBlocks = footer[0];
+    numKeys_ = footer[1];
+    long long indexPos = fileSize - runFooterBytes - 2 * sizeof(int64_t) * numBlocks;
+    if ((numBlocks < 0) || (indexPos < 0) || (numKeys_ < 0)) throw std::ios_base::failure("RunReader invalid run");
+
+    std::vector<int64_t> index(2 * numBlocks);
+    if (numBlocks) file.read(index.data(), sizeof(int64_t)*index.size(), indexPos);
+    blockFirstKey_.resize(numBlocks + 1);
+    blockPos_.resize(numBlocks + 1);
+    for (long long b = 0; b < numBlocks; b++) {
+      blockFirstKey_[b] = index[2 * b];
+      blockPos_[b] = index[2 * b + 1];
+    }
+    blockFirstKey_[numBlocks] = numKeys_;
+    blockPos_[numBlocks] = indexPos;
+
+    bufferFirstBlock_ = bufferEndBlock_ = 0;
+    randomBlockInd_ = -1;
+    seek(0);
+  }
+
+  template<typename key>
+  void RunReader<key>::seek(long long pos) {
+    decodedSize_ = decodedPos_ = 0;
+    nextBlock_ = findBlock(pos);
+    long long offset = pos - blockFirstKey_[nextBlock_];
+    if (!offset) return;
+
+    //Skip the first keys of the block
+    if ((nextBlock_ < bufferFirstBlock_) || (nextBlock_ >= bufferEndBlock_)) fill();
+    decodedSize_ = decodeRunBlock(buffer_.data() + blockPos_[nextBlock_] - blockPos_[bufferFirstBlock_], decoded_.data());
+    decodedPos_ = offset;
+    nextBlock_++;
+  }
+
+  template<typename key>
+  void RunReader<key>::read(key *keys, long long numKeys) {
+    long long numBlocks = blockFirstKey_.size() - 1;
+    while (numKeys > 0) {
+      if (decodedPos_ < decodedSize_) {
+        //Rest of a partly read block
+        long long numCopied = std::min(numKeys, decodedSize_ - decodedPos_);
+        std::copy(decoded_.begin() + decodedPos_, decoded_.begin() + decodedPos_ + numCopied, keys);
+        decodedPos_ += numCopied;
+        keys += numCopied;
+        numKeys -= numCopied;
+        continue;
+      }
+      if (nextBlock_ >= numBlocks) throw std::ios_base::failure("RunReader end of run reached");
+      if ((nextBlock_ < bufferFirstBlock_) || (nextBlock_ >= bufferEndBlock_)) fill();
+      const char *in = buffer_.data() + blockPos_[nextBlock_] - blockPos_[bufferFirstBlock_];
+      long long blockKeys = blockFirstKey_[nextBlock_ + 1] - blockFirstKey_[nextBlock_];
+      nextBlock_++;
+      if (blockKeys <= numKeys) {
+        //Whole block, decoded in place
+        decodeRunBlock(in, keys);
+        keys += blockKeys;
+        numKeys -= blockKeys;
+      }
+      else {
+        decodedSize_ = decodeRunBlock(in, decoded_.data());
+        decodedPos_ = 0;
+      }
+    }
+  }
+
+  template<typename key>
+  key RunReader<key>::keyAt(long long pos) {
+    if (pos >= numKeys_) throw std::ios_base::failure("RunReader position out of the run");
+    long long block = findBlock(pos);
+    if (block != randomBlockInd_) {
+      long long numBytes = blockPos_[block + 1] - blockPos_[block];
+      randomBlock_.resize(numBytes + 8);
+      file_->read(randomBlock_.data(), numBytes, blockPos_[block]);
+      decodeRunBlock(randomBlock_.data(), randomKeys_.data());
+      randomBlockInd_ = block;
+    }
+    return randomKeys_[pos - blockFirstKey_[block]];
+  }
+
+  template<typename key>
+  long long RunReader<key>::findBlock(long long pos) const {
+    if ((pos < 0) || (pos > numKeys_)) throw std::ios_base::failure("RunReader position out of the run");
+    //The end of the run is the extra entry
+    long long numBlocks = blockFirstKey_.size() - 1;
+    if (pos == numKeys_) return numBlocks;
+    //Last block starting at or before pos
+    return std::upper_bound(blockFirstKey_.begin(), blockFirstKey_.begin() + numBlocks, pos) - blockFirstKey_.begin() - 1;
+  }
+
+  template<typename key>
+  void RunReader<key>::fill() {
+    //As many whole blocks as fit in the buffer, at least one
+    long long numBlocks = blockFirstKey_.size() - 1;
+    long long endBlock = nextBlock_ + 1;
+    while ((endBlock < numBlocks) && (blockPos_[endBlock + 1] - blockPos_[nextBlock_] <= bufferBytes_)) endBlock++;
+    long long numBytes = blockPos_[endBlock] - blockPos_[nextBlock_];
+    //The decoder may read 8 bytes past the last block
+    if ((long long)buffer_.size() < numBytes + 8) buffer_.resize(numBytes + 8);
+    file_->read(buffer_.data(), numBytes, blockPos_[nextBlock_]);
+    bufferFirstBlock_ = nextBlock_;
+    bufferEndBlock_ = endBlock;
+  }
+
+} //namespace ems
@@ -0,0 +1,155 @@
+//Compressed format of the sorted runs written in temporary files
+//The keys are mapped to unsigned integers preserving their order (see RadixTraits) and stored by blocks
+//of runBlockKeys keys. A block starts with a header holding its number of keys, the bit width of its
+//deltas and its first key, followed by the deltas between consecutive keys packed with this bit width.
+//The file ends with an index of the blocks (position of the first key and of the block in the file)
+//and a footer (number of blocks and of keys) so that a run can be read from any key.
+//The NaNs, which come last in a sorted block, are stored raw between the header and the deltas so that
+//their bits are preserved.
+
+#pragma once
+
+#include "FileIo.h"
+#include "RadixSort.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace ems {
+
+  //Number of keys per block
+  const long long runBlockKeys = 1024;
+
+  //Can runs of this key type be compressed?
+  template<typename key>
+  struct RunCodec {
+    static const bool isSupported = RadixTraits<key>::isSupported;
+  };
+
+  //Maximum size in bytes of an encoded block
+  template<typename key>
+  long long maxRunBlockBytes();
+
+  //Encode numKeys keys, at most runBlockKeys, in out which must hold maxRunBlockBytes bytes
+  //Returns the size of the encoded block
+  template<typename key>
+  long long encodeRunBlock(const key *keys, long long numKeys, char *out);
+
+  //Decode the block at in into keys, returns the number of keys
+  //The 8 bytes following the block must be readable
+  template<typename key>
+  long long decodeRunBlock(const char *in, key *keys);
+
+  //Writes a compressed run in a file from its beginning
+  template<typename key>
+  class RunWriter
+  {
+  public:
+    //The encoded blocks are written by batches of about bufferBytes bytes
+    RunWriter(File &file, long long bufferBytes = 1 << 20);
+
+    RunWriter(const RunWriter &) = delete;
+    RunWriter &operator=(const RunWriter &) = delete;
+
+    //Append sorted keys to the run
+    //Throws std::ios_base::failure if the file could not be written
+    void write(const key *keys, long long numKeys);
+
+    //Write the last block, the index and the footer
+    void close();
+
+  private:
+    //Encode the pending keys as a block
+    void encodePending();
+
+    //Write the encoded blocks
+    void flush();
+
+    File &file_;
+
+    //Keys of the block being filled
+    std::vector<key> pending_;
+    long long numPending_;
+
+    //Encoded blocks not written yet and their size
+    std::vector<char> buffer_;
+    long long bufferSize_;
+
+    //Position of the end of the written data in the file
+    long long filePos_;
+
+    //Number of keys in the run
+    long long numKeys_;
+
+    //Position of the first key and of each block
+    std::vector<long long> index_;
+  };
+
+  //Reads a compressed run from a file, sequentially from a given key or by random accesses
+  template<typename key>
+  class RunReader
+  {
+  public:
+    //The encoded blocks are read by batches of about bufferBytes bytes
+    explicit RunReader(long long bufferBytes = 1 << 20);
+
+    RunReader(const RunReader &) = delete;
+    RunReader &operator=(const RunReader &) = delete;
+
+    //Read the index of the run, the next key read is the first one
+    //Throws std::ios_base::failure if the file is not a valid run
+    void open(File &file);
+
+    //Number of keys of the run
+    inline long long size() const {
+      return numKeys_;
+    }
+
+    //The next key read is the one at pos
+    void seek(long long pos);
+
+    //Read the next numKeys keys
+    //Throws std::ios_base::failure if the end of the run is reached
+    void read(key *keys, long long numKeys);
+
+    //Key at pos, the last block accessed is cached
+    key keyAt(long long pos);
+
+  private:
+    //Block holding the key at pos
+    long long findBlock(long long pos) const;
+
+    //Read the blocks from nextBlock_ into the buffer
+    void fill();
+
+    File *file_;
+    long long bufferBytes_;
+
+    //Number of keys, position of the first key of each block and position of each block
+    //Both have an extra entry for the end of the run
+    long long numKeys_;
+    std::vector<long long> blockFirstKey_;
+    std::vector<long long> blockPos_;
+
+    //Encoded blocks read from the file, blocks [bufferFirstBlock_, bufferEndBlock_) are in the buffer
+    std::vector<char> buffer_;
+    long long bufferFirstBlock_;
+    long long bufferEndBlock_;
+
+    //Next block to decode
+    long long nextBlock_;
+
+    //Decoded block whose keys are only partly read, and position of the next key in it
+    std::vector<key> decoded_;
+    long long decodedSize_;
+    long long decodedPos_;
+
+    //Block decoded by keyAt
+    std::vector<char> randomBlock_;
+    std::vector<key> randomKeys_;
+    long long randomBlockInd_;
+  };
+
+} //namespace ems
+
+#include "RunCodec-inl.h"
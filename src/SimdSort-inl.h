@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <cstring>
+
+#ifdef EMS_SIMD_SORT_X86
+#include <immintrin.h>
+#endif //EMS_SIMD_SORT_X86
+
+namespace ems {
+
+  inline SimdLevel simdLevel() {
+#ifdef EMS_SIMD_SORT_X86
+    static const SimdLevel level = []() {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+      if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+      return SimdLevel::Scalar;
+    }();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif //EMS_SIMD_SORT_X86
+  }
+
+#ifdef EMS_SIMD_SORT_X86
+  //Signed integers sorted by the kernels, they may alias the keys they are mapped from
+  template<size_t size> struct SimdValue;
+  template<> struct SimdValue<4> { typedef int32_t __attribute__((may_alias)) type; };
+  template<> struct SimdValue<8> { typedef int64_t __attribute__((may_alias)) type; };
+#endif //EMS_SIMD_SORT_X86
+
+} //namespace ems
+
+#ifdef EMS_SIMD_SORT_X86
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace ems {
+  namespace avx2 {
+
+    //8 lanes of 32 bits, the masks are vectors of all ones or zero lanes
+    struct Int32Ops {
+      typedef SimdValue<4>::type value;
+      typedef __m256i vector;
+      typedef __m256i mask;
+      static const int width = 8;
+      static inline vector load(const value *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      }
+      static inline void store(value *p, vector v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+      }
+      static inline vector min(vector a, vector b) {
+        return _mm256_min_epi32(a, b);
+      }
+      static inline vector max(vector a, vector b) {
+        return _mm256_max_epi32(a, b);
+      }
+      static inline vector permute(vector v, vector index) {
+        return _mm256_permutevar8x32_epi32(v, index);
+      }
+      static inline vector blend(vector a, vector b, mask m) {
+        return _mm256_blendv_epi8(a, b, m);
+      }
+      static inline vector makeIndex(const int *lanes) {
+        return _mm256_setr_epi32(lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6], lanes[7]);
+      }
+      static inline mask makeMask(const bool *lanes) {
+        int l[width];
+        for (int i = 0; i < width; i++) l[i] = lanes[i] ? -1 : 0;
+        return makeIndex(l);
+      }
+    };
+
+    //4 lanes of 64 bits, compared with cmpgt and permuted as pairs of 32-bit lanes
+    struct Int64Ops {
+      typedef SimdValue<8>::type value;
+      typedef __m256i vector;
+      typedef __m256i mask;
+      static const int width = 4;
+      static inline vector load(const value *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      }
+      static inline void store(value *p, vector v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+      }
+      static inline vector min(vector a, vector b) {
+        return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+      }
+      static inline vector max(vector a, vector b) {
+        return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b));
+      }
+      static inline vector permute(vector v, vector index) {
+        return _mm256_permutevar8x32_epi32(v, index);
+      }
+      static inline vector blend(vector a, vector b, mask m) {
+        return _mm256_blendv_epi8(a, b, m);
+      }
+      static inline vector makeIndex(const int *lanes) {
+        return _mm256_setr_epi32(2 * lanes[0], 2 * lanes[0] + 1, 2 * lanes[1], 2 * lanes[1] + 1,
+          2 * lanes[2], 2 * lanes[2] + 1, 2 * lanes[3], 2 * lanes[3] + 1);
+      }
+      static inline mask makeMask(const bool *lanes) {
+        return _mm256_setr_epi64x(lanes[0] ? -1 : 0, lanes[1] ? -1 : 0, lanes[2] ? -1 : 0, lanes[3] ? -1 : 0);
+      }
+    };
+
+  } //namespace avx2
+} //namespace ems
+
+#define EMS_SIMD_NAMESPACE avx2
+#include "SimdSortKernel-inl.h"
+#undef EMS_SIMD_NAMESPACE
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,avx512f")
+
+namespace ems {
+  namespace avx512 {
+
+    //16 lanes of 32 bits, the masks are mask registers
+    struct Int32Ops {
+      typedef SimdValue<4>::type value;
+      typedef __m512i vector;
+      typedef __mmask16 mask;
+      static const int width = 16;
+      static inline vector load(const value *p) {
+        return _mm512_loadu_si512(p);
+      }
+      static inline void store(value *p, vector v) {
+        _mm512_storeu_si512(p, v);
+      }
+      static inline vector min(vector a, vector b) {
+        return _mm512_min_epi32(a, b);
+      }
+      static inline vector max(vector a, vector b) {
+        return _mm512_max_epi32(a, b);
+      }
+      static inline vector permute(vector v, vector index) {
+        return _mm512_permutexvar_epi32(index, v);
+      }
+      static inline vector blend(vector a, vector b, mask m) {
+        return _mm512_mask_blend_epi32(m, a, b);
+      }
+      static inline vector makeIndex(const int *lanes) {
+        int32_t l[width];
+        for (int i = 0; i < width; i++) l[i] = lanes[i];
+        return _mm512_loadu_si512(l);
+      }
+      static inline mask makeMask(const bool *lanes) {
+        mask m = 0;
+        for (int i = 0; i < width; i++) m |= static_cast<mask>(lanes[i] ? (1 << i) : 0);
+        return m;
+      }
+    };
+
+    //8 lanes of 64 bits
+    struct Int64Ops {
+      typedef SimdValue<8>::type value;
+      typedef __m512i vector;
+      typedef __mmask8 mask;
+      static const int width = 8;
+      static inline vector load(const value *p) {
+        return _mm512_loadu_si512(p);
+      }
+      static inline void store(value *p, vector v) {
+        _mm512_storeu_si512(p, v);
+      }
+      static inline vector min(vector a, vector b) {
+        return _mm512_min_epi64(a, b);
+      }
+      static inline vector max(vector a, vector b) {
+        return _mm512_max_epi64(a, b);
+      }
+      static inline vector permute(vector v, vector index) {
+        return _mm512_permutexvar_epi64(index, v);
+      }
+      static inline vector blend(vector a, vector b, mask m) {
+        return _mm512_mask_blend_epi64(m, a, b);
+      }
+      static inline vector makeIndex(const int *lanes) {
+        int64_t l[width];
+        for (int i = 0; i < width; i++) l[i] = lanes[i];
+        return _mm512_loadu_si512(l);
+      }
+      static inline mask makeMask(const bool *lanes) {
+        mask m = 0;
+        for (int i = 0; i < width; i++) m |= static_cast<mask>(lanes[i] ? (1 << i) : 0);
+        return m;
+      }
+    };
+
+  } //namespace avx512
+} //namespace ems
+
+#define EMS_SIMD_NAMESPACE avx512
+#include "SimdSortKernel-inl.h"
+#undef EMS_SIMD_NAMESPACE
+
+#pragma GCC pop_options
+
+#endif //EMS_SIMD_SORT_X86
+
+namespace ems {
+
+  //Sort of the keys without SIMD kernel: radixSort for the keys with a RadixTraits mapping, std::sort by KeyOrder otherwise
+  template<typename key, bool useRadixSort = RadixTraits<key>::isSupported>
+  struct SimdScalarSort {
+    static void sort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt) {
+      std::sort(beginIt, endIt, KeyLess<key>());
+    }
+  };
+  template<typename key>
+  struct SimdScalarSort<key, true> {
+    static void sort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt) {
+      radixSort<key>(beginIt, endIt);
+    }
+  };
+
+  //Keys sorted by the SIMD kernels: 32 and 64-bit keys with a RadixTraits mapping
+  template<typename key, bool isSupported = RadixTraits<key>::isSupported && ((sizeof(key) == 4) || (sizeof(key) == 8))>
+  struct SimdSortKernel {
+    static void sort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt, SimdLevel) {
+      SimdScalarSort<key>::sort(beginIt, endIt);
+    }
+  };
+
+#ifdef EMS_SIMD_SORT_X86
+  //The keys are mapped in place to signed integers (radix with the sign bit flipped), sorted, then mapped back
+  //The NaNs are left out of the mapping and placed last, as ordered by KeyOrder
+  template<typename key>
+  struct SimdSortKernel<key, true> {
+    static void sort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt, SimdLevel level) {
+      if (level == SimdLevel::Scalar) {
+        SimdScalarSort<key>::sort(beginIt, endIt);
+        return;
+      }
+      typedef RadixTraits<key> Traits;
+      typedef typename Traits::type radix;
+      typedef typename SimdValue<sizeof(key)>::type value;
+      typedef typename std::conditional<sizeof(key) == 4, int32_t, int64_t>::type bufferValue;
+      const radix signBit = radix(1) << (8 * sizeof(key) - 1);
+
+      //The mapping would turn all the NaNs into the same NaN, they are moved after the other keys untouched
+      endIt = std::partition(beginIt, endIt, [](const key &k) { return k == k; });
+      long long numValues = endIt - beginIt;
+      if (numValues < 2) return;
+
+      key *keys = &(*beginIt);
+      value *values = reinterpret_cast<value *>(keys);
+      for (long long i = 0; i < numValues; i++) {
+        key k = keys[i];
+        values[i] = static_cast<value>(Traits::toRadix(k) ^ signBit);
+      }
+
+      std::vector<bufferValue> buffer(numValues);
+      value *sorted = sortValues(values, reinterpret_cast<value *>(buffer.data()), numValues, level);
+
+      for (long long i = 0; i < numValues; i++) {
+        radix r = static_cast<radix>(sorted[i]) ^ signBit;
+        keys[i] = Traits::fromRadix(r);
+      }
+    }
+
+    static typename SimdValue<4>::type *sortValues(typename SimdValue<4>::type *data, typename SimdValue<4>::type *buffer, long long numValues, SimdLevel level) {
+      if (level == SimdLevel::Avx512) return avx512::sortValues<avx512::Int32Ops>(data, buffer, numValues);
+      return avx2::sortValues<avx2::Int32Ops>(data, buffer, numValues);
+    }
+
+    static typename SimdValue<8>::type *sortValues(typename SimdValue<8>::type *data, typename SimdValue<8>::type *buffer, long long numValues, SimdLevel level) {
+      if (level == SimdLevel::Avx512) return avx512::sortValues<avx512::Int64Ops>(data, buffer, numValues);
+      return avx2::sortValues<avx2::Int64Ops>(data, buffer, numValues);
+    }
+  };
+#endif //EMS_SIMD_SORT_X86
+
+  template<typename key>
+  void simdSort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt) {
+    simdSortAtLevel<key>(beginIt, endIt, simdLevel());
+  }
+
+  template<typename key>
+  void simdSortAtLevel(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt, SimdLevel level) {
+    SimdSortKernel<key>::sort(beginIt, endIt, std::min(level, simdLevel()));
+  }
+
+} //namespace ems
@@ -0,0 +1,44 @@
+//Sort of 32 and 64-bit integral and floating point keys with SIMD sorting networks and merges
+//The keys are mapped in place to signed integers preserving their order (RadixTraits). Each pair of vectors of keys
+//is sorted by an in-register bitonic network, then the sorted runs are merged pairwise by a vectorized bitonic merge.
+//The instruction set (AVX-512 or AVX2) is picked at runtime from CPUID. The other CPUs, compilers and key types
+//fall back to radixSort, or std::sort for the keys without a RadixTraits mapping.
+
+#pragma once
+
+#include "KeyOrder.h"
+#include "RadixSort.h"
+
+#include <vector>
+
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define EMS_SIMD_SORT_X86
+#endif
+
+namespace ems {
+
+  //Instruction sets of the SIMD sort, in increasing order
+  enum class SimdLevel {
+    //No SIMD kernel, radixSort or std::sort
+    Scalar,
+    //256-bit vectors: 8 keys of 32 bits or 4 keys of 64 bits
+    Avx2,
+    //512-bit vectors: 16 keys of 32 bits or 8 keys of 64 bits
+    Avx512
+  };
+
+  //Best instruction set supported by the CPU and the compiler, detected once
+  SimdLevel simdLevel();
+
+  //Sort the keys with the best supported instruction set, can be set with ExternalMergeSort::setSortFunction
+  //Allocates a temporary buffer as large as the keys
+  template<typename key>
+  void simdSort(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt);
+
+  //Sort the keys with at most the given instruction set
+  template<typename key>
+  void simdSortAtLevel(typename std::vector<key>::iterator beginIt, typename std::vector<key>::iterator endIt, SimdLevel level);
+
+} //namespace ems
+
+#include "SimdSort-inl.h"
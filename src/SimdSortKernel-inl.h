@@ -0,0 +1,203 @@
+//Generic SIMD sort kernel, included by SimdSort-inl.h once per instruction set (no include guard)
+//The includer compiles this file for the instruction set with #pragma GCC target and names its namespace
+//EMS_SIMD_NAMESPACE. The kernel is written for vector operations Ops providing:
+//value, vector, mask and width (number of lanes), load, store, min, max, permute (lane i gets lane index[i]),
+//blend (lanes of b where the mask is set, of a elsewhere), makeIndex and makeMask (from arrays of width lanes)
+//The values may alias the keys they are mapped from, so they are only accessed through value pointers
+
+namespace ems {
+  namespace EMS_SIMD_NAMESPACE {
+
+    //Merge the sorted ranges a and b one value at a time in out, returns the end of the merged values
+    template<typename Ops>
+    typename Ops::value *mergeScalar(const typename Ops::value *a, const typename Ops::value *aEnd,
+      const typename Ops::value *b, const typename Ops::value *bEnd, typename Ops::value *out) {
+      while ((a != aEnd) && (b != bEnd)) *out++ = (*b < *a) ? *b++ : *a++;
+      while (a != aEnd) *out++ = *a++;
+      while (b != bEnd) *out++ = *b++;
+      return out;
+    }
+
+    //Sort a few values by insertion
+    template<typename Ops>
+    void insertionSort(typename Ops::value *begin, typename Ops::value *end) {
+      typedef typename Ops::value value;
+      for (value *it = begin; it != end; ++it) {
+        value v = *it;
+        value *pos = it;
+        for (; (pos != begin) && (v < *(pos - 1)); --pos) *pos = *(pos - 1);
+        *pos = v;
+      }
+    }
+
+    //Constants of the bitonic networks: lane exchanges and lanes taking the maximum of each step
+    template<typename Ops>
+    struct BitonicNetwork {
+      typedef typename Ops::vector vector;
+      typedef typename Ops::mask mask;
+      static const int width = Ops::width;
+      static const int logWidth = (width == 16) ? 4 : ((width == 8) ? 3 : 2);
+
+      //Lane i exchanged with lane i^(1<<l), and lane i with lane width-1-i
+      vector exchange[logWidth];
+      vector reverse;
+
+      //Lanes taking the maximum at each step of the sort of a vector, and at distance 1<<l in a merge
+      mask sortMax[logWidth * (logWidth + 1) / 2];
+      mask mergeMax[logWidth];
+
+      BitonicNetwork() {
+        int lanes[width];
+        bool takeMax[width];
+        for (int l = 0; l < logWidth; l++) {
+          for (int i = 0; i < width; i++) lanes[i] = i ^ (1 << l);
+          exchange[l] = Ops::makeIndex(lanes);
+          for (int i = 0; i < width; i++) takeMax[i] = (i & (1 << l)) != 0;
+          mergeMax[l] = Ops::makeMask(takeMax);
+        }
+        for (int i = 0; i < width; i++) lanes[i] = width - 1 - i;
+        reverse = Ops::makeIndex(lanes);
+
+        //Sequences of k lanes are sorted alternately up and down, then merged at distances k/2 to 1
+        int step = 0;
+        for (int k = 2; k <= width; k *= 2) {
+          for (int j = k / 2; j >= 1; j /= 2) {
+            for (int i = 0; i < width; i++) takeMax[i] = (((i & j) != 0) != ((i & k) != 0));
+            sortMax[step++] = Ops::makeMask(takeMax);
+          }
+        }
+      }
+
+      //Compare each lane with the lane given by exchange, keeping the maximum in the lanes of takeMax
+      static inline vector compareExchange(vector v, vector exchange, mask takeMax) {
+        vector other = Ops::permute(v, exchange);
+        return Ops::blend(Ops::min(v, other), Ops::max(v, other), takeMax);
+      }
+
+      //Sort the lanes of a vector
+      inline vector sortVector(vector v) const {
+        int step = 0;
+        for (int k = 1; k < logWidth + 1; k++) {
+          for (int l = k - 1; l >= 0; l--) v = compareExchange(v, exchange[l], sortMax[step++]);
+        }
+        return v;
+      }
+
+      //Merge two sorted vectors, a gets the lowest keys and b the highest ones, both sorted
+      inline void mergeVectors(vector &a, vector &b) const {
+        b = Ops::permute(b, reverse);
+        vector low = Ops::min(a, b);
+        vector high = Ops::max(a, b);
+        for (int l = logWidth - 1; l >= 0; l--) {
+          low = compareExchange(low, exchange[l], mergeMax[l]);
+          high = compareExchange(high, exchange[l], mergeMax[l]);
+        }
+        a = low;
+        b = high;
+      }
+    };
+
+    //Merge the sorted runs a and b in out
+    //A vector of the merged keys not output yet is merged with the next vector of the run whose next key is the smallest,
+    //the lowest half is output. The last keys, once a run has less than a vector left, are merged one by one.
+    template<typename Ops>
+    void mergeRuns(const BitonicNetwork<Ops> &network, const typename Ops::value *a, long long numA,
+      const typename Ops::value *b, long long numB, typename Ops::value *out) {
+      typedef typename Ops::value value;
+      typedef typename Ops::vector vector;
+      const int width = Ops::width;
+      if ((numA < width) || (numB < width)) {
+        mergeScalar<Ops>(a, a + numA, b, b + numB, out);
+        return;
+      }
+
+      vector low = Ops::load(a);
+      vector high = Ops::load(b);
+      network.mergeVectors(low, high);
+      Ops::store(out, low);
+      out += width;
+      long long posA = width;
+      long long posB = width;
+      //The loaded vector is the one reversed by the merge, out of the dependency chain through the merged vector
+      while ((posA + width <= numA) && (posB + width <= numB)) {
+        bool fromA = a[posA] < b[posB];
+        vector next = Ops::load(fromA ? a + posA : b + posB);
+        posA += fromA ? width : 0;
+        posB += fromA ? 0 : width;
+        network.mergeVectors(high, next);
+        Ops::store(out, high);
+        high = next;
+        out += width;
+      }
+
+      //The keys left in the merged vector, then in the shorter run, then in the longer one
+      value pending[width];
+      value merged[2 * width];
+      Ops::store(pending, high);
+      bool shortA = (numA - posA < width);
+      const value *shortRun = shortA ? a + posA : b + posB;
+      long long numShort = shortA ? numA - posA : numB - posB;
+      const value *longRun = shortA ? b + posB : a + posA;
+      long long numLong = shortA ? numB - posB : numA - posA;
+      value *mergedEnd = mergeScalar<Ops>(pending, pending + width, shortRun, shortRun + numShort, merged);
+      mergeScalar<Ops>(merged, mergedEnd, longRun, longRun + numLong, out);
+    }
+
+    //Merge passes over runs of runLength values doubling their length until all the values are sorted, between data and buffer
+    //Returns the array holding the sorted values, data or buffer
+    template<typename Ops>
+    typename Ops::value *mergePasses(const BitonicNetwork<Ops> &network, typename Ops::value *data, typename Ops::value *buffer,
+      long long numValues, long long runLength) {
+      typedef typename Ops::value value;
+      value *source = data;
+      value *dest = buffer;
+      for (; runLength < numValues; runLength *= 2) {
+        for (long long start = 0; start < numValues; start += 2 * runLength) {
+          long long middle = std::min(start + runLength, numValues);
+          long long end = std::min(start + 2 * runLength, numValues);
+          mergeRuns<Ops>(network, source + start, middle - start, source + middle, end - middle, dest + start);
+        }
+        value *merged = dest;
+        dest = source;
+        source = merged;
+      }
+      return source;
+    }
+
+    //Sort numValues values, using buffer of the same size
+    //Blocks small enough to stay in the cache are sorted first, then merged by passes over the whole arrays
+    //Returns the array holding the sorted values, data or buffer
+    template<typename Ops>
+    typename Ops::value *sortValues(typename Ops::value *data, typename Ops::value *buffer, long long numValues) {
+      typedef typename Ops::value value;
+      typedef typename Ops::vector vector;
+      const long long width = Ops::width;
+      const long long blockSize = (1 << 17) / sizeof(value);
+      BitonicNetwork<Ops> network;
+
+      for (long long blockStart = 0; blockStart < numValues; blockStart += blockSize) {
+        value *block = data + blockStart;
+        long long numBlockValues = std::min(blockSize, numValues - blockStart);
+
+        //Runs of two vectors sorted in registers, the last run sorted by insertion
+        long long numRuns = numBlockValues / (2 * width);
+        for (long long i = 0; i < numRuns; i++) {
+          value *run = block + 2 * width * i;
+          vector low = network.sortVector(Ops::load(run));
+          vector high = network.sortVector(Ops::load(run + width));
+          network.mergeVectors(low, high);
+          Ops::store(run, low);
+          Ops::store(run + width, high);
+        }
+        insertionSort<Ops>(block + 2 * width * numRuns, block + numBlockValues);
+
+        //The sorted blocks are all in data
+        value *sorted = mergePasses<Ops>(network, block, buffer + blockStart, numBlockValues, 2 * width);
+        if (sorted != block) std::memcpy(block, sorted, sizeof(value) * numBlockValues);
+      }
+
+      return mergePasses<Ops>(network, data, buffer, numValues, blockSize);
+    }
+
+  } //namespace EMS_SIMD_NAMESPACE
+} //namespace ems
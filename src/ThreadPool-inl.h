@@ -2,9 +2,71 @@
 
 namespace ems {
 
+  WorkStealingDeque::WorkStealingDeque(long long capacity) :
+    capacity_(1),
+    top_(0),
+    bottom_(0)
+  {
+    while (capacity_ < capacity) capacity_ <<= 1;
+    buffer_.reset(new std::atomic<PriorityTask *>[capacity_]);
+    for (long long i = 0; i < capacity_; i++) buffer_[i].store(nullptr, std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque::~WorkStealingDeque() {
+    while (PriorityTask *task = steal()) delete task;
+  }
+
+  bool WorkStealingDeque::push(PriorityTask *task) {
+    long long b = bottom_.load(std::memory_order_relaxed);
+    long long t = top_.load(std::memory_order_acquire);
+    if (b - t >= capacity_) return false;
+    buffer_[b & (capacity_ - 1)].store(task, std::memory_order_relaxed);
+    //Publish the element before the new bottom
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  PriorityTask *WorkStealingDeque::pop() {
+    long long b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    //Order the bottom update with the read of top, pairs with the fence in steal
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      //Empty, restore bottom
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    PriorityTask *task = buffer_[b & (capacity_ - 1)].load(std::memory_order_relaxed);
+    if (t == b) {
+      //Last element, race with the thieves
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) task = nullptr;
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  PriorityTask *WorkStealingDeque::steal() {
+    long long t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+
+    PriorityTask *task = buffer_[t & (capacity_ - 1)].load(std::memory_order_relaxed);
+    //Another thief or the owner took the element first
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+    return task;
+  }
+
   ThreadPool::ThreadPool() :
-    isHandlingTasks_(false),
+    numPendingTasks_(0),
+    numIdleWorkers_(0),
     stopWhenEmpty_(false),
+    isHandlingTasks_(false),
+    hasWorkerException_(false),
     profile_(false)
   {  
   }
@@ -14,11 +76,17 @@ namespace ems {
     stopHandlingTasks();
     join();
 
+    //The tasks left by the previous workers are handled by the new ones
+    flushWorkerTasks();
+
     if (numWorkers <= 0) return;
 
+    workerTasks_.clear();
+    for (int i = 0; i < numWorkers; i++) workerTasks_.emplace_back(new WorkStealingDeque());
+
     {
       //Acquire lock
-      std::lock_guard<std::mutex> lock(tasksMutex_);
+      std::lock_guard<std::mutex> lock(idleMutex_);
       stopWhenEmpty_ = stopWhenEmpty;
       isHandlingTasks_ = true;
       //Release lock
@@ -37,7 +105,7 @@ namespace ems {
     //Stop the threads if needed
     {
       // Acquire lock
-      std::lock_guard<std::mutex> lock(tasksMutex_);
+      std::lock_guard<std::mutex> lock(idleMutex_);
       if (isHandlingTasks_) isHandlingTasks_ = false;
       else return;
       //Release lock
@@ -46,6 +114,11 @@ namespace ems {
     //Notify all threads
     tasksCondition_.notify_all();
 
+    {
+      //Make sure the threads waiting for a completed task are either waiting or will see the change
+      std::lock_guard<std::mutex> lock(completedTasksMutex_);
+    }
+
     //Notify threads waiting for new completed task
     completedTasksCondition_.notify_all();
   }
@@ -61,8 +134,27 @@ namespace ems {
     if (!task) return;
 
     task->handlingThreadId = -1;
+    task->priority = priority;
 
     {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(task->dependencyMutex);
+      //The task may be handled again
+      task->isCompleted = false;
+      //Release lock
+    }
+
+    //Tasks added by a worker go to its own deque unless it is full
+    int workerId = currentWorkerId();
+    if (workerId >= 0) {
+      PriorityTask *workerTask = new PriorityTask(priority, task);
+      if (!workerTasks_[workerId]->push(workerTask)) {
+        delete workerTask;
+        workerId = -1;
+      }
+    }
+
+    if (workerId < 0) {
       //Acquire lock
       std::lock_guard<std::mutex> lock(tasksMutex_);
 
@@ -70,58 +162,104 @@ namespace ems {
       tasks_.emplace(priority,task);
 
       //Release lock
-    } 
+    }
+
+    //Count the task once it can be taken
+    numPendingTasks_++;
 
     //Notify the threads that a task has been added
-    tasksCondition_.notify_one();
+    notifyTaskAdded();
   }
 
-  std::shared_ptr<Task> ThreadPool::getTask(bool block, bool rethrowException) {
-    //Acquire lock
-    std::unique_lock<std::mutex> lock(tasksMutex_);
+  void ThreadPool::addTask(std::shared_ptr<Task> task, const std::vector<std::shared_ptr<Task>> &dependencies, int priority) {
+    if (!task) return;
 
-    while (block && tasks_.empty() && isHandlingTasks_) {
-      tasksCondition_.wait(lock);
-    }
+    task->handlingThreadId = -1;
+    task->priority = priority;
 
-    //If an exception occured in one of the thread, rethrow it or return null
-    if (workerException_ != nullptr) {
-      if (rethrowException) std::rethrow_exception(workerException_);
-      else return nullptr;
+    //Hold one dependency until all the dependencies are registered so that the task is not enqueued early
+    task->numDependencies = 1;
+    for (auto &dependency : dependencies) {
+      if (!dependency) continue;
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(dependency->dependencyMutex);
+      if (!dependency->isCompleted) {
+        task->numDependencies++;
+        dependency->continuations.push_back(task);
+      }
+      //Release lock
     }
 
-    if (tasks_.empty()) return nullptr;
+    if (--task->numDependencies == 0) addTask(task, priority);
+  }
 
-    std::shared_ptr<Task> res = tasks_.top().second;
-    tasks_.pop();
+  std::shared_ptr<Task> ThreadPool::getTask(bool block, bool rethrowException) {
+    int workerId = currentWorkerId();
+
+    while (true) {
+      //If an exception occured in one of the thread, rethrow it or return null
+      if (hasWorkerException_) {
+        std::exception_ptr exception = getThreadException();
+        if (rethrowException) std::rethrow_exception(exception);
+        else return nullptr;
+      }
 
-    return res;
+      PriorityTask *task = takeTask(workerId);
+      if (task) {
+        numPendingTasks_--;
+        std::shared_ptr<Task> res = task->second;
+        delete task;
+        return res;
+      }
 
-    //Release lock
+      //A task is being added or another thread won the race for the last one, try again
+      if (numPendingTasks_ > 0) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      if (!block || !isHandlingTasks_) return nullptr;
+
+      //Wait for a new task
+      numIdleWorkers_++;
+      {
+        //Acquire lock
+        std::unique_lock<std::mutex> lock(idleMutex_);
+        while ((numPendingTasks_ <= 0) && isHandlingTasks_ && !hasWorkerException_) {
+          tasksCondition_.wait(lock);
+        }
+        //Release lock
+      }
+      numIdleWorkers_--;
+    }
   }
 
   void ThreadPool::clearTasks() {
-    //Acquire lock
-    std::unique_lock<std::mutex> lock(tasksMutex_);
+    {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(tasksMutex_);
 
-    //Clear the tasks
-    tasks_ = {};
+      //Clear the tasks
+      numPendingTasks_ -= tasks_.size();
+      tasks_ = {};
 
-    // Stop the threads if stopWhenEmpty_ is true
-    if (stopWhenEmpty_) {
       //Release lock
-      lock.unlock();
+    }
 
-      //Stop the threads
-      stopHandlingTasks();
+    for (auto &workerTasks : workerTasks_) {
+      while (PriorityTask *task = workerTasks->steal()) {
+        numPendingTasks_--;
+        delete task;
+      }
     }
 
-    //Release lock
+    // Stop the threads if stopWhenEmpty_ is true
+    if (stopWhenEmpty_) stopHandlingTasks();
   }
 
   std::shared_ptr<Task> ThreadPool::getCompletedTask(bool block,bool rethrowException) {
     //Acquire lock
-    std::unique_lock<std::mutex> lock(tasksMutex_);
+    std::unique_lock<std::mutex> lock(completedTasksMutex_);
 
     while (block && completedTasks_.empty() && isHandlingTasks_) {
       completedTasksCondition_.wait(lock);
@@ -145,13 +283,18 @@ namespace ems {
 
   void ThreadPool::clearCompletedTasks() {
     //Acquire lock
-    std::lock_guard<std::mutex> lock(tasksMutex_);
+    std::lock_guard<std::mutex> lock(completedTasksMutex_);
 
     completedTasks_.clear();
 
     //Release lock
   }
 
+  void ThreadPool::addCompletedTask(std::shared_ptr<Task> task) {
+    if (!task) return;
+    completeTask(task);
+  }
+
   void ThreadPool::addTaskHandler(size_t typeHash, TaskHandler handler, int threadId) {
     //Acquire lock
     std::lock_guard<std::mutex> lock(taskHandlersMutex_);
@@ -224,11 +367,15 @@ namespace ems {
   }
 
   void ThreadPool::workerFunc(int threadId) {
+    //Tasks added by this thread go to its deque
+    currentPool() = this;
+    currentPoolWorkerId() = threadId;
+
     std::shared_ptr<Task> threadCurrentTask = nullptr;
     try {
       while (true) {
         //Get the next task
-        std::shared_ptr<Task> threadCurrentTask = getTask(!stopWhenEmpty_);
+        threadCurrentTask = getTask(!stopWhenEmpty_);
 
         //Stop the thread if we could not get a new task
         if (!threadCurrentTask) return;
@@ -255,20 +402,10 @@ namespace ems {
         }
         else threadCurrentTask->handlingThreadId = -1;
 
-        //Push the task to the list of completed tasks
-        {
-          //Acquire lock
-          std::lock_guard<std::mutex> lock(tasksMutex_);
-
-          completedTasks_.push_back(threadCurrentTask);
-          //Release lock
-        }
-
-        //Free the current task pointer
-        threadCurrentTask.reset();
-
-        //Notify threads waiting for new completed task
-        completedTasksCondition_.notify_one();
+        //Push the task to the list of completed tasks and enqueue the tasks waiting for it
+        std::shared_ptr<Task> completedTask;
+        completedTask.swap(threadCurrentTask);
+        completeTask(completedTask);
       }
     }
     catch (std::exception e) {
@@ -276,21 +413,127 @@ namespace ems {
       if (threadCurrentTask) addTask(threadCurrentTask);
 
       //Set the exception pointer
-      workerException_ = std::current_exception();
+      std::exception_ptr exception = std::current_exception();
+      {
+        //Acquire lock
+        std::lock_guard<std::mutex> lock(completedTasksMutex_);
+        workerException_ = exception;
+        hasWorkerException_ = true;
+        //Release lock
+      }
       
       bool rethrowException = true;
 
       //Run the custom exception handler if there is one
       if (threadExceptionHandler_) {
-        rethrowException = threadExceptionHandler_(threadId, workerException_);
+        rethrowException = threadExceptionHandler_(threadId, exception);
       }
 
       //Stop the threads
       stopHandlingTasks();
 
       //Rethrow the exception
-      if (rethrowException) std::rethrow_exception(workerException_);
+      if (rethrowException) std::rethrow_exception(exception);
     }
   }
 
+  void ThreadPool::completeTask(std::shared_ptr<Task> task) {
+    std::vector<std::shared_ptr<Task>> continuations;
+    {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(task->dependencyMutex);
+      task->isCompleted = true;
+      continuations.swap(task->continuations);
+      //Release lock
+    }
+
+    {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(completedTasksMutex_);
+
+      completedTasks_.push_back(task);
+
+      //Release lock
+    }
+
+    //Notify threads waiting for new completed task
+    completedTasksCondition_.notify_one();
+
+    //Enqueue the continuations whose last dependency was this task
+    for (auto &continuation : continuations) {
+      if (--continuation->numDependencies == 0) addTask(continuation, continuation->priority);
+    }
+  }
+
+  PriorityTask *ThreadPool::takeTask(int workerId) {
+    //Own tasks first, the most recent ones are the most likely to be in cache
+    if (workerId >= 0) {
+      PriorityTask *task = workerTasks_[workerId]->pop();
+      if (task) return task;
+    }
+
+    {
+      //Acquire lock
+      std::lock_guard<std::mutex> lock(tasksMutex_);
+      if (!tasks_.empty()) {
+        PriorityTask *task = new PriorityTask(tasks_.top());
+        tasks_.pop();
+        return task;
+      }
+      //Release lock
+    }
+
+    //Steal the oldest task of another worker, starting with the next one
+    int numDeques = static_cast<int>(workerTasks_.size());
+    for (int i = 1; i <= numDeques; i++) {
+      int victim = (workerId + i + numDeques) % numDeques;
+      if (victim == workerId) continue;
+      PriorityTask *task = workerTasks_[victim]->steal();
+      if (task) return task;
+    }
+
+    return nullptr;
+  }
+
+  void ThreadPool::flushWorkerTasks() {
+    //Acquire lock
+    std::lock_guard<std::mutex> lock(tasksMutex_);
+
+    for (auto &workerTasks : workerTasks_) {
+      while (PriorityTask *task = workerTasks->steal()) {
+        tasks_.push(*task);
+        delete task;
+      }
+    }
+
+    //Release lock
+  }
+
+  void ThreadPool::notifyTaskAdded() {
+    //A worker becoming idle after this check will see the new task before waiting
+    if (numIdleWorkers_ == 0) return;
+
+    {
+      //Make sure an idle worker is either waiting or will see the new task
+      std::lock_guard<std::mutex> lock(idleMutex_);
+    }
+    tasksCondition_.notify_one();
+  }
+
+  int ThreadPool::currentWorkerId() const {
+    if (currentPool() != this) return -1;
+    int workerId = currentPoolWorkerId();
+    return (workerId < static_cast<int>(workerTasks_.size())) ? workerId : -1;
+  }
+
+  const ThreadPool *&ThreadPool::currentPool() {
+    static thread_local const ThreadPool *pool = nullptr;
+    return pool;
+  }
+
+  int &ThreadPool::currentPoolWorkerId() {
+    static thread_local int workerId = -1;
+    return workerId;
+  }
+
 } //namespace ems
\ No newline at end of file
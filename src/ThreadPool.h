@@ -6,6 +6,7 @@
 
 #include <unordered_map>
 #include <queue>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -20,12 +21,41 @@ namespace ems {
 
   //Base polymorphic base struct for tasks
   struct Task {
-    Task() : handlingThreadId(-1) {};
+    Task() : handlingThreadId(-1), isCompleted(false), numDependencies(0), priority(0) {};
     virtual ~Task() {}; // for polymorphism
 
+    //Copies do not inherit the dependencies and continuations
+    Task(const Task &other) :
+      handlingThreadId(other.handlingThreadId),
+      startTime(other.startTime),
+      endTime(other.endTime),
+      isCompleted(false),
+      numDependencies(0),
+      priority(other.priority) {};
+
+    Task &operator=(const Task &other) {
+      handlingThreadId = other.handlingThreadId;
+      startTime = other.startTime;
+      endTime = other.endTime;
+      priority = other.priority;
+      return *this;
+    }
+
     int handlingThreadId;
     TimePoint startTime;
     TimePoint endTime;
+
+    //Dependency tracking, managed by ThreadPool
+    //Protects isCompleted and continuations
+    std::mutex dependencyMutex;
+    //Set once the task has been handled, continuations added later do not wait for it
+    bool isCompleted;
+    //Tasks to enqueue when this one is completed, once all their dependencies are completed
+    std::vector<std::shared_ptr<Task>> continuations;
+    //Number of dependencies not completed yet
+    std::atomic<int> numDependencies;
+    //Priority used when the task is enqueued
+    int priority;
   };
 
   typedef std::pair<int, std::shared_ptr<Task>> PriorityTask;
@@ -34,6 +64,51 @@ namespace ems {
     return p1.first < p2.first;
   }
 
+  //Bounded lock-free work-stealing deque (Chase-Lev)
+  //Only the owner thread pushes and pops at the bottom, any thread can steal from the top
+  //The deque holds owning raw pointers, whoever gets a pointer out of it must delete it
+  class WorkStealingDeque
+  {
+  public:
+    explicit WorkStealingDeque(long long capacity = 1024);
+
+    //Delete the remaining elements
+    ~WorkStealingDeque();
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    //Push an element at the bottom, owner thread only
+    //Returns false if the deque is full
+    bool push(PriorityTask *task);
+
+    //Pop the most recently pushed element, owner thread only
+    //Returns null if the deque is empty
+    PriorityTask *pop();
+
+    //Steal the oldest element, any thread
+    //Returns null if the deque is empty or if another thread won the race for the element
+    PriorityTask *steal();
+
+    //Is the deque empty? The result may be outdated as soon as it is returned
+    inline bool empty() const {
+      return bottom_.load(std::memory_order_acquire) <= top_.load(std::memory_order_acquire);
+    }
+
+  private:
+    //Capacity of the ring buffer (power of two)
+    long long capacity_;
+
+    //Ring buffer of elements
+    std::unique_ptr<std::atomic<PriorityTask *>[]> buffer_;
+
+    //Index of the oldest element, incremented by the thieves
+    std::atomic<long long> top_;
+
+    //Index after the newest element, only written by the owner
+    std::atomic<long long> bottom_;
+  };
+
   typedef std::function<void(int, Task *)> TaskHandler;
   typedef std::function<bool(int, std::exception_ptr)> ThreadExceptionHandler;
 
@@ -55,9 +130,19 @@ namespace ems {
     void join();
 
     //Enqueue a task for processing
+    //Tasks added from outside the workers go to a shared queue ordered by priority
+    //Tasks added by a worker go to its own deque, it runs them last in first out while idle workers steal them
+    //first in first out, their priority is only a hint used when they are moved back to the shared queue
     void addTask(std::shared_ptr<Task> task, int priority=0);
 
+    //Enqueue a task once all its dependencies are completed
+    //The task is enqueued by the thread completing the last dependency, from a worker it goes to its deque
+    //Dependencies which are already completed are ignored, the others must be enqueued or be completed with
+    //addCompletedTask, otherwise the task never runs
+    void addTask(std::shared_ptr<Task> task, const std::vector<std::shared_ptr<Task>> &dependencies, int priority=0);
+
     //Get a task and remove it from the queue
+    //Workers take from their own deque first, then from the shared queue and finally steal from the other workers
     //If block is true and the task queue is empty the thread will block
     //until a new task is added or stopHandlingTasks is called
     //If block is false the function will return immediately
@@ -79,6 +164,10 @@ namespace ems {
     //Clear all completed tasks
     void clearCompletedTasks();
 
+    //Push a task directly to the completed task queue and enqueue the tasks depending on it
+    //Used by handlers which complete several tasks while handling a single one
+    void addCompletedTask(std::shared_ptr<Task> task);
+
     //Add a handler for a task type described by its type_info hashcode and a specific thread
     //If no handler exists for this task type or if threadId is -1, set this handler as default
     void addTaskHandler(size_t typeHash, TaskHandler handler, int threadId = -1);
@@ -113,6 +202,7 @@ namespace ems {
 
     //Get the latest exception thorwn by the worker threads
     inline std::exception_ptr getThreadException() {
+      std::lock_guard<std::mutex> lock(completedTasksMutex_);
       return workerException_;
     }
 
@@ -147,18 +237,34 @@ namespace ems {
     //Worker threads
     std::vector<std::thread> workers_;
 
-    //Queue of tasks to be processed
+    //Shared queue of tasks added from outside the workers
     std::priority_queue<PriorityTask> tasks_;
 
-    //Queue of completed tasks
-    std::deque<std::shared_ptr<Task>> completedTasks_;
-
-    //Mutex for accessing the tasks
+    //Mutex for accessing the shared queue
     std::mutex tasksMutex_;
 
+    //Deque of the tasks added by each worker
+    std::vector<std::unique_ptr<WorkStealingDeque>> workerTasks_;
+
+    //Number of tasks in the shared queue and the deques
+    //Transiently negative when a task is taken before its addition is counted
+    std::atomic<long long> numPendingTasks_;
+
+    //Number of workers waiting for a new task
+    std::atomic<int> numIdleWorkers_;
+
+    //Mutex for waiting for new tasks
+    std::mutex idleMutex_;
+
     //Condition variable to notify threads when new tasks have been added or when task handling has been terminated
     std::condition_variable tasksCondition_;
 
+    //Queue of completed tasks
+    std::deque<std::shared_ptr<Task>> completedTasks_;
+
+    //Mutex for accessing the completed tasks and workerException_
+    std::mutex completedTasksMutex_;
+
     //Condition variable to notify threads when new task has been completed or when task handling has been terminated
     std::condition_variable completedTasksCondition_;
 
@@ -174,8 +280,11 @@ namespace ems {
     //Indicates when the threads are active
     std::atomic<bool> isHandlingTasks_;
 
-    //keep track of exceptions occuring in threads
-    std::atomic<std::exception_ptr> workerException_;
+    //keep track of exceptions occuring in threads (protected by completedTasksMutex_)
+    std::exception_ptr workerException_;
+
+    //Set when workerException_ is set, checked without locking
+    std::atomic<bool> hasWorkerException_;
 
     //Custom exception handler for the threads
     ThreadExceptionHandler threadExceptionHandler_;
@@ -191,6 +300,26 @@ namespace ems {
 
     //Function called by individual worker threads
     void workerFunc(int threadId);
+
+    //Mark a task as completed, push it to the completed tasks and enqueue its ready continuations
+    void completeTask(std::shared_ptr<Task> task);
+
+    //Take a pending task: own deque, shared queue, then the other deques
+    //workerId is -1 when not called from a worker of this pool
+    PriorityTask *takeTask(int workerId);
+
+    //Move the tasks left in the deques to the shared queue
+    void flushWorkerTasks();
+
+    //Notify the idle workers after a task has been added
+    void notifyTaskAdded();
+
+    //Id of the worker of this pool running on the calling thread, -1 if there is none
+    int currentWorkerId() const;
+
+    //Pool and worker id of the calling thread
+    static const ThreadPool *&currentPool();
+    static int &currentPoolWorkerId();
   };
 
 } //namespace ems
@@ -4,83 +4,79 @@
 #include <random>
 #include <limits>
 #include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <algorithm>
 #include <iostream>
+#include <future>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif //_WIN32
 
 namespace ems {
 
   template<typename key>
   bool createRandomFile(std::string fileName, long long numValues, long long chunkSize) {
-    if ((numValues <= 0) || (chunkSize <= 0) || (fileName.empty())) return false;
-    
-    std::fstream outFile;
-
-    //Random number generation
-    double minDouble = std::numeric_limits<double>::min();
-    double minKey = static_cast<double>(std::numeric_limits<key>::min());
-    double distMin = std::max(minDouble, minKey);
-    double maxDouble = std::numeric_limits<double>::max();
-    double maxKey = static_cast<double>(std::numeric_limits<key>::max());
-    double distMax = std::min(maxDouble, maxKey);
-    std::uniform_real_distribution<double> dist(distMin, distMax);
     std::random_device rd;
+    KeyGeneratorOptions options;
+    options.seed = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+    options.chunkSize = chunkSize;
+    return createRandomFile<key>(fileName, numValues, options);
+  }
 
-    //Write dataSize random integer values
-    outFile.open(fileName, std::ios::out | std::ios::binary);
-    if (!outFile.is_open()) return false;
-
-    long long numChunks = numValues / chunkSize;
-    long long lastChunkSize = numValues % chunkSize;
-    if (lastChunkSize != 0) numChunks++;
-    else lastChunkSize = chunkSize;
-
-    std::vector<key> chunk(chunkSize);
-
-    for (long long i = 0; i < numChunks ; i++) {
-      long long currentChunkSize = (i == (numChunks - 1)) ? lastChunkSize : chunkSize;
-      for (int i = 0; i < currentChunkSize; i++) chunk[i] = static_cast<key>(dist(rd));
-      outFile.write(reinterpret_cast<char *>(&chunk[0]), sizeof(key) * currentChunkSize);
-      if (outFile.fail()) {
-        remove(fileName.c_str());
-        return false;
+  template<typename key>
+  bool createRandomFile(std::string fileName, long long numValues, const KeyGeneratorOptions &options) {
+    if ((numValues <= 0) || (options.chunkSize <= 0) || (fileName.empty())) return false;
+
+    File outFile;
+    if (!outFile.open(fileName, File::Write)) return false;
+
+    //Each thread generates and writes every numThreads-th chunk
+    long long numChunks = (numValues + options.chunkSize - 1) / options.chunkSize;
+    int numThreads = options.numThreads;
+    if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = static_cast<int>(std::min<long long>(numThreads, numChunks));
+
+    auto generateChunks = [&](int threadId) {
+      std::vector<key> chunk(std::min(options.chunkSize, numValues));
+      for (long long i = threadId; i < numChunks; i += numThreads) {
+        long long first = i * options.chunkSize;
+        long long numKeys = std::min(options.chunkSize, numValues - first);
+        generateKeys(chunk.data(), first, numKeys, numValues, options);
+        outFile.write(chunk.data(), sizeof(key)*numKeys, sizeof(key)*first);
+      }
+    };
+    std::vector<std::future<void>> pendingChunks;
+    for (int t = 0; t < numThreads; t++) pendingChunks.push_back(std::async(std::launch::async, generateChunks, t));
+
+    bool success = true;
+    for (auto &pendingChunk : pendingChunks) {
+      try {
+        pendingChunk.get();
+      }
+      catch (std::ios_base::failure &) {
+        success = false;
       }
     }
-
-    return true;
-
+    outFile.close();
+    if (!success) remove(fileName.c_str());
+    return success;
   }
 
   template<typename key>
   bool checkSortedFile(std::string fileName) {
-    std::fstream inFile;
-    inFile.open(fileName, std::ios::in | std::ios::binary);
-    if (!inFile.is_open()) return false;
-
-    //Get the size of the input file
-    inFile.seekg(0, std::ios::end);
-    long long dataLength = inFile.tellg();
-    inFile.seekg(0, std::ios::beg);
-
-    //Check that the file is of the right size
-    if (dataLength % sizeof(key)) return false;
-
-    long long numValues = dataLength / sizeof(key);
+    FileSummary summary;
+    try {
+      summary = summarizeFile<key>(fileName);
+    }
+    catch (std::ios_base::failure &) {
+      return false;
+    }
 
     //File must contain at least one value
-    if (numValues == 0) return false;
-
-    key val;
-    key previousVal = std::numeric_limits<key>::min();
-
-    for (long long i = 0; i < numValues; i++) {
-      //Read the value and compare it to the previous
-      inFile.read(reinterpret_cast<char *>(&val), sizeof(key));
-      if (inFile.fail()) return false;
-      if (val < previousVal) return false;
-      previousVal = val;
-    }
-    return true;
+    return (summary.numValues > 0) && summary.sorted;
   }
 
   std::string findAvailableFileName(std::string desiredFileName, int &appendNumber) {
@@ -110,6 +106,55 @@ namespace ems {
     return testFileName;
   }
 
+  //With cgroup v2 the limits are in the memory.max files of the cgroup directory and its parents ("max" if none),
+  //with cgroup v1 in memory.limit_in_bytes of the memory controller directory (a huge value if none)
+  inline long long processMemoryLimit() {
+    auto readLimit = [](const std::string &fileName) -> long long {
+      std::ifstream file(fileName);
+      std::string value;
+      if (!(file >> value) || (value == "max")) return 0;
+      long long limit = std::strtoll(value.c_str(), nullptr, 10);
+      return ((limit > 0) && (limit < (1LL << 60))) ? limit : 0;
+    };
+
+    long long limit = 0;
+#ifndef _WIN32
+    long long numPages = sysconf(_SC_PHYS_PAGES);
+    long long pageSize = sysconf(_SC_PAGESIZE);
+    if ((numPages > 0) && (pageSize > 0)) limit = numPages * pageSize;
+#endif //_WIN32
+    std::ifstream cgroupFile("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cgroupFile, line)) {
+      //Lines are hierarchy-id:controllers:path, the v2 hierarchy has no controllers
+      size_t first = line.find(':');
+      size_t second = (first == std::string::npos) ? first : line.find(':', first + 1);
+      if (second == std::string::npos) continue;
+      std::string controllers = line.substr(first + 1, second - first - 1);
+      std::string path = line.substr(second + 1);
+      std::string root, limitFile;
+      if (controllers.empty()) {
+        root = "/sys/fs/cgroup";
+        limitFile = "/memory.max";
+      }
+      else if ((',' + controllers + ',').find(",memory,") != std::string::npos) {
+        root = "/sys/fs/cgroup/memory";
+        limitFile = "/memory.limit_in_bytes";
+      }
+      else continue;
+
+      //The smallest limit of the cgroup and its parents applies
+      while (true) {
+        long long pathLimit = readLimit(root + ((path == "/") ? "" : path) + limitFile);
+        if (pathLimit && (!limit || (pathLimit < limit))) limit = pathLimit;
+        if (path.empty() || (path == "/")) break;
+        size_t parent = path.rfind('/');
+        path = parent ? path.substr(0, parent) : "/";
+      }
+    }
+    return limit;
+  }
+
   void writeProfilingFile(std::string profilingFileName, int numThreads, TimePoint startTime, TimePoint endTime, const std::vector<std::shared_ptr<Task>> &completedTasks) {
     std::fstream profilingFile;
     profilingFile.open(profilingFileName,std::ios_base::out);
@@ -3,16 +3,25 @@
 #pragma once
 
 #include "ThreadPool.h"
+#include "FileIo.h"
+#include "VerifyFile.h"
+#include "KeyGenerator.h"
 
 #include <string>
 
 namespace ems {
 
-  //Create a random file of keys, generating and writing the integers by chunks
+  //Create a file of uniform random keys with a random seed, generating and writing the keys by chunks
   template<typename key>
   bool createRandomFile(std::string fileName, long long numValues, long long chunkSize = 10000);
 
-  //Check if a file contains sorted keys
+  //Create a file of keys generated with the given options (see KeyGeneratorOptions)
+  //The chunks are generated and written in parallel, the file only depends on the seed, chunk size and distribution
+  template<typename key>
+  bool createRandomFile(std::string fileName, long long numValues, const KeyGeneratorOptions &options);
+
+  //Check if a file contains sorted keys, with all the hardware threads (see summarizeFile)
+  //Returns false if the file is empty or cannot be read
   template<typename key>
   bool checkSortedFile(std::string fileName);
 
@@ -33,6 +42,11 @@ namespace ems {
     return findAvailableFileName(desiredFileName, appendNumber);
   }
 
+  //Memory available to the process in bytes: the smallest of the physical memory and of the memory limits
+  //of the cgroup of the process and of its parent cgroups (cgroup v2 or v1)
+  //Returns 0 if none of them can be read
+  long long processMemoryLimit();
+
   //Write a file containing the profiling information for a list of tasks completed by a thread pool
   //All durations are written in nanoseconds
   //The first line contains the number of threads and total duration (endTime - startTime)
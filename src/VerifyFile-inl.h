@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include <future>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include <ios>
+
+namespace ems {
+
+  template<typename key>
+  uint64_t keyHash(const key &k) {
+    //The bytes are taken by words of 8 bytes, each word is mixed with the splitmix64 finalizer
+    //The increment keeps the hash of a zero word from being zero, so the number of zero keys counts
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&k);
+    uint64_t h = 0;
+    for (size_t pos = 0; pos < sizeof(key); pos += sizeof(uint64_t)) {
+      uint64_t word = 0;
+      std::memcpy(&word, bytes + pos, std::min(sizeof(uint64_t), sizeof(key) - pos));
+      uint64_t z = (h ^ word) + 0x9e3779b97f4a7c15ULL;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      h = z ^ (z >> 31);
+    }
+    return h;
+  }
+
+  //Keys of a range of a file as seen by a verification thread
+  template<typename key>
+  struct RangeSummary {
+    FileSummary summary;
+    key first;
+    key last;
+  };
+
+  //Read the keys [start, end) of the file by blocks, counting the descents and summing the hashes of the keys
+  template<typename key>
+  RangeSummary<key> summarizeRange(File &file, long long start, long long end) {
+    RangeSummary<key> range;
+    range.summary.numValues = end - start;
+    if (start == end) return range;
+
+    std::vector<key> block(std::min(std::max<long long>(1, verifyBlockBytes / sizeof(key)), end - start));
+    long long numDescents = 0;
+    uint64_t hash = 0;
+    for (long long pos = start; pos < end; pos += block.size()) {
+      long long numKeys = std::min<long long>(block.size(), end - pos);
+      file.read(block.data(), sizeof(key)*numKeys, sizeof(key)*pos);
+      const key *keys = block.data();
+
+      //The previous block is only compared through its last key
+      if (pos == start) range.first = keys[0];
+      else numDescents += KeyOrder<key>::less(keys[0], range.last);
+
+      //No branch on the keys, the loops can be vectorized by the compiler
+      for (long long i = 1; i < numKeys; i++) numDescents += KeyOrder<key>::less(keys[i], keys[i - 1]);
+      for (long long i = 0; i < numKeys; i++) hash += keyHash(keys[i]);
+      range.last = keys[numKeys - 1];
+    }
+    range.summary.sorted = (numDescents == 0);
+    range.summary.hash = hash;
+    return range;
+  }
+
+  template<typename key>
+  FileSummary summarizeFile(const std::string &fileName, int numThreads) {
+    File file;
+    if (!file.open(fileName, File::Read)) throw std::ios_base::failure("Could not open file " + fileName);
+    long long dataLength = file.size();
+    if (dataLength % sizeof(key)) throw std::ios_base::failure("Size of file " + fileName + " is not a multiple of the key size");
+    long long numValues = dataLength / sizeof(key);
+
+    //At least a block per thread
+    if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    long long blockKeys = std::max<long long>(1, verifyBlockBytes / sizeof(key));
+    long long numRanges = std::max(1LL, std::min<long long>(numThreads, (numValues + blockKeys - 1) / blockKeys));
+
+    //The positional reads let all the threads share the file
+    std::vector<std::future<RangeSummary<key>>> pendingRanges;
+    for (long long i = 0; i < numRanges; i++) {
+      long long start = numValues * i / numRanges;
+      long long end = numValues * (i + 1) / numRanges;
+      pendingRanges.push_back(std::async(std::launch::async, [&file, start, end]() { return summarizeRange<key>(file, start, end); }));
+    }
+
+    //Join the ranges, the last key of a range must not be greater than the first key of the next one
+    FileSummary summary;
+    bool hasLast = false;
+    key last = key();
+    for (auto &pendingRange : pendingRanges) {
+      RangeSummary<key> range = pendingRange.get();
+      if (!range.summary.numValues) continue;
+      summary.numValues += range.summary.numValues;
+      summary.sorted = summary.sorted && range.summary.sorted && !(hasLast && KeyOrder<key>::less(range.first, last));
+      summary.hash += range.summary.hash;
+      last = range.last;
+      hasLast = true;
+    }
+    return summary;
+  }
+
+  template<typename key>
+  bool verifySortedFile(const std::string &sortedFileName, const std::string &inputFileName, int numThreads) {
+    FileSummary sortedSummary = summarizeFile<key>(sortedFileName, numThreads);
+    FileSummary inputSummary = summarizeFile<key>(inputFileName, numThreads);
+    return sortedSummary.sorted && (sortedSummary.numValues == inputSummary.numValues) && (sortedSummary.hash == inputSummary.hash);
+  }
+
+} //namespace ems
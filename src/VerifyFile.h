@@ -0,0 +1,48 @@
+//Verification of the files written by a sort
+//The file is split in one range per thread, each thread reads its range by blocks with positional reads,
+//counts the descents between consecutive keys and sums a hash of every key. The ranges are then joined by
+//checking the keys at their boundaries. The sum of the key hashes does not depend on the order of the keys,
+//so comparing the hashes of the input and output files checks that the output is a permutation of the input.
+
+#pragma once
+
+#include "FileIo.h"
+#include "KeyOrder.h"
+
+#include <string>
+#include <cstdint>
+
+namespace ems {
+
+  //Size in bytes of the blocks read by the verification threads
+  const long long verifyBlockBytes = 1 << 20;
+
+  //Keys of a file as seen by summarizeFile
+  struct FileSummary {
+    FileSummary() : numValues(0), sorted(true), hash(0) {}
+
+    long long numValues;
+    //Is no key lower than the one before it in KeyOrder? NaNs come after all other keys, as placed by the sorts
+    bool sorted;
+    //Hash of the multiset of keys: sum of the hashes of the keys, independent of their order
+    uint64_t hash;
+  };
+
+  //Hash of the bytes of a key, mixed so that sums of hashes of different multisets of keys differ
+  //NaNs of different signs or payloads have different hashes, the sorts preserve their bits
+  template<typename key>
+  uint64_t keyHash(const key &k);
+
+  //Check the order and hash the keys of a file with numThreads threads (the hardware concurrency if not positive)
+  //Throws std::ios_base::failure if the file cannot be read or if its size is not a multiple of the key size
+  template<typename key>
+  FileSummary summarizeFile(const std::string &fileName, int numThreads = 0);
+
+  //Check that the keys of sortedFileName are sorted and are a permutation of the keys of inputFileName
+  //Throws std::ios_base::failure as summarizeFile
+  template<typename key>
+  bool verifySortedFile(const std::string &sortedFileName, const std::string &inputFileName, int numThreads = 0);
+
+} //namespace ems
+
+#include "VerifyFile-inl.h"
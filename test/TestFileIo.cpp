@@ -0,0 +1,240 @@
+// Test File positional reads and writes, including concurrent reads by several threads
+
+#include "Util.h"
+#include "FileIo.h"
+
+#include <vector>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <ios>
+
+bool fileIoTest() {
+  std::string fileName = ems::findAvailableFileName("testfileio");
+  if (fileName.empty()) return false;
+
+  const long long numValues = 100000;
+  const int numThreads = 8;
+
+  std::vector<long long> values(numValues);
+  for (long long i = 0; i < numValues; i++) values[i] = i;
+
+  ems::File file;
+  if (!file.open(fileName, ems::File::Write)) return false;
+
+  //Write the second half first to check that positional writes do not depend on a file pointer
+  long long half = numValues / 2;
+  file.write(&values[half], sizeof(long long)*(numValues - half), sizeof(long long)*half);
+  file.write(&values[0], sizeof(long long)*half, 0);
+  file.close();
+
+  if (!file.open(fileName, ems::File::Read)) {
+    remove(fileName.c_str());
+    return false;
+  }
+  if (file.size() != static_cast<long long>(sizeof(long long))*numValues) {
+    file.close();
+    remove(fileName.c_str());
+    return false;
+  }
+
+  //Each thread reads interleaved blocks of the file
+  std::atomic<bool> valid(true);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      const long long blockSize = 1000;
+      std::vector<long long> block(blockSize);
+      for (long long start = t*blockSize; start < numValues; start += numThreads*blockSize) {
+        long long numRead = std::min(blockSize, numValues - start);
+        file.read(&block[0], sizeof(long long)*numRead, sizeof(long long)*start);
+        for (long long i = 0; i < numRead; i++) {
+          if (block[i] != start + i) valid = false;
+        }
+      }
+    }));
+  }
+  for (auto &thread : threads) thread.join();
+
+  //Reading past the end of the file must throw
+  bool thrown = false;
+  try {
+    long long val;
+    file.read(&val, sizeof(long long), sizeof(long long)*numValues);
+  }
+  catch (std::ios_base::failure &) {
+    thrown = true;
+  }
+
+  file.close();
+  remove(fileName.c_str());
+
+  return valid && thrown;
+}
+
+//Write a file through a writable mapping and read it back through a mapping at an unaligned offset
+bool mappedFileTest() {
+  if (!ems::MappedFile::isSupported()) return true;
+
+  std::string fileName = ems::findAvailableFileName("testfileio");
+  if (fileName.empty()) return false;
+
+  const long long numValues = 100000;
+  bool valid = true;
+  try {
+    ems::File file;
+    if (!file.open(fileName, ems::File::Read | ems::File::Write)) return false;
+    file.resize(sizeof(long long)*numValues);
+
+    ems::MappedFile mapping;
+    mapping.map(file, 0, sizeof(long long)*numValues, true);
+    long long *values = static_cast<long long *>(mapping.data());
+    for (long long i = 0; i < numValues; i++) values[i] = i;
+    mapping.unmap();
+    file.close();
+
+    if (!file.open(fileName, ems::File::Read) || (file.size() != static_cast<long long>(sizeof(long long))*numValues)) valid = false;
+    else {
+      long long start = 12345;
+      mapping.map(file, sizeof(long long)*start, sizeof(long long)*(numValues - start), false);
+      const long long *mappedValues = static_cast<const long long *>(mapping.data());
+      for (long long i = 0; i < numValues - start; i++) {
+        if (mappedValues[i] != start + i) valid = false;
+      }
+      mapping.unmap();
+      file.close();
+    }
+  }
+  catch (...) {
+    valid = false;
+  }
+
+  remove(fileName.c_str());
+  return valid;
+}
+
+//Write and read a file in Direct mode with aligned and unaligned heads and tails
+//The buffers mirror the file from an aligned address so that the accesses can bypass the page cache
+bool directFileTest() {
+  std::string fileName = ems::findAvailableFileName("testfileio");
+  if (fileName.empty()) return false;
+
+  //Not a multiple of the alignment so that the file has an unaligned tail
+  const long long numValues = 100001;
+  const long long alignmentValues = ems::directIoAlignment / sizeof(long long);
+  std::vector<long long> written(numValues + alignmentValues);
+  std::vector<long long> read(numValues + alignmentValues);
+  auto align = [&](std::vector<long long> &vec) {
+    long long *data = vec.data();
+    while (reinterpret_cast<uintptr_t>(data) % ems::directIoAlignment) data++;
+    return data;
+  };
+  long long *values = align(written);
+  long long *readValues = align(read);
+
+  bool valid = true;
+  try {
+    ems::File file;
+    if (!file.open(fileName, ems::File::Write | ems::File::Direct)) return false;
+    for (long long i = 0; i < numValues; i++) values[i] = i;
+    file.write(values, sizeof(long long)*numValues, 0);
+
+    //Overwrite a range with unaligned start and end, then a few keys with an unaligned buffer
+    long long start = 777;
+    long long end = 60001;
+    for (long long i = start; i < end; i++) values[i] = -i;
+    file.write(values + start, sizeof(long long)*(end - start), sizeof(long long)*start);
+    std::vector<long long> few(3, -1);
+    for (long long i = 0; i < 3; i++) values[end + i] = -1;
+    file.write(&few[0], sizeof(long long)*3, sizeof(long long)*end);
+    file.close();
+
+    if (!file.open(fileName, ems::File::Read | ems::File::Direct) || (file.size() != static_cast<long long>(sizeof(long long))*numValues)) valid = false;
+    else {
+      //Whole file, then a range with unaligned start and end
+      file.read(readValues, sizeof(long long)*numValues, 0);
+      for (long long i = 0; i < numValues; i++) {
+        if (readValues[i] != values[i]) valid = false;
+      }
+      for (long long i = 0; i < numValues; i++) readValues[i] = 0;
+      start = 12345;
+      end = numValues - 1;
+      file.read(readValues + start, sizeof(long long)*(end - start), sizeof(long long)*start);
+      for (long long i = start; i < end; i++) {
+        if (readValues[i] != values[i]) valid = false;
+      }
+      file.close();
+    }
+  }
+  catch (...) {
+    valid = false;
+  }
+
+  remove(fileName.c_str());
+  return valid;
+}
+
+//Copy ranges of a file to another file, including past its end and in several pieces
+bool copyFileTest() {
+  int fileId = 0;
+  std::string sourceName = ems::findAvailableFileName("testfileio", fileId);
+  fileId++;
+  std::string copyName = ems::findAvailableFileName("testfileio", fileId);
+  if (sourceName.empty() || copyName.empty()) return false;
+
+  const long long numValues = 300001;
+  std::vector<long long> values(numValues);
+  for (long long i = 0; i < numValues; i++) values[i] = i;
+
+  bool valid = true;
+  try {
+    ems::File source;
+    ems::File copy;
+    if (!source.open(sourceName, ems::File::Read | ems::File::Write) || !copy.open(copyName, ems::File::Read | ems::File::Write)) valid = false;
+    else {
+      source.write(&values[0], sizeof(long long)*numValues, 0);
+
+      //The second half of the source goes first, then the first half
+      long long half = numValues / 2;
+      copy.copyFrom(source, sizeof(long long)*(numValues - half), sizeof(long long)*half, 0);
+      copy.copyFrom(source, sizeof(long long)*half, 0, sizeof(long long)*(numValues - half));
+      if (copy.size() != static_cast<long long>(sizeof(long long))*numValues) valid = false;
+      std::vector<long long> copied(numValues);
+      copy.read(&copied[0], sizeof(long long)*numValues, 0);
+      for (long long i = 0; i < numValues; i++) {
+        if (copied[i] != values[(i + half) % numValues]) valid = false;
+      }
+
+      //Copying past the end of the source must throw
+      bool thrown = false;
+      try {
+        copy.copyFrom(source, sizeof(long long) * 2, sizeof(long long)*(numValues - 1), 0);
+      }
+      catch (std::ios_base::failure &) {
+        thrown = true;
+      }
+      if (!thrown) valid = false;
+    }
+  }
+  catch (...) {
+    valid = false;
+  }
+
+  remove(sourceName.c_str());
+  remove(copyName.c_str());
+  return valid;
+}
+
+int main(int argc, char** argv)
+{
+  if (!fileIoTest()) return 1;
+
+  if (!mappedFileTest()) return 1;
+
+  if (!directFileTest()) return 1;
+
+  if (!copyFileTest()) return 1;
+
+  return 0;
+}
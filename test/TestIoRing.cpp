@@ -0,0 +1,72 @@
+// Test IoRing reads and writes split in several requests, skipped if io_uring is not available
+
+#include "Util.h"
+#include "IoRing.h"
+
+#include <vector>
+#include <cstdio>
+#include <ios>
+
+//Write a file with many operations in flight and read it back in blocks with a small queue depth
+bool ioRingTest(unsigned queueDepth, long long requestSize) {
+  ems::IoRing ring;
+  if (!ring.init(queueDepth, requestSize)) return true;
+
+  std::string fileName = ems::findAvailableFileName("testioring");
+  if (fileName.empty()) return false;
+
+  const long long numValues = 1000000;
+  const long long blockSize = 100000;
+  std::vector<long long> values(numValues);
+  for (long long i = 0; i < numValues; i++) values[i] = i;
+
+  bool valid = true;
+  try {
+    ems::File file;
+    if (!file.open(fileName, ems::File::Read | ems::File::Write)) return false;
+
+    //One operation per block, written in reverse order
+    for (long long start = numValues - blockSize; start >= 0; start -= blockSize) {
+      ring.write(file, &values[start], sizeof(long long)*blockSize, sizeof(long long)*start, start / blockSize);
+    }
+    ring.waitAll();
+    if (file.size() != static_cast<long long>(sizeof(long long))*numValues) valid = false;
+
+    //Read the blocks, waiting for them in a different order than the submission
+    std::vector<long long> readValues(numValues, -1);
+    for (long long start = 0; start < numValues; start += blockSize) {
+      ring.read(file, &readValues[start], sizeof(long long)*blockSize, sizeof(long long)*start, start / blockSize);
+    }
+    ring.submit();
+    for (long long block = numValues / blockSize - 1; block >= 0; block--) ring.wait(block);
+    if (readValues != values) valid = false;
+
+    //Reading past the end of the file must throw
+    bool thrown = false;
+    long long val;
+    ring.read(file, &val, sizeof(long long), sizeof(long long)*numValues, 0);
+    try {
+      ring.wait(0);
+    }
+    catch (std::ios_base::failure &) {
+      thrown = true;
+    }
+    if (!thrown) valid = false;
+    file.close();
+  }
+  catch (...) {
+    valid = false;
+  }
+
+  remove(fileName.c_str());
+  return valid;
+}
+
+int main(int argc, char** argv)
+{
+  if (!ioRingTest(32, 1 << 20)) return 1;
+  if (!ioRingTest(4, 4096)) return 1;
+  if (!ioRingTest(1, 1 << 16)) return 1;
+
+  return 0;
+}
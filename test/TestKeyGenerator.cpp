@@ -0,0 +1,140 @@
+// Test the key generator: reproducible keys whatever the threads and the generated ranges, shape of the distributions
+
+#include "Util.h"
+#include "KeyGenerator.h"
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+
+//Generate the keys in a file and read them back
+template<typename key>
+bool generateFile(long long numValues, const ems::KeyGeneratorOptions &options, std::vector<key> &values) {
+  std::string fileName = ems::findAvailableFileName("testkeygenerator");
+  if (fileName.empty() || !ems::createRandomFile<key>(fileName, numValues, options)) return false;
+  ems::File file;
+  if (!file.open(fileName, ems::File::Read) || (file.size() != static_cast<long long>(sizeof(key))*numValues)) {
+    remove(fileName.c_str());
+    return false;
+  }
+  values.resize(numValues);
+  file.read(values.data(), sizeof(key)*numValues, 0);
+  file.close();
+  remove(fileName.c_str());
+  return true;
+}
+
+//Number of keys lower than the previous one
+template<typename key>
+long long numDescents(const std::vector<key> &values) {
+  long long descents = 0;
+  for (size_t i = 1; i < values.size(); i++) descents += (values[i] < values[i - 1]);
+  return descents;
+}
+
+//The same seed gives the same keys with any number of threads or generated range, another seed other keys
+template<typename key>
+bool testReproducible(ems::KeyDistribution distribution) {
+  const long long numValues = 10000;
+  ems::KeyGeneratorOptions options;
+  options.distribution = distribution;
+  options.seed = 42;
+  options.chunkSize = 1000;
+  options.numThreads = 1;
+  std::vector<key> values;
+  if (!generateFile<key>(numValues, options, values)) return false;
+
+  options.numThreads = 3;
+  std::vector<key> parallelValues;
+  if (!generateFile<key>(numValues, options, parallelValues) || (parallelValues != values)) return false;
+
+  std::vector<key> rangeValues(numValues - 2000);
+  ems::generateKeys(rangeValues.data(), 2000, numValues - 2000, numValues, options);
+  if (!std::equal(rangeValues.begin(), rangeValues.end(), values.begin() + 2000)) return false;
+
+  if (distribution != ems::KeyDistribution::Equal) {
+    options.seed = 43;
+    if (!generateFile<key>(numValues, options, parallelValues) || (parallelValues == values)) return false;
+  }
+  return true;
+}
+
+//Shape of each distribution
+template<typename key>
+bool testDistributions() {
+  const long long numValues = 100000;
+  ems::KeyGeneratorOptions options;
+  options.seed = 7;
+  options.chunkSize = 4096;
+  std::vector<key> values;
+
+  //Uniform keys are finite, spread on both sides of zero for the signed types
+  options.distribution = ems::KeyDistribution::Uniform;
+  if (!generateFile<key>(numValues, options, values)) return false;
+  long long numNegative = 0;
+  for (key k : values) {
+    if (!std::isfinite(static_cast<double>(k))) return false;
+    numNegative += (k < key());
+  }
+  if (std::numeric_limits<key>::is_signed && ((numNegative < numValues / 3) || (numNegative > 2 * numValues / 3))) return false;
+  if (numDescents(values) < numValues / 3) return false;
+
+  options.distribution = ems::KeyDistribution::Sorted;
+  if (!generateFile<key>(numValues, options, values) || numDescents(values)) return false;
+
+  options.distribution = ems::KeyDistribution::Reverse;
+  if (!generateFile<key>(numValues, options, values)) return false;
+  std::reverse(values.begin(), values.end());
+  if (numDescents(values)) return false;
+
+  //A few descents, about two per swap
+  options.distribution = ems::KeyDistribution::NearlySorted;
+  options.swapPercent = 2;
+  if (!generateFile<key>(numValues, options, values)) return false;
+  long long descents = numDescents(values);
+  if ((descents == 0) || (descents > numValues * 3 / 100)) return false;
+
+  options.distribution = ems::KeyDistribution::FewUnique;
+  options.numUniqueKeys = 5;
+  if (!generateFile<key>(numValues, options, values)) return false;
+  std::sort(values.begin(), values.end());
+  if (std::unique(values.begin(), values.end()) - values.begin() != 5) return false;
+
+  //The most frequent key of a Zipf distribution of exponent 1 is drawn about numValues/ln(numValues) times
+  options.distribution = ems::KeyDistribution::Zipf;
+  options.zipfExponent = 1;
+  if (!generateFile<key>(numValues, options, values)) return false;
+  std::map<key, long long> counts;
+  for (key k : values) counts[k]++;
+  long long maxCount = 0;
+  for (auto &count : counts) maxCount = std::max(maxCount, count.second);
+  if ((maxCount < numValues / 20) || (counts.size() < 1000)) return false;
+
+  options.distribution = ems::KeyDistribution::Equal;
+  if (!generateFile<key>(numValues, options, values)) return false;
+  return std::count(values.begin(), values.end(), values[0]) == numValues;
+}
+
+int main(int argc, char** argv)
+{
+  for (auto distribution : { ems::KeyDistribution::Uniform, ems::KeyDistribution::Sorted, ems::KeyDistribution::Reverse,
+    ems::KeyDistribution::NearlySorted, ems::KeyDistribution::FewUnique, ems::KeyDistribution::Zipf, ems::KeyDistribution::Equal }) {
+    if (!testReproducible<uint32_t>(distribution)) return 1;
+    if (!testReproducible<double>(distribution)) return 1;
+  }
+
+  if (!testDistributions<uint32_t>()) return 1;
+  if (!testDistributions<int64_t>()) return 1;
+  if (!testDistributions<float>()) return 1;
+  if (!testDistributions<double>()) return 1;
+
+  ems::KeyDistribution distribution;
+  if (!ems::parseKeyDistribution("zipf", distribution) || (distribution != ems::KeyDistribution::Zipf)) return 1;
+  if (ems::parseKeyDistribution("normal", distribution)) return 1;
+
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Test the merge kernels and multisequence selection on runs held in memory
+
+#include "MergeKernel.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+
+//Merge numRuns random runs of at most maxRunSize keys with the given kernel
+//The runs are served to the kernel by blocks of blockSize keys and the output is flushed every blockSize keys
+bool testMerge(ems::MergeKernel kernel, long long numRuns, long long maxRunSize, long long blockSize) {
+  std::mt19937 gen(static_cast<unsigned int>(numRuns * 7919 + maxRunSize));
+  //Small range so that there are many duplicates
+  std::uniform_int_distribution<int> keyDist(0, 1000);
+  std::uniform_int_distribution<long long> sizeDist(0, maxRunSize);
+
+  //Generate the sorted runs, some of them may be empty
+  std::vector<std::vector<uint32_t>> runData(numRuns);
+  std::vector<uint32_t> expected;
+  for (auto &run : runData) {
+    run.resize(sizeDist(gen));
+    for (auto &val : run) val = keyDist(gen);
+    std::sort(run.begin(), run.end());
+    expected.insert(expected.end(), run.begin(), run.end());
+  }
+  std::sort(expected.begin(), expected.end());
+
+  //Position of the next block to serve for each run
+  std::vector<long long> runPos(numRuns, 0);
+  std::vector<ems::MergeRun<uint32_t>> runs(numRuns);
+  for (auto &run : runs) run.begin = run.end = nullptr;
+
+  ems::MergeRefillFunction<uint32_t> refill = [&](long long i, ems::MergeRun<uint32_t> &run) {
+    long long numRead = std::min<long long>(blockSize, runData[i].size() - runPos[i]);
+    if (numRead <= 0) return false;
+    run.begin = runData[i].data() + runPos[i];
+    run.end = run.begin + numRead;
+    runPos[i] += numRead;
+    return true;
+  };
+
+  std::vector<uint32_t> outputBuffer(blockSize);
+  std::vector<uint32_t> result;
+  ems::MergeOutput<uint32_t> output;
+  output.begin = output.pos = outputBuffer.data();
+  output.end = outputBuffer.data() + blockSize;
+
+  ems::MergeFlushFunction<uint32_t> flush = [&](ems::MergeOutput<uint32_t> &out) {
+    result.insert(result.end(), out.begin, out.pos);
+    out.pos = out.begin;
+  };
+
+  ems::mergeRuns(kernel, runs, output, refill, flush);
+
+  return result == expected;
+}
+
+//Merge runs held entirely in memory in an output buffer of exactly the merged size, never flushed (as the memory-mapped merges)
+bool testMergeInPlace(ems::MergeKernel kernel, long long numRuns, long long runSize) {
+  std::vector<std::vector<uint32_t>> runData(numRuns);
+  std::vector<ems::MergeRun<uint32_t>> runs(numRuns);
+  std::vector<uint32_t> expected;
+  for (long long i = 0; i < numRuns; i++) {
+    for (long long j = 0; j < runSize; j++) runData[i].push_back(static_cast<uint32_t>(j * numRuns + i));
+    runs[i].begin = runData[i].data();
+    runs[i].end = runs[i].begin + runSize;
+    expected.insert(expected.end(), runData[i].begin(), runData[i].end());
+  }
+  std::sort(expected.begin(), expected.end());
+
+  std::vector<uint32_t> result(expected.size());
+  ems::MergeOutput<uint32_t> output;
+  output.begin = output.pos = result.data();
+  output.end = result.data() + result.size();
+  ems::MergeRefillFunction<uint32_t> refill = [](long long, ems::MergeRun<uint32_t> &) { return false; };
+  ems::MergeFlushFunction<uint32_t> flush = [](ems::MergeOutput<uint32_t> &) {};
+
+  ems::mergeRuns(kernel, runs, output, refill, flush);
+
+  return (output.pos == output.end) && (result == expected);
+}
+
+//Split numRuns random runs at every rank and check that the splits are valid
+bool testMultiSequenceSelect(long long numRuns, long long maxRunSize, int maxKey) {
+  std::mt19937 gen(static_cast<unsigned int>(numRuns * 31 + maxRunSize + maxKey));
+  std::uniform_int_distribution<int> keyDist(0, maxKey);
+  std::uniform_int_distribution<long long> sizeDist(0, maxRunSize);
+
+  std::vector<std::vector<uint32_t>> runData(numRuns);
+  std::vector<long long> sizes(numRuns);
+  long long numValues = 0;
+  for (long long i = 0; i < numRuns; i++) {
+    runData[i].resize(sizeDist(gen));
+    for (auto &val : runData[i]) val = keyDist(gen);
+    std::sort(runData[i].begin(), runData[i].end());
+    sizes[i] = runData[i].size();
+    numValues += sizes[i];
+  }
+
+  auto keyAt = [&](long long i, long long pos) { return runData[i][pos]; };
+
+  std::vector<long long> previousSplit(numRuns, 0);
+  for (long long rank = 0; rank <= numValues; rank++) {
+    std::vector<long long> split = ems::multiSequenceSelect<uint32_t>(sizes, rank, keyAt);
+
+    //The split must select rank keys and consecutive ranks must give consecutive ranges
+    long long numSelected = 0;
+    for (long long i = 0; i < numRuns; i++) {
+      if ((split[i] < previousSplit[i]) || (split[i] > sizes[i])) return false;
+      numSelected += split[i];
+    }
+    if (numSelected != rank) return false;
+
+    //Every selected key must be lower or equal to every other key
+    for (long long i = 0; i < numRuns; i++) {
+      if (!split[i]) continue;
+      for (long long j = 0; j < numRuns; j++) {
+        if ((split[j] < sizes[j]) && (runData[j][split[j]] < runData[i][split[i] - 1])) return false;
+      }
+    }
+    previousSplit = split;
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  //Multisequence selection with few and many distinct keys
+  for (long long numRuns : { 1, 2, 3, 10 }) {
+    if (!testMultiSequenceSelect(numRuns, 100, 5)) return 1;
+    if (!testMultiSequenceSelect(numRuns, 100, 100000)) return 1;
+  }
+
+  for (auto kernel : { ems::MergeKernel::Heap, ems::MergeKernel::LoserTree, ems::MergeKernel::Cascade }) {
+    //No run at all
+    if (!testMerge(kernel, 0, 10, 4)) return 1;
+    //Various fan-ins, including non powers of two
+    for (long long numRuns : { 1, 2, 3, 4, 5, 7, 10, 64, 100 }) {
+      if (!testMerge(kernel, numRuns, 50, 1)) return 1;
+      if (!testMerge(kernel, numRuns, 50, 7)) return 1;
+      if (!testMerge(kernel, numRuns, 1000, 64)) return 1;
+      if (!testMergeInPlace(kernel, numRuns, 1000)) return 1;
+    }
+  }
+
+  return 0;
+}
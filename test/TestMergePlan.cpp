@@ -0,0 +1,110 @@
+// Test the merge planner: valid merge trees with full fan-in, written keys never above the level by level merges
+
+#include "MergePlan.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iostream>
+
+//Check that the plan merges all the runs into one, each run being merged once after it is written,
+//with fanIn inputs per merge except the first one
+bool checkPlan(const std::vector<long long> &runSizes, const std::vector<ems::PlannedMerge> &plan, long long fanIn) {
+  long long numRuns = runSizes.size();
+  if (numRuns < 2) return plan.empty();
+  if (plan.empty()) return false;
+
+  std::vector<long long> sizes(runSizes);
+  std::vector<int> levels(numRuns, 0);
+  std::vector<bool> merged(numRuns + plan.size(), false);
+  long long total = 0;
+  for (auto size : runSizes) total += size;
+
+  for (size_t m = 0; m < plan.size(); m++) {
+    const ems::PlannedMerge &merge = plan[m];
+    long long numInputs = merge.inputs.size();
+    if ((numInputs < 2) || (numInputs > fanIn) || ((m > 0) && (numInputs != fanIn))) return false;
+    long long numValues = 0;
+    int level = 0;
+    for (long long input : merge.inputs) {
+      if ((input < 0) || (input >= numRuns + static_cast<long long>(m)) || merged[input]) return false;
+      merged[input] = true;
+      numValues += sizes[input];
+      level = std::max(level, levels[input]);
+    }
+    if ((numValues != merge.numValues) || (merge.level != level + 1)) return false;
+    sizes.push_back(numValues);
+    levels.push_back(merge.level);
+  }
+
+  //Only the final run is left
+  for (size_t i = 0; i + 1 < merged.size(); i++) {
+    if (!merged[i]) return false;
+  }
+  return plan.back().numValues == total;
+}
+
+//Keys written by merging the runs in order, fanIn at a time, level by level
+long long levelMergeSize(std::vector<long long> sizes, long long fanIn) {
+  long long numValues = 0;
+  while (sizes.size() > 1) {
+    std::vector<long long> mergedSizes;
+    for (size_t first = 0; first < sizes.size(); first += fanIn) {
+      long long size = 0;
+      for (size_t i = first; i < std::min<size_t>(first + fanIn, sizes.size()); i++) size += sizes[i];
+      mergedSizes.push_back(size);
+    }
+    if (mergedSizes.size() > 1) {
+      for (auto size : mergedSizes) numValues += size;
+    }
+    sizes.swap(mergedSizes);
+  }
+  return numValues;
+}
+
+int main(int argc, char** argv)
+{
+  std::mt19937_64 gen(42);
+
+  //Random runs of equal or unequal sizes, the plan never writes more keys than the level by level merges
+  for (long long fanIn : { 2, 3, 4, 10 }) {
+    for (long long numRuns : { 0, 1, 2, 3, 4, 5, 9, 10, 11, 37, 100 }) {
+      for (long long maxSize : { 1, 1000 }) {
+        std::uniform_int_distribution<long long> sizeDist(1, maxSize);
+        std::vector<long long> runSizes(numRuns);
+        for (auto &size : runSizes) size = sizeDist(gen);
+        std::vector<ems::PlannedMerge> plan = ems::planMerges(runSizes, std::vector<double>(), fanIn);
+        if (!checkPlan(runSizes, plan, fanIn)) {
+          std::cerr << "Invalid plan for " << numRuns << " runs, fan-in " << fanIn << std::endl;
+          return 1;
+        }
+        if (ems::intermediateMergeSize(plan) > levelMergeSize(runSizes, fanIn)) {
+          std::cerr << "Plan writes more keys than the level by level merges for " << numRuns << " runs, fan-in " << fanIn << std::endl;
+          return 1;
+        }
+      }
+    }
+  }
+
+  //10 equal runs with fan-in 4: two full merges of 4 runs then the final merge, instead of merges of 4, 4 and 2 runs
+  std::vector<long long> runSizes(10, 100);
+  std::vector<ems::PlannedMerge> plan = ems::planMerges(runSizes, std::vector<double>(), 4);
+  if ((plan.size() != 3) || (ems::intermediateMergeSize(plan) != 800) || (levelMergeSize(runSizes, 4) != 1000)) return 1;
+
+  //A large run is only merged by the final merge
+  runSizes.assign(5, 1);
+  runSizes.push_back(1000);
+  plan = ems::planMerges(runSizes, std::vector<double>(), 4);
+  if (!checkPlan(runSizes, plan, 4) || (plan.size() != 2) || (ems::intermediateMergeSize(plan) != 3)) return 1;
+
+  //Among equal runs the first ready ones are merged first
+  runSizes.assign(7, 100);
+  std::vector<double> readyTimes = { 6, 5, 4, 3, 2, 1, 0 };
+  plan = ems::planMerges(runSizes, readyTimes, 4);
+  if (!checkPlan(runSizes, plan, 4)) return 1;
+  std::vector<long long> firstInputs = plan[0].inputs;
+  std::sort(firstInputs.begin(), firstInputs.end());
+  if ((firstInputs != std::vector<long long>{ 3, 4, 5, 6 }) || (plan[0].readyTime != 403)) return 1;
+
+  return 0;
+}
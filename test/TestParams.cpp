@@ -1,5 +1,6 @@
 // Test input parameter validity of ExternalMergeSort
 // Check that we always have numThreads>=1 dataSizePerThreads>=3 and dataSizePerThreads-1 >= numMergesPerThread >= 2
+// Check that a memory budget is not exceeded and gives merge blocks of at least minIoSize bytes when it allows it
 
 #include "ExternalMergeSort.h"
 
@@ -24,6 +25,23 @@ int main(int argc, char** argv)
   mergeSort.setNumMergesPerThread(mergeSort.getDataSizePerThread() + 1);
   if ((mergeSort.getDataSizePerThread() - 1) != mergeSort.getNumMergesPerThread()) return 1;
 
+  //Budgets too small for a single thread with full merge blocks, then large enough for several threads
+  for (long long budget : { 1LL, 1LL << 20, 64LL << 20, 256LL << 20 }) {
+    mergeSort.setMemoryBudget(budget);
+    if (mergeSort.getMemoryBudget() != budget) return 1;
+    long long numThreads = mergeSort.getNumThreads();
+    long long dataSize = mergeSort.getDataSizePerThread();
+    long long numMerges = mergeSort.getNumMergesPerThread();
+    if ((numThreads < 1) || (dataSize < 3) || (numMerges < 2) || (numMerges > dataSize - 1)) return 1;
+    if ((budget >= 1LL << 20) && (2 * numThreads * dataSize * static_cast<long long>(sizeof(uint32_t)) > budget)) return 1;
+    long long blockBytes = dataSize / (numMerges + 1) / 2 * sizeof(uint32_t);
+    if ((budget >= 64LL << 20) && (blockBytes < mergeSort.getMinIoSize())) return 1;
+    if ((budget >= 64LL << 20) && (numMerges < ems::minBudgetMerges)) return 1;
+  }
+
+  //The limits still apply to the values set after a budget
+  mergeSort.setNumThreads(0);
+  if (mergeSort.getNumThreads() != 1) return 1;
+
   return 0;
 }
-
@@ -0,0 +1,84 @@
+// Test radixSort against std::sort for all the basic types
+
+#include "RadixSort.h"
+
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+//Sort random values and compare with std::sort
+//If maxValue is not zero the values are in [0, maxValue] so that some radix passes are skipped
+template<typename key>
+bool testRadixSort(long long numValues, double maxValue = 0) {
+  std::mt19937_64 gen(numValues);
+  double distMin = maxValue ? 0 : std::max<double>(static_cast<double>(std::numeric_limits<key>::lowest()), -1e300);
+  double distMax = maxValue ? maxValue : std::min<double>(static_cast<double>(std::numeric_limits<key>::max()), 1e300);
+  std::uniform_real_distribution<double> dist(distMin, distMax);
+
+  std::vector<key> values(numValues);
+  for (auto &val : values) val = static_cast<key>(dist(gen));
+  std::vector<key> expected = values;
+
+  ems::radixSort<key>(values.begin(), values.end());
+  std::sort(expected.begin(), expected.end());
+
+  return values == expected;
+}
+
+//Check the order of special floating point values, NaNs must be placed last
+template<typename key>
+bool testRadixSortSpecialValues() {
+  const key inf = std::numeric_limits<key>::infinity();
+  const key nan = std::numeric_limits<key>::quiet_NaN();
+  std::vector<key> values;
+  for (int i = 0; i < 50; i++) {
+    values.push_back(static_cast<key>(i - 25));
+    values.push_back(-nan);
+    values.push_back(nan);
+    values.push_back(inf);
+    values.push_back(-inf);
+    values.push_back(static_cast<key>(-0.0));
+    values.push_back(std::numeric_limits<key>::denorm_min());
+  }
+
+  ems::radixSort<key>(values.begin(), values.end());
+
+  //All the NaNs at the end
+  long long numNaN = 0;
+  while ((numNaN < (long long)values.size()) && std::isnan(values[values.size() - 1 - numNaN])) numNaN++;
+  if (numNaN != 100) return false;
+
+  //Everything else sorted
+  return std::is_sorted(values.begin(), values.end() - numNaN);
+}
+
+template<typename key>
+bool testRadixSortType() {
+  for (long long numValues : { 0, 1, 2, 63, 64, 1000, 100000 }) {
+    if (!testRadixSort<key>(numValues)) return false;
+    if (!testRadixSort<key>(numValues, 100)) return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (!testRadixSortType<uint8_t>()) return 1;
+  if (!testRadixSortType<uint16_t>()) return 1;
+  if (!testRadixSortType<uint32_t>()) return 1;
+  if (!testRadixSortType<uint64_t>()) return 1;
+  if (!testRadixSortType<int8_t>()) return 1;
+  if (!testRadixSortType<int16_t>()) return 1;
+  if (!testRadixSortType<int32_t>()) return 1;
+  if (!testRadixSortType<int64_t>()) return 1;
+  if (!testRadixSortType<float>()) return 1;
+  if (!testRadixSortType<double>()) return 1;
+
+  if (!testRadixSortSpecialValues<float>()) return 1;
+  if (!testRadixSortSpecialValues<double>()) return 1;
+
+  return 0;
+}
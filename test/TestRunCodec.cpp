@@ -0,0 +1,169 @@
+// Test the compressed runs: blocks of packed deltas written and read back sequentially, from any key and by random accesses
+
+#include "Util.h"
+#include "RunCodec.h"
+
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+//Write a sorted run of random keys in [0, maxValue] (the whole range if maxValue is zero) and read it back
+//The run is written and read in pieces of various sizes so that blocks are split between calls
+template<typename key>
+bool testRun(long long numValues, double maxValue) {
+  std::mt19937_64 gen(numValues + static_cast<long long>(maxValue));
+  double distMin = maxValue ? 0 : std::max<double>(static_cast<double>(std::numeric_limits<key>::lowest()), -1e300);
+  double distMax = maxValue ? maxValue : std::min<double>(static_cast<double>(std::numeric_limits<key>::max()), 1e300);
+  std::uniform_real_distribution<double> dist(distMin, distMax);
+  std::vector<key> values(numValues);
+  for (auto &val : values) val = static_cast<key>(dist(gen));
+  std::sort(values.begin(), values.end());
+
+  std::string fileName = ems::findAvailableFileName("testruncodec");
+  if (fileName.empty()) return false;
+
+  bool valid = true;
+  try {
+    std::uniform_int_distribution<long long> pieceDist(1, 3000);
+    ems::File file;
+    if (!file.open(fileName, ems::File::Write)) return false;
+    //Small buffer so that the blocks are written in several batches
+    ems::RunWriter<key> writer(file, 10000);
+    for (long long pos = 0; pos < numValues;) {
+      long long numWritten = std::min(pieceDist(gen), numValues - pos);
+      writer.write(values.data() + pos, numWritten);
+      pos += numWritten;
+    }
+    writer.close();
+    file.close();
+
+    if (!file.open(fileName, ems::File::Read)) valid = false;
+    else {
+      ems::RunReader<key> reader(10000);
+      reader.open(file);
+      if (reader.size() != numValues) valid = false;
+
+      //Sequential read
+      std::vector<key> readValues(numValues);
+      for (long long pos = 0; pos < numValues;) {
+        long long numRead = std::min(pieceDist(gen), numValues - pos);
+        reader.read(readValues.data() + pos, numRead);
+        pos += numRead;
+      }
+      if (readValues != values) valid = false;
+
+      //Reading past the end must throw
+      bool thrown = false;
+      try {
+        key val;
+        reader.read(&val, 1);
+      }
+      catch (std::ios_base::failure &) {
+        thrown = true;
+      }
+      if (!thrown) valid = false;
+
+      //Ranges starting anywhere and random accesses
+      std::uniform_int_distribution<long long> posDist(0, numValues);
+      for (int i = 0; i < 20; i++) {
+        long long start = posDist(gen);
+        long long end = std::min(numValues, start + pieceDist(gen));
+        reader.seek(start);
+        std::vector<key> range(end - start);
+        reader.read(range.data(), end - start);
+        if (!std::equal(range.begin(), range.end(), values.begin() + start)) valid = false;
+        if ((start < numValues) && (reader.keyAt(start) != values[start])) valid = false;
+      }
+      file.close();
+    }
+  }
+  catch (...) {
+    valid = false;
+  }
+
+  remove(fileName.c_str());
+  return valid;
+}
+
+//Write runs of keys ending with NaNs of various payloads, and with a NaN before other keys, and compare the bits read back
+template<typename key>
+bool testRunNaNs() {
+  for (long long numNaNs : { 1, 10, 1024, 1500 }) {
+    for (bool sorted : { true, false }) {
+      long long numValues = 3000;
+      std::vector<key> values(numValues);
+      for (long long i = 0; i < numValues; i++) values[i] = static_cast<key>(i) / 8;
+      for (long long i = numValues - numNaNs; i < numValues; i++) {
+        typename ems::RadixUnsigned<sizeof(key)>::type bits;
+        key nan = (i & 1) ? std::numeric_limits<key>::quiet_NaN() : -std::numeric_limits<key>::quiet_NaN();
+        std::memcpy(&bits, &nan, sizeof(key));
+        bits ^= i & 0xFF;
+        std::memcpy(&values[i], &bits, sizeof(key));
+      }
+      if (!sorted) std::swap(values[100], values[numValues - 1]);
+
+      std::string fileName = ems::findAvailableFileName("testruncodec");
+      if (fileName.empty()) return false;
+      bool valid = true;
+      try {
+        ems::File file;
+        if (!file.open(fileName, ems::File::Write)) return false;
+        ems::RunWriter<key> writer(file, 10000);
+        writer.write(values.data(), numValues);
+        writer.close();
+        file.close();
+
+        if (!file.open(fileName, ems::File::Read)) valid = false;
+        else {
+          ems::RunReader<key> reader(10000);
+          reader.open(file);
+          std::vector<key> readValues(numValues);
+          reader.read(readValues.data(), numValues);
+          if (std::memcmp(readValues.data(), values.data(), numValues * sizeof(key))) valid = false;
+          key last = reader.keyAt(numValues - 1);
+          if (std::memcmp(&last, &values[numValues - 1], sizeof(key))) valid = false;
+          file.close();
+        }
+      }
+      catch (...) {
+        valid = false;
+      }
+      remove(fileName.c_str());
+      if (!valid) return false;
+    }
+  }
+  return true;
+}
+
+template<typename key>
+bool testRunType() {
+  for (long long numValues : { 0, 1, 2, 1023, 1024, 1025, 100000 }) {
+    //Full range (wide deltas), small range (narrow deltas) and a single value (no delta)
+    if (!testRun<key>(numValues, 0)) return false;
+    if (!testRun<key>(numValues, 100)) return false;
+    if (!testRun<key>(numValues, 0.5)) return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (!testRunType<uint8_t>()) return 1;
+  if (!testRunType<uint16_t>()) return 1;
+  if (!testRunType<uint32_t>()) return 1;
+  if (!testRunType<uint64_t>()) return 1;
+  if (!testRunType<int8_t>()) return 1;
+  if (!testRunType<int16_t>()) return 1;
+  if (!testRunType<int32_t>()) return 1;
+  if (!testRunType<int64_t>()) return 1;
+  if (!testRunType<float>()) return 1;
+  if (!testRunType<double>()) return 1;
+  if (!testRunNaNs<float>()) return 1;
+  if (!testRunNaNs<double>()) return 1;
+
+  return 0;
+}
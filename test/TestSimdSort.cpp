@@ -0,0 +1,141 @@
+// Test simdSort against std::sort for all the instruction sets supported by the CPU
+
+#include "SimdSort.h"
+
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+//Sort random values with at most the given instruction set and compare with std::sort
+//If maxValue is not zero the values are in [0, maxValue] so that there are many duplicates
+template<typename key>
+bool testSimdSort(long long numValues, ems::SimdLevel level, double maxValue = 0) {
+  std::mt19937_64 gen(numValues);
+  double distMin = maxValue ? 0 : std::max<double>(static_cast<double>(std::numeric_limits<key>::lowest()), -1e300);
+  double distMax = maxValue ? maxValue : std::min<double>(static_cast<double>(std::numeric_limits<key>::max()), 1e300);
+  std::uniform_real_distribution<double> dist(distMin, distMax);
+
+  std::vector<key> values(numValues);
+  for (auto &val : values) val = static_cast<key>(dist(gen));
+  std::vector<key> expected = values;
+
+  ems::simdSortAtLevel<key>(values.begin(), values.end(), level);
+  std::sort(expected.begin(), expected.end());
+
+  return values == expected;
+}
+
+//Sorted and reversed input (the 8-bit keys wrap around), and the extreme values of the type
+template<typename key>
+bool testSimdSortOrderedValues(ems::SimdLevel level) {
+  std::vector<key> values;
+  for (int i = 0; i < 1000; i++) values.push_back(static_cast<key>(i));
+  std::sort(values.begin(), values.end());
+  std::vector<key> expected = values;
+  ems::simdSortAtLevel<key>(values.begin(), values.end(), level);
+  if (values != expected) return false;
+
+  std::reverse(values.begin(), values.end());
+  ems::simdSortAtLevel<key>(values.begin(), values.end(), level);
+  if (values != expected) return false;
+
+  for (int i = 0; i < 100; i++) {
+    values.push_back(std::numeric_limits<key>::lowest());
+    values.push_back(std::numeric_limits<key>::max());
+    values.push_back(std::numeric_limits<key>::min());
+  }
+  expected = values;
+  ems::simdSortAtLevel<key>(values.begin(), values.end(), level);
+  std::sort(expected.begin(), expected.end());
+  return values == expected;
+}
+
+//Check the order of special floating point values, without NaNs which std::sort does not order
+template<typename key>
+bool testSimdSortSpecialValues(ems::SimdLevel level) {
+  const key inf = std::numeric_limits<key>::infinity();
+  std::vector<key> values;
+  for (int i = 0; i < 50; i++) {
+    values.push_back(static_cast<key>(i - 25));
+    values.push_back(inf);
+    values.push_back(-inf);
+    values.push_back(static_cast<key>(-0.0));
+    values.push_back(std::numeric_limits<key>::denorm_min());
+    values.push_back(-std::numeric_limits<key>::denorm_min());
+  }
+
+  ems::simdSortAtLevel<key>(values.begin(), values.end(), level);
+  return std::is_sorted(values.begin(), values.end());
+}
+
+//NaNs of various payloads and signs are placed last with their bits unchanged
+template<typename key>
+bool testSimdSortNaNs(ems::SimdLevel level) {
+  typedef typename ems::RadixUnsigned<sizeof(key)>::type bitsType;
+  std::vector<key> values;
+  std::vector<bitsType> nanBits;
+  for (int i = 0; i < 1000; i++) {
+    if (i % 7) {
+      values.push_back(static_cast<key>(i % 100 - 50));
+      continue;
+    }
+    key nan = (i & 1) ? std::numeric_limits<key>::quiet_NaN() : -std::numeric_limits<key>::quiet_NaN();
+    bitsType bits;
+    std::memcpy(&bits, &nan, sizeof(key));
+    bits ^= static_cast<bitsType>(i & 0xFF);
+    std::memcpy(&nan, &bits, sizeof(key));
+    values.push_back(nan);
+    nanBits.push_back(bits);
+  }
+
+  ems::simdSortAtLevel<key>(values.begin(), values.end(), level);
+  if (!std::is_sorted(values.begin(), values.end(), ems::KeyLess<key>())) return false;
+  std::vector<bitsType> sortedNanBits(nanBits.size());
+  std::memcpy(sortedNanBits.data(), values.data() + values.size() - nanBits.size(), nanBits.size() * sizeof(key));
+  std::sort(nanBits.begin(), nanBits.end());
+  std::sort(sortedNanBits.begin(), sortedNanBits.end());
+  return sortedNanBits == nanBits;
+}
+
+//Sizes around the vector widths, the in-register runs and the cache blocks
+template<typename key>
+bool testSimdSortType(ems::SimdLevel level) {
+  for (long long numValues : { 0, 1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000, 32767, 32768, 32769, 100000 }) {
+    if (!testSimdSort<key>(numValues, level)) return false;
+    if (!testSimdSort<key>(numValues, level, 100)) return false;
+  }
+  return testSimdSortOrderedValues<key>(level);
+}
+
+template<typename key>
+bool testSimdSortFloatType(ems::SimdLevel level) {
+  return testSimdSortType<key>(level) && testSimdSortSpecialValues<key>(level) && testSimdSortNaNs<key>(level);
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<ems::SimdLevel> levels = { ems::SimdLevel::Scalar, ems::SimdLevel::Avx2, ems::SimdLevel::Avx512 };
+  for (ems::SimdLevel level : levels) {
+    if (level > ems::simdLevel()) break;
+    if (!testSimdSortType<uint32_t>(level)) return 1;
+    if (!testSimdSortType<uint64_t>(level)) return 1;
+    if (!testSimdSortType<int32_t>(level)) return 1;
+    if (!testSimdSortType<int64_t>(level)) return 1;
+    if (!testSimdSortFloatType<float>(level)) return 1;
+    if (!testSimdSortFloatType<double>(level)) return 1;
+
+    //Keys without SIMD kernel fall back to the scalar sort
+    if (!testSimdSortType<uint8_t>(level)) return 1;
+    if (!testSimdSortType<int16_t>(level)) return 1;
+  }
+
+  //The default level sorts like the others
+  std::vector<uint32_t> values = { 3, 1, 2 };
+  ems::simdSort<uint32_t>(values.begin(), values.end());
+  if (values != std::vector<uint32_t>{ 1, 2, 3 }) return 1;
+
+  return 0;
+}
@@ -2,6 +2,8 @@
 
 #include "Util.h"
 #include "ExternalMergeSort.h"
+#include "ExternalSampleSort.h"
+#include "SimdSort.h"
 
 #include <iostream>
 #include <cstdlib>
@@ -9,6 +11,11 @@
 #include <string>
 #include <fstream>
 #include <memory>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <cstring>
+#include <type_traits>
 
 //Input and output files generated by the test
 std::string inputFileName;
@@ -22,9 +29,129 @@ void cleanup() {
   outputFileName.clear();
 }
 
+//Options of ExternalMergeSort used by a test
+struct SortOptions {
+  ems::MergeKernel kernel;
+  bool doubleBuffering;
+  bool pipelinedSort;
+  bool stdSort;
+  //Sort the chunks with simdSort
+  bool simdSort;
+  bool replacementSelection;
+  bool parallelFinalMerge;
+  bool inMemorySort;
+  bool memoryMappedIo;
+  bool ioUring;
+  //Phases using direct I/O
+  int directIo;
+  bool compressTemporaryFiles;
+  bool countingSort;
+  bool adaptiveSort;
+  //Sort with ExternalSampleSort instead of ExternalMergeSort
+  bool sampleSort;
+  //Sort the input file before the test
+  bool sortedInput;
+  //With sortedInput, shuffle the sorted keys by windows of this size, so that neighbouring chunks overlap (0 for none)
+  long long shuffleWindow;
+  //With sortedInput, sort the keys by ranges of this size instead of as a whole, forming natural runs (0 for a single range)
+  long long runLength;
+  //With sortedInput, reverse the order of the sorted keys
+  bool reverseInput;
+  //Replace the keys by repeating the first numUniqueKeys ones (0 to keep all the keys)
+  long long numUniqueKeys;
+  //Replace one floating point key in specialKeys by a NaN of either sign and with various payloads, a signed zero
+  //or an infinity (0 for none)
+  long long specialKeys;
+  int numThreads;
+  long long dataSizePerThread;
+  //Number of keys of the input file
+  long long numValues;
+};
+
+//Read all the keys of a file
 template<typename key>
-bool testSort() {
-  ems::ExternalMergeSort<key> mergeSort;
+std::vector<key> readFile(const std::string &fileName) {
+  std::fstream file(fileName, std::ios::in | std::ios::binary);
+  file.seekg(0, std::ios::end);
+  std::vector<key> values(static_cast<long long>(file.tellg()) / sizeof(key));
+  file.seekg(0, std::ios::beg);
+  if (values.size()) file.read(reinterpret_cast<char *>(&values[0]), sizeof(key)*values.size());
+  return values;
+}
+
+//Bits of the keys, sorted
+template<typename key>
+std::vector<typename ems::RadixUnsigned<sizeof(key)>::type> sortedBits(const std::vector<key> &values) {
+  std::vector<typename ems::RadixUnsigned<sizeof(key)>::type> bits(values.size());
+  if (values.size()) std::memcpy(&bits[0], &values[0], sizeof(key)*values.size());
+  std::sort(bits.begin(), bits.end());
+  return bits;
+}
+
+//Check that the output file contains the keys of the input file bit for bit, sorted in KeyOrder
+template<typename key>
+bool checkSameKeys(const std::string &inFileName, const std::string &outFileName) {
+  std::vector<key> inValues = readFile<key>(inFileName);
+  std::vector<key> outValues = readFile<key>(outFileName);
+  if (!std::is_sorted(outValues.begin(), outValues.end(), ems::KeyLess<key>())) return false;
+  return sortedBits(inValues) == sortedBits(outValues);
+}
+
+//Replace one key in spacing by a NaN of either sign and with various payloads, a signed zero or an infinity
+template<typename key, bool isFloatingPoint = std::is_floating_point<key>::value>
+struct SpecialKeys {
+  static void add(std::vector<key> &, long long) {}
+};
+template<typename key>
+struct SpecialKeys<key, true> {
+  static void add(std::vector<key> &values, long long spacing) {
+    typedef typename ems::RadixUnsigned<sizeof(key)>::type bitsType;
+    const key specialValues[] = { std::numeric_limits<key>::quiet_NaN(), -std::numeric_limits<key>::quiet_NaN(), key(0), -key(0),
+      std::numeric_limits<key>::infinity(), -std::numeric_limits<key>::infinity() };
+    for (long long i = 0; i < static_cast<long long>(values.size()); i += spacing) {
+      key k = specialValues[(i / spacing) % 6];
+      if (k != k) {
+        //The lowest bits of the payload, the quiet bit keeps it a NaN
+        bitsType bits;
+        std::memcpy(&bits, &k, sizeof(key));
+        bits ^= static_cast<bitsType>(i & 0xFF);
+        std::memcpy(&k, &bits, sizeof(key));
+      }
+      values[i] = k;
+    }
+  }
+};
+
+//Rewrite the keys of the input file as described by the options
+//The keys are repeated, special floating point keys are added, sorted by ranges of runLength keys (whole file if zero),
+//reversed, then shuffled by windows of shuffleWindow keys if not zero
+template<typename key>
+void prepareInputFile(const std::string &fileName, const SortOptions &options) {
+  std::vector<key> values = readFile<key>(fileName);
+  long long numValues = values.size();
+  if (options.numUniqueKeys) {
+    for (long long i = options.numUniqueKeys; i < numValues; i++) values[i] = values[i % options.numUniqueKeys];
+  }
+  if (options.specialKeys) SpecialKeys<key>::add(values, options.specialKeys);
+  if (options.sortedInput) {
+    long long runLength = options.runLength ? options.runLength : numValues;
+    for (long long i = 0; i < numValues; i += runLength) {
+      std::sort(values.begin() + i, values.begin() + std::min(i + runLength, numValues), ems::KeyLess<key>());
+    }
+    if (options.reverseInput) std::reverse(values.begin(), values.end());
+    std::mt19937 gen(static_cast<unsigned>(numValues));
+    for (long long i = 0; options.shuffleWindow && (i < numValues); i += options.shuffleWindow) {
+      std::shuffle(values.begin() + i, values.begin() + std::min(i + options.shuffleWindow, numValues), gen);
+    }
+  }
+  std::fstream file(fileName, std::ios::out | std::ios::binary);
+  file.write(reinterpret_cast<char *>(&values[0]), sizeof(key)*values.size());
+}
+
+template<typename key>
+bool testSort(const SortOptions &options) {
+  std::unique_ptr<ems::ExternalMergeSort<key>> sorter(options.sampleSort ? new ems::ExternalSampleSort<key>() : new ems::ExternalMergeSort<key>());
+  ems::ExternalMergeSort<key> &mergeSort = *sorter;
 
   try {
     //Find an available input filename
@@ -36,24 +163,39 @@ bool testSort() {
     if (outputFileName.empty()) return false;
 
     //Create the input file
-    if (!ems::createRandomFile<key>(inputFileName, 1000, 1000)) {
+    if (!ems::createRandomFile<key>(inputFileName, options.numValues, 1000)) {
       cleanup();
       return false;
     }
+    if (options.sortedInput || options.numUniqueKeys || options.specialKeys) prepareInputFile<key>(inputFileName, options);
 
     //Perform the sort
     mergeSort.setInputFileName(inputFileName.c_str());
     mergeSort.setOutputFileName(outputFileName.c_str());
-    mergeSort.setDataSizePerThread(100);
+    mergeSort.setDataSizePerThread(options.dataSizePerThread);
     mergeSort.setNumMergesPerThread(4);
-    mergeSort.setNumThreads(4);
+    mergeSort.setNumThreads(options.numThreads);
+    mergeSort.setMergeKernel(options.kernel);
+    mergeSort.setDoubleBuffering(options.doubleBuffering);
+    mergeSort.setPipelinedSort(options.pipelinedSort);
+    mergeSort.setReplacementSelection(options.replacementSelection);
+    mergeSort.setParallelFinalMerge(options.parallelFinalMerge);
+    mergeSort.setInMemorySort(options.inMemorySort);
+    mergeSort.setMemoryMappedIo(options.memoryMappedIo);
+    mergeSort.setIoUring(options.ioUring);
+    mergeSort.setDirectIo(options.directIo);
+    mergeSort.setCompressTemporaryFiles(options.compressTemporaryFiles);
+    mergeSort.setCountingSort(options.countingSort);
+    mergeSort.setAdaptiveSort(options.adaptiveSort);
+    if (options.stdSort) mergeSort.setSortFunction(std::sort<typename std::vector<key>::iterator>);
+    if (options.simdSort) mergeSort.setSortFunction(ems::simdSort<key>);
     if (!mergeSort.sort()) {
       cleanup();
       return false;
     }
 
     //Check the result
-    if (!ems::checkSortedFile<key>(outputFileName)) {
+    if (!ems::checkSortedFile<key>(outputFileName) || !checkSameKeys<key>(inputFileName, outputFileName)) {
       cleanup();
       return false;
     }
@@ -67,19 +209,365 @@ bool testSort() {
   }
 }
 
+//Test with all basic types
+bool testSortAllTypes(const SortOptions &options) {
+  if (!testSort<uint8_t>(options)) return false;
+  if (!testSort<uint16_t>(options)) return false;
+  if (!testSort<uint32_t>(options)) return false;
+  if (!testSort<uint64_t>(options)) return false;
+  if (!testSort<int8_t>(options)) return false;
+  if (!testSort<int16_t>(options)) return false;
+  if (!testSort<int32_t>(options)) return false;
+  if (!testSort<int64_t>(options)) return false;
+  if (!testSort<float>(options)) return false;
+  if (!testSort<double>(options)) return false;
+  return true;
+}
+
+//Test with the floating point types
+bool testSortFloatingPointTypes(const SortOptions &options) {
+  if (!testSort<float>(options)) return false;
+  if (!testSort<double>(options)) return false;
+  return true;
+}
+
 int main(int argc, char** argv)
 {
-  //Test with all basic types
-  if (!testSort<uint8_t>()) return 1;
-  if (!testSort<uint16_t>()) return 1;
-  if (!testSort<uint32_t>()) return 1;
-  if (!testSort<uint64_t>()) return 1;
-  if (!testSort<int8_t>()) return 1;
-  if (!testSort<int16_t>()) return 1;
-  if (!testSort<int32_t>()) return 1;
-  if (!testSort<int64_t>()) return 1;
-  if (!testSort<float>()) return 1;
-  if (!testSort<double>()) return 1;
+  SortOptions defaultOptions;
+  defaultOptions.kernel = ems::MergeKernel::Cascade;
+  defaultOptions.doubleBuffering = true;
+  defaultOptions.pipelinedSort = false;
+  defaultOptions.stdSort = false;
+  defaultOptions.simdSort = false;
+  defaultOptions.replacementSelection = false;
+  defaultOptions.parallelFinalMerge = true;
+  defaultOptions.inMemorySort = true;
+  defaultOptions.memoryMappedIo = false;
+  defaultOptions.ioUring = false;
+  defaultOptions.directIo = 0;
+  defaultOptions.compressTemporaryFiles = false;
+  defaultOptions.countingSort = true;
+  defaultOptions.adaptiveSort = true;
+  defaultOptions.sampleSort = false;
+  defaultOptions.sortedInput = false;
+  defaultOptions.shuffleWindow = 0;
+  defaultOptions.runLength = 0;
+  defaultOptions.reverseInput = false;
+  defaultOptions.numUniqueKeys = 0;
+  defaultOptions.specialKeys = 0;
+  defaultOptions.numThreads = 4;
+  defaultOptions.dataSizePerThread = 100;
+  defaultOptions.numValues = 1000;
+
+  if (!testSortAllTypes(defaultOptions)) return 1;
+
+  //The other tests use the merges for the 8 and 16-bit keys, the counting sort is tested last
+  defaultOptions.countingSort = false;
+
+  //Heap merge kernel
+  SortOptions options = defaultOptions;
+  options.kernel = ems::MergeKernel::Heap;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Loser tree merge kernel
+  options.kernel = ems::MergeKernel::LoserTree;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Without double buffering, with the loser tree and cascade kernels
+  options.doubleBuffering = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.kernel = ems::MergeKernel::Cascade;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Pipelined sort
+  options = defaultOptions;
+  options.pipelinedSort = true;
+  if (!testSortAllTypes(options)) return 1;
+
+  //std::sort instead of the default radix sort
+  options = defaultOptions;
+  options.stdSort = true;
+  if (!testSortAllTypes(options)) return 1;
+
+  //SIMD sort, on chunks larger than the vectors, with NaNs of various payloads in the floating point keys
+  options = defaultOptions;
+  options.simdSort = true;
+  options.dataSizePerThread = 1000;
+  options.numValues = 10000;
+  if (!testSortAllTypes(options)) return 1;
+  options.specialKeys = 37;
+  if (!testSortFloatingPointTypes(options)) return 1;
+
+  //Replacement selection, on random and sorted input (single file per thread, the sorted input is not detected)
+  options = defaultOptions;
+  options.replacementSelection = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.adaptiveSort = false;
+  options.sortedInput = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.numThreads = 1;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Sorted input, copied to the output or sorted as random input without the adaptive sort
+  options = defaultOptions;
+  options.sortedInput = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.adaptiveSort = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.adaptiveSort = true;
+
+  //Nearly sorted input: the merges concatenate the chunks and merge the overlapping neighbours
+  options.shuffleWindow = 150;
+  if (!testSortAllTypes(options)) return 1;
+  options.parallelFinalMerge = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = false;
+  options.ioUring = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = true;
+  options.ioUring = false;
+  options.memoryMappedIo = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.memoryMappedIo = false;
+  options.compressTemporaryFiles = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.compressTemporaryFiles = false;
+  options.replacementSelection = true;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Natural runs merged from the input file in one or two levels, with the final merge split or not,
+  //io_uring, memory mapped files, compressed temporary files, direct I/O and without the adaptive sort
+  options = defaultOptions;
+  options.sortedInput = true;
+  options.runLength = 300;
+  if (!testSortAllTypes(options)) return 1;
+  options.runLength = 120;
+  if (!testSortAllTypes(options)) return 1;
+  options.parallelFinalMerge = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.parallelFinalMerge = true;
+  options.doubleBuffering = false;
+  options.ioUring = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = true;
+  options.ioUring = false;
+  options.memoryMappedIo = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.memoryMappedIo = false;
+  options.compressTemporaryFiles = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.compressTemporaryFiles = false;
+  options.adaptiveSort = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.adaptiveSort = true;
+  options.numValues = 100000;
+  options.dataSizePerThread = 10000;
+  options.runLength = 12001;
+  options.directIo = ems::ExternalMergeSortBase::DirectInput | ems::ExternalMergeSortBase::DirectTemporaryFiles | ems::ExternalMergeSortBase::DirectOutput;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Chunks sorted in reverse order or with few distinct keys, sorted in linear time, and in memory
+  options = defaultOptions;
+  options.sortedInput = true;
+  options.reverseInput = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.sortedInput = false;
+  options.reverseInput = false;
+  options.numUniqueKeys = 10;
+  if (!testSortAllTypes(options)) return 1;
+  options.numUniqueKeys = 100;
+  if (!testSortAllTypes(options)) return 1;
+  options.dataSizePerThread = 300;
+  options.numUniqueKeys = 10;
+  if (!testSortAllTypes(options)) return 1;
+  options.sampleSort = true;
+  if (!testSortAllTypes(options)) return 1;
+
+  //NaNs, signed zeros and infinities in the floating point keys: merge kernels, final merge split or not, in memory
+  //sort, replacement selection, natural runs and nearly sorted chunks
+  options = defaultOptions;
+  options.specialKeys = 37;
+  options.dataSizePerThread = 10000;
+  options.numValues = 200000;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.kernel = ems::MergeKernel::Heap;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.kernel = ems::MergeKernel::LoserTree;
+  options.parallelFinalMerge = false;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.kernel = ems::MergeKernel::Cascade;
+  options.parallelFinalMerge = true;
+  options.dataSizePerThread = 50000;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.dataSizePerThread = 10000;
+  options.replacementSelection = true;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.replacementSelection = false;
+  options.sortedInput = true;
+  options.runLength = 30001;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.runLength = 0;
+  options.shuffleWindow = 15000;
+  if (!testSortFloatingPointTypes(options)) return 1;
+
+  //NaNs of various payloads in compressed runs, written by the chunk sorts and by the replacement selection
+  options = defaultOptions;
+  options.specialKeys = 37;
+  options.compressTemporaryFiles = true;
+  options.dataSizePerThread = 10000;
+  options.numValues = 200000;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.replacementSelection = true;
+  if (!testSortFloatingPointTypes(options)) return 1;
+
+  //NaNs of various payloads in chunks with few distinct keys, which are not sorted by counting
+  options = defaultOptions;
+  options.specialKeys = 37;
+  options.numUniqueKeys = 10;
+  options.dataSizePerThread = 10000;
+  options.numValues = 200000;
+  if (!testSortFloatingPointTypes(options)) return 1;
+
+  //NaNs, signed zeros and infinities with the sample sort, frequent enough to be splitters whose equal keys form buckets
+  options = defaultOptions;
+  options.specialKeys = 5;
+  options.sampleSort = true;
+  options.numThreads = 2;
+  options.dataSizePerThread = 10000;
+  options.numValues = 200000;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.numUniqueKeys = 10;
+  if (!testSortFloatingPointTypes(options)) return 1;
+  options.numThreads = 4;
+  options.dataSizePerThread = 3;
+  options.numValues = 1000;
+  if (!testSortFloatingPointTypes(options)) return 1;
+
+  //Final merge in a single task
+  options = defaultOptions;
+  options.parallelFinalMerge = false;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Memory mapped files, with the final merge split or not and a single chunk
+  options = defaultOptions;
+  options.memoryMappedIo = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.parallelFinalMerge = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.inMemorySort = false;
+  options.dataSizePerThread = 1000;
+  if (!testSortAllTypes(options)) return 1;
+
+  //io_uring (positional reads and writes if not available), with and without double buffering and a single chunk
+  options = defaultOptions;
+  options.ioUring = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.inMemorySort = false;
+  options.dataSizePerThread = 1000;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Input fitting in the data of all the threads, sorted in memory or in a single chunk
+  options = defaultOptions;
+  options.dataSizePerThread = 300;
+  if (!testSortAllTypes(options)) return 1;
+  options.numThreads = 3;
+  options.dataSizePerThread = 334;
+  if (!testSortAllTypes(options)) return 1;
+  options.inMemorySort = false;
+  options.dataSizePerThread = 1000;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Direct I/O for all the phases or only the temporary files, with inputs large enough for aligned blocks
+  options = defaultOptions;
+  options.directIo = ems::ExternalMergeSortBase::DirectInput | ems::ExternalMergeSortBase::DirectTemporaryFiles | ems::ExternalMergeSortBase::DirectOutput;
+  options.numValues = 100000;
+  options.dataSizePerThread = 10000;
+  if (!testSortAllTypes(options)) return 1;
+  options.ioUring = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.ioUring = false;
+  options.pipelinedSort = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.pipelinedSort = false;
+  options.replacementSelection = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.replacementSelection = false;
+  options.dataSizePerThread = 30000;
+  if (!testSortAllTypes(options)) return 1;
+  options.directIo = ems::ExternalMergeSortBase::DirectTemporaryFiles;
+  options.dataSizePerThread = 10000;
+  options.parallelFinalMerge = false;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Compressed temporary files, with the final merge split or not, pipelined sort, replacement selection and io_uring
+  options = defaultOptions;
+  options.compressTemporaryFiles = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.parallelFinalMerge = false;
+  if (!testSortAllTypes(options)) return 1;
+  options = defaultOptions;
+  options.compressTemporaryFiles = true;
+  options.pipelinedSort = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.pipelinedSort = false;
+  options.replacementSelection = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.adaptiveSort = false;
+  options.sortedInput = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.numThreads = 1;
+  if (!testSortAllTypes(options)) return 1;
+  options = defaultOptions;
+  options.compressTemporaryFiles = true;
+  options.ioUring = true;
+  options.doubleBuffering = false;
+  options.numValues = 100000;
+  options.dataSizePerThread = 5000;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Sample sort, with recursive partitions, without double buffering, a single thread or bucket, sorted input and direct I/O
+  options = defaultOptions;
+  options.sampleSort = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = false;
+  options.stdSort = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = true;
+  options.stdSort = false;
+  options.numThreads = 1;
+  if (!testSortAllTypes(options)) return 1;
+  options.dataSizePerThread = 1000;
+  if (!testSortAllTypes(options)) return 1;
+  options.numThreads = 4;
+  options.dataSizePerThread = 3;
+  options.numValues = 100;
+  if (!testSortAllTypes(options)) return 1;
+  options = defaultOptions;
+  options.sampleSort = true;
+  options.sortedInput = true;
+  if (!testSortAllTypes(options)) return 1;
+  options.sortedInput = false;
+  options.numValues = 100000;
+  options.dataSizePerThread = 5000;
+  options.directIo = ems::ExternalMergeSortBase::DirectInput | ems::ExternalMergeSortBase::DirectTemporaryFiles | ems::ExternalMergeSortBase::DirectOutput;
+  if (!testSortAllTypes(options)) return 1;
+
+  //Counting sort, with and without double buffering, a single thread and direct I/O
+  options = defaultOptions;
+  options.countingSort = true;
+  options.numValues = 100000;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = false;
+  if (!testSortAllTypes(options)) return 1;
+  options.doubleBuffering = true;
+  options.numThreads = 1;
+  if (!testSortAllTypes(options)) return 1;
+  options.numThreads = 3;
+  options.dataSizePerThread = 10000;
+  options.directIo = ems::ExternalMergeSortBase::DirectInput | ems::ExternalMergeSortBase::DirectOutput;
+  if (!testSortAllTypes(options)) return 1;
 
   return 0;
 }
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <atomic>
+#include <chrono>
 
 //Used to store the atomic sum
 std::atomic<long long> atomicSum ;
@@ -134,6 +135,65 @@ bool parallelAddTest() {
   return true;
 }
 
+struct DependentAddTask : public ems::Task {
+  long long number;
+  std::shared_ptr<DependentAddTask> operands[2];
+};
+
+void dependentAddTaskHandler(int threadId, ems::Task *task) {
+  DependentAddTask *addTask = dynamic_cast<DependentAddTask *>(task);
+  if (!addTask || !addTask->operands[0]) return;
+  addTask->number = addTask->operands[0]->number + addTask->operands[1]->number;
+}
+
+//Test using additive parallel reduction where the whole tree is submitted up front,
+//each addition is enqueued once its two operands are computed
+bool dependencyTest() {
+  //Must be power of two
+  long long numValues = 1024;
+
+  //Tasks of the current level of the tree, starting with the leaves
+  std::vector<std::shared_ptr<DependentAddTask>> levelTasks(numValues);
+  for (long long i = 0; i < numValues; i++) {
+    levelTasks[i] = std::make_shared<DependentAddTask>();
+    levelTasks[i]->number = i + 1;
+  }
+
+  ems::ThreadPool pool;
+  pool.addTaskHandler<DependentAddTask>(dependentAddTaskHandler);
+
+  //Add the additions before their operands to make sure they wait for them
+  std::vector<std::shared_ptr<DependentAddTask>> leaves = levelTasks;
+  while (levelTasks.size() > 1) {
+    std::vector<std::shared_ptr<DependentAddTask>> nextLevelTasks(levelTasks.size() / 2);
+    for (size_t i = 0; i < nextLevelTasks.size(); i++) {
+      nextLevelTasks[i] = std::make_shared<DependentAddTask>();
+      nextLevelTasks[i]->operands[0] = levelTasks[2 * i];
+      nextLevelTasks[i]->operands[1] = levelTasks[2 * i + 1];
+      std::vector<std::shared_ptr<ems::Task>> dependencies(levelTasks.begin() + 2 * i, levelTasks.begin() + 2 * i + 2);
+      pool.addTask(nextLevelTasks[i], dependencies);
+    }
+    levelTasks.swap(nextLevelTasks);
+  }
+
+  //Half the leaves are already completed, the other half is computed by the workers
+  for (long long i = 0; i < numValues; i++) {
+    if (i % 2) pool.addTask(leaves[i]);
+    else pool.addCompletedTask(leaves[i]);
+  }
+
+  //The workers stop once the root is computed since no other task is pending
+  pool.handleTasks(4, true);
+  pool.join();
+
+  if (pool.getThreadException()) return false;
+
+  //Check the sum
+  if (levelTasks[0]->number != ((numValues*(numValues + 1)) / 2)) return false;
+
+  return true;
+}
+
 bool priorityTest() {
   std::vector<std::shared_ptr<AtomicAddTask>> tasks;
 
@@ -158,6 +218,76 @@ bool priorityTest() {
   return true;
 }
 
+struct SplitAddTask : public ems::Task {
+  long long first;
+  long long last;
+};
+
+//Test the work stealing and measure the throughput of the pool on tiny tasks
+//Flat tasks are all added by the main thread, split tasks are added by the workers which split
+//the range [first, last) in two until a single number remains
+bool throughputTest(int numWorkers) {
+  long long numValues = 1 << 17;
+
+  //Flat tasks
+  atomicSum = 0;
+  ems::ThreadPool pool;
+  pool.addTaskHandler<AtomicAddTask>(atomicAddTaskHandler);
+  for (long long i = 0; i < numValues; i++) {
+    std::shared_ptr<AtomicAddTask> task = std::make_shared<AtomicAddTask>();
+    task->number = i + 1;
+    pool.addTask(task);
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  pool.handleTasks(numWorkers, true);
+  pool.join();
+  std::chrono::duration<double> flatTime = std::chrono::high_resolution_clock::now() - start;
+
+  if (pool.getThreadException()) return false;
+  if (atomicSum != ((numValues*(numValues + 1)) / 2)) return false;
+  pool.clearCompletedTasks();
+
+  //Split tasks
+  atomicSum = 0;
+  long long numSplitTasks = 0;
+  pool.addTaskHandler<SplitAddTask>([&pool](int threadId, ems::Task *task) {
+    SplitAddTask *splitTask = dynamic_cast<SplitAddTask *>(task);
+    if (!splitTask) return;
+    if (splitTask->last - splitTask->first == 1) {
+      atomicSum += splitTask->last;
+      return;
+    }
+    long long middle = (splitTask->first + splitTask->last) / 2;
+    for (int i = 0; i < 2; i++) {
+      std::shared_ptr<SplitAddTask> child = std::make_shared<SplitAddTask>();
+      child->first = i ? middle : splitTask->first;
+      child->last = i ? splitTask->last : middle;
+      pool.addTask(child);
+    }
+  });
+
+  std::shared_ptr<SplitAddTask> rootTask = std::make_shared<SplitAddTask>();
+  rootTask->first = 0;
+  rootTask->last = numValues;
+  pool.addTask(rootTask);
+
+  start = std::chrono::high_resolution_clock::now();
+  pool.handleTasks(numWorkers, true);
+  pool.join();
+  std::chrono::duration<double> splitTime = std::chrono::high_resolution_clock::now() - start;
+
+  if (pool.getThreadException()) return false;
+  if (atomicSum != ((numValues*(numValues + 1)) / 2)) return false;
+  while (pool.getCompletedTask(false)) numSplitTasks++;
+  if (numSplitTasks != 2 * numValues - 1) return false;
+
+  std::cout << numWorkers << " workers: " << numValues / flatTime.count() << " flat tasks/s, " 
+    << numSplitTasks / splitTime.count() << " split tasks/s" << std::endl;
+
+  return true;
+}
+
 int main(int argc, char** argv)
 {
   if (!atomicAddTest()) return 1;
@@ -166,6 +296,12 @@ int main(int argc, char** argv)
 
   if (!priorityTest()) return 1;
 
+  if (!dependencyTest()) return 1;
+
+  for (int numWorkers : { 1, 2, 4, 8 }) {
+    if (!throughputTest(numWorkers)) return 1;
+  }
+
   return 0;
 }
 
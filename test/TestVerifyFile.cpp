@@ -0,0 +1,166 @@
+// Test the verification of sorted files: order checked across the ranges of the threads and multiset hashes
+
+#include "Util.h"
+#include "VerifyFile.h"
+
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ios>
+
+//Write the keys in a new file, returns its name (empty on failure)
+template<typename key>
+std::string writeFile(const std::vector<key> &values) {
+  std::string fileName = ems::findAvailableFileName("testverifyfile");
+  if (fileName.empty()) return fileName;
+  ems::File file;
+  if (!file.open(fileName, ems::File::Write)) return std::string();
+  if (!values.empty()) file.write(values.data(), sizeof(key)*values.size(), 0);
+  return fileName;
+}
+
+//Summarize the keys written in a file with numThreads threads
+template<typename key>
+bool summarize(const std::vector<key> &values, int numThreads, ems::FileSummary &summary) {
+  std::string fileName = writeFile(values);
+  if (fileName.empty()) return false;
+  summary = ems::summarizeFile<key>(fileName, numThreads);
+  remove(fileName.c_str());
+  return true;
+}
+
+//Sorted keys with a single descent at every position around the boundaries of the ranges and blocks
+template<typename key>
+bool testSortedness(long long numValues, int numThreads) {
+  std::mt19937_64 gen(numValues);
+  std::uniform_real_distribution<double> dist(std::numeric_limits<key>::is_signed ? -1000 : 0, 1000);
+  std::vector<key> values(numValues);
+  for (auto &val : values) val = static_cast<key>(dist(gen));
+  std::sort(values.begin(), values.end());
+
+  ems::FileSummary summary;
+  if (!summarize(values, numThreads, summary)) return false;
+  if ((summary.numValues != numValues) || !summary.sorted) return false;
+
+  //Descents at the start, at the end, at the boundaries of the thread ranges and of the blocks
+  long long blockKeys = ems::verifyBlockBytes / sizeof(key);
+  std::vector<long long> positions = { 1, numValues - 1, blockKeys, blockKeys + 1 };
+  for (int i = 1; i < numThreads; i++) {
+    positions.push_back(numValues * i / numThreads);
+    positions.push_back(numValues * i / numThreads + 1);
+  }
+  for (long long pos : positions) {
+    if ((pos <= 0) || (pos >= numValues)) continue;
+    std::vector<key> unsorted = values;
+    unsorted[pos] = unsorted[pos - 1];
+    unsorted[pos - 1] = std::numeric_limits<key>::max();
+    ems::FileSummary unsortedSummary;
+    if (!summarize(unsorted, numThreads, unsortedSummary)) return false;
+    if (unsortedSummary.sorted) return false;
+  }
+  return true;
+}
+
+//The hash does not depend on the order of the keys nor on the number of threads, but changes with the multiset
+template<typename key>
+bool testHash(long long numValues) {
+  std::mt19937_64 gen(numValues);
+  std::uniform_int_distribution<int> dist(0, 100);
+  std::vector<key> values(numValues);
+  for (auto &val : values) val = static_cast<key>(dist(gen));
+
+  ems::FileSummary summary;
+  if (!summarize(values, 3, summary)) return false;
+
+  std::vector<key> sorted = values;
+  std::sort(sorted.begin(), sorted.end());
+  ems::FileSummary sortedSummary;
+  if (!summarize(sorted, 1, sortedSummary)) return false;
+  if (sortedSummary.hash != summary.hash) return false;
+
+  //A key replaced by another one, a duplicated key replacing another, an additional zero key
+  std::vector<key> changed = sorted;
+  changed[numValues / 2] = static_cast<key>(1000);
+  ems::FileSummary changedSummary;
+  if (!summarize(changed, 2, changedSummary) || (changedSummary.hash == summary.hash)) return false;
+  changed = sorted;
+  changed[numValues - 1] = changed[0];
+  if (!summarize(changed, 2, changedSummary) || (changedSummary.hash == summary.hash)) return false;
+  changed = sorted;
+  changed.insert(changed.begin(), key());
+  if (!summarize(changed, 2, changedSummary) || (changedSummary.hash == summary.hash)) return false;
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  for (int numThreads : { 1, 2, 3, 8 }) {
+    for (long long numValues : { 1, 2, 1000, 1000000 }) {
+      if (!testSortedness<uint32_t>(numValues, numThreads)) return 1;
+      if (!testSortedness<int64_t>(numValues, numThreads)) return 1;
+      if (!testSortedness<float>(numValues, numThreads)) return 1;
+    }
+  }
+
+  for (long long numValues : { 10, 100000 }) {
+    if (!testHash<uint8_t>(numValues)) return 1;
+    if (!testHash<uint32_t>(numValues)) return 1;
+    if (!testHash<double>(numValues)) return 1;
+  }
+
+  //NaNs come after all other keys, -0 and +0 are equal, NaNs of different payloads have different hashes
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  ems::FileSummary summary;
+  if (!summarize(std::vector<float>({ -1.0f, 2.0f, nan, -nan }), 1, summary) || !summary.sorted) return 1;
+  if (!summarize(std::vector<float>({ -1.0f, nan, 2.0f }), 1, summary) || summary.sorted) return 1;
+  if (!summarize(std::vector<float>({ 1.0f, nan, 0.0f }), 1, summary) || summary.sorted) return 1;
+  if (!summarize(std::vector<float>({ 0.0f, -0.0f, 0.0f, std::numeric_limits<float>::infinity(), nan }), 1, summary) || !summary.sorted) return 1;
+  if (ems::keyHash(std::numeric_limits<float>::quiet_NaN()) == ems::keyHash(-std::numeric_limits<float>::signaling_NaN())) return 1;
+
+  //Files differing only by the payload of a NaN are not permutations of each other
+  std::vector<double> withNaN = { -1.0, 2.0, std::numeric_limits<double>::quiet_NaN() };
+  std::string inputName = writeFile(withNaN);
+  uint64_t nanBits;
+  std::memcpy(&nanBits, &withNaN[2], sizeof(double));
+  nanBits ^= 1;
+  std::memcpy(&withNaN[2], &nanBits, sizeof(double));
+  std::string sortedName = writeFile(withNaN);
+  bool samePayloadValid = ems::verifySortedFile<double>(inputName, inputName, 1);
+  bool otherPayloadValid = ems::verifySortedFile<double>(sortedName, inputName, 1);
+  remove(inputName.c_str());
+  remove(sortedName.c_str());
+  if (!samePayloadValid || otherPayloadValid) return 1;
+
+  //A NaN followed by a finite key breaks the order within a block, across blocks and across the ranges of the threads
+  std::vector<double> doubles(1000000);
+  for (size_t i = 0; i < doubles.size(); i++) doubles[i] = static_cast<double>(i);
+  for (size_t i = doubles.size() - 1000; i < doubles.size(); i++) doubles[i] = std::numeric_limits<double>::quiet_NaN();
+  if (!summarize(doubles, 8, summary) || !summary.sorted) return 1;
+  for (long long pos : { 1000LL, 131071LL, 499999LL }) {
+    double value = doubles[pos];
+    doubles[pos] = std::numeric_limits<double>::quiet_NaN();
+    if (!summarize(doubles, 2, summary) || summary.sorted) return 1;
+    doubles[pos] = value;
+  }
+
+  //An empty file is sorted, a file of a partial key cannot be verified
+  ems::FileSummary emptySummary;
+  if (!summarize(std::vector<uint32_t>(), 4, emptySummary) || emptySummary.numValues || !emptySummary.sorted) return 1;
+  if (ems::checkSortedFile<uint32_t>("testverifyfile_missing")) return 1;
+  std::string fileName = writeFile(std::vector<uint8_t>(3));
+  bool thrown = false;
+  try {
+    ems::summarizeFile<uint16_t>(fileName);
+  }
+  catch (std::ios_base::failure &) {
+    thrown = true;
+  }
+  remove(fileName.c_str());
+  if (!thrown) return 1;
+
+  return 0;
+}